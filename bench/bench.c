@@ -0,0 +1,332 @@
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "api.h"
+#include "config.h"
+#include "popup.h"
+#include "util.h"
+
+/* Replay benchmark for the parse / format / render hot paths.
+ *
+ * Why replay recorded inputs through the real modules:
+ * - The numbers are only useful if they come from the code that ships,
+ *   so bodies go through api_parse_usage(), credentials through
+ *   config_read_credentials() and the popup through render_surface()
+ *   into its off-screen DIB, exactly as at runtime
+ * - Inputs are files (bench/data, copied next to the binary), so a body
+ *   captured from a user report can be dropped in and measured
+ *
+ * Why count allocations:
+ * - Most of the hot paths are meant to run out of stack arenas and
+ *   pooled buffers; an allocation per op creeping back in is a
+ *   regression even when the time barely moves. The target links with
+ *   -Wl,--wrap for malloc/calloc/realloc, so every call made by our own
+ *   objects (not by Windows DLLs) lands in the counters below
+ */
+
+static LONG g_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    g_allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    g_allocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    g_allocs++;
+    return __real_realloc(p, size);
+}
+
+/* Run each benchmark for about this long */
+#define BENCH_TARGET_MS 250.0
+#define BENCH_MAX_BODIES 16
+
+typedef void (*BenchFunc)(void *ctx, LONGLONG i);
+
+static double g_ticks_per_ns;
+
+static LONGLONG now_ticks(void)
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+static double run_for(BenchFunc fn, void *ctx, LONGLONG iters)
+{
+    LONGLONG start = now_ticks();
+    for (LONGLONG i = 0; i < iters; i++)
+        fn(ctx, i);
+    return (now_ticks() - start) / g_ticks_per_ns;
+}
+
+/* Calibrate the iteration count, then time one full run */
+static void bench(const char *name, BenchFunc fn, void *ctx)
+{
+    fn(ctx, 0);  /* Warm caches and one-time setup */
+
+    LONGLONG iters = 1;
+    double ns = run_for(fn, ctx, iters);
+    while (ns < BENCH_TARGET_MS * 1e6 / 10 && iters < (1LL << 30)) {
+        iters *= 2;
+        ns = run_for(fn, ctx, iters);
+    }
+    iters = (LONGLONG)(iters * (BENCH_TARGET_MS * 1e6 / (ns > 1 ? ns : 1)));
+    if (iters < 1) iters = 1;
+
+    g_allocs = 0;
+    ns = run_for(fn, ctx, iters);
+    printf("%-34s %12.0f ns/op %8.2f allocs/op %10lld ops\n",
+           name, ns / iters, (double)g_allocs / iters, iters);
+}
+
+/* ---- Inputs ---- */
+
+typedef struct {
+    char  name[MAX_PATH];
+    char *body;
+} RecordedBody;
+
+static char *read_file(const wchar_t *path)
+{
+    HANDLE h = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                           OPEN_EXISTING, 0, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    char *buf = NULL;
+    DWORD size = GetFileSize(h, NULL);
+    if (size == INVALID_FILE_SIZE || size > 1024 * 1024)
+        goto done;
+    buf = (char *)malloc(size + 1);
+    DWORD got = 0;
+    if (!buf || !ReadFile(h, buf, size, &got, NULL)) {
+        free(buf);
+        buf = NULL;
+        goto done;
+    }
+    buf[got] = '\0';
+
+done:
+    CloseHandle(h);
+    return buf;
+}
+
+/* Every usage-*.json in 'dir' */
+static int load_bodies(const wchar_t *dir, RecordedBody *out, int max)
+{
+    wchar_t pattern[MAX_PATH_LEN];
+    _snwprintf(pattern, MAX_PATH_LEN, L"%s\\usage-*.json", dir);
+
+    WIN32_FIND_DATAW fd;
+    HANDLE find = FindFirstFileW(pattern, &fd);
+    if (find == INVALID_HANDLE_VALUE)
+        return 0;
+
+    int n = 0;
+    do {
+        wchar_t path[MAX_PATH_LEN];
+        _snwprintf(path, MAX_PATH_LEN, L"%s\\%s", dir, fd.cFileName);
+        char *body = read_file(path);
+        if (!body)
+            continue;
+        WideCharToMultiByte(CP_UTF8, 0, fd.cFileName, -1,
+                            out[n].name, MAX_PATH, NULL, NULL);
+        out[n].body = body;
+        n++;
+    } while (n < max && FindNextFileW(find, &fd));
+
+    FindClose(find);
+    return n;
+}
+
+/* Fields a parsed body fills in, so bodies can be compared */
+static int populated_fields(const UsageData *u)
+{
+    if (!u->valid)
+        return -1;
+    return (u->five_hour_util >= 0) + (u->five_hour_resets[0] != '\0') +
+           (u->seven_day_util >= 0) + (u->seven_day_resets[0] != '\0') +
+           (u->opus_util >= 0) + (u->sonnet_util >= 0) +
+           (u->extra_enabled != FALSE) + (u->subscription_type[0] != '\0');
+}
+
+/* The body that drives the formatting and render benchmarks.
+ *
+ * Why pick it explicitly:
+ * - FindNextFileW order is up to the file system, so "the last one
+ *   loaded" was usage-max.json on NTFS but could be any body elsewhere,
+ *   and the numbers moved with it
+ * - usage-max.json is the reference input; a data directory without it
+ *   uses the valid body with the most fields set (the first such body by
+ *   name on a tie), which exercises the most of the popup layout
+ */
+static int pick_reference_body(const RecordedBody *bodies, int n)
+{
+    int best = 0, best_fields = -2;
+    for (int i = 0; i < n; i++) {
+        if (_stricmp(bodies[i].name, "usage-max.json") == 0)
+            return i;
+        UsageData u;
+        api_parse_usage(bodies[i].body, &u);
+        int fields = populated_fields(&u);
+        if (fields > best_fields ||
+            (fields == best_fields && _stricmp(bodies[i].name, bodies[best].name) < 0)) {
+            best = i;
+            best_fields = fields;
+        }
+    }
+    return best;
+}
+
+/* ---- Benchmarks ---- */
+
+static void op_parse(void *ctx, LONGLONG i)
+{
+    (void)i;
+    UsageData u;
+    api_parse_usage((const char *)ctx, &u);
+}
+
+static void op_format_json(void *ctx, LONGLONG i)
+{
+    (void)i;
+    char buf[1024];
+    api_format_usage_json((const UsageData *)ctx, buf, sizeof(buf));
+}
+
+static void op_parse_iso8601(void *ctx, LONGLONG i)
+{
+    (void)i;
+    SYSTEMTIME st;
+    util_parse_iso8601((const char *)ctx, &st);
+}
+
+static void op_iso8601_to_unix(void *ctx, LONGLONG i)
+{
+    (void)i;
+    LONGLONG t;
+    util_iso8601_to_unix((const char *)ctx, &t);
+}
+
+static void op_time_remaining(void *ctx, LONGLONG i)
+{
+    (void)i;
+    wchar_t buf[32];
+    util_format_time_remaining((const SYSTEMTIME *)ctx, buf, 32);
+}
+
+static void op_credentials_full(void *ctx, LONGLONG i)
+{
+    (void)i;
+    Credentials creds;
+    memset(&creds, 0, sizeof(creds));  /* Not loaded: always read + parse */
+    config_read_credentials((const wchar_t *)ctx, &creds);
+}
+
+static Credentials g_cached_creds;
+
+static void op_credentials_unchanged(void *ctx, LONGLONG i)
+{
+    (void)i;
+    config_read_credentials((const wchar_t *)ctx, &g_cached_creds);
+}
+
+/* Alternate between two samples: what a poll with new numbers costs */
+typedef struct {
+    UsageData a, b;
+} RenderPair;
+
+static void op_render(void *ctx, LONGLONG i)
+{
+    RenderPair *p = (RenderPair *)ctx;
+    popup_render_offscreen((i & 1) ? &p->b : &p->a);
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    g_ticks_per_ns = freq.QuadPart / 1e9;
+
+    arena_json_install();
+
+    /* Data directory: argument, or bench-data next to the executable */
+    wchar_t dir[MAX_PATH_LEN];
+    if (argc > 1) {
+        wcsncpy(dir, argv[1], MAX_PATH_LEN - 1);
+        dir[MAX_PATH_LEN - 1] = L'\0';
+    } else {
+        GetModuleFileNameW(NULL, dir, MAX_PATH_LEN);
+        wchar_t *slash = wcsrchr(dir, L'\\');
+        if (slash) *slash = L'\0';
+        wcsncat(dir, L"\\bench-data", MAX_PATH_LEN - wcslen(dir) - 1);
+    }
+
+    RecordedBody bodies[BENCH_MAX_BODIES];
+    int nbodies = load_bodies(dir, bodies, BENCH_MAX_BODIES);
+    if (nbodies == 0) {
+        fwprintf(stderr, L"No usage-*.json bodies in %s\n", dir);
+        return 1;
+    }
+
+    char name[128];
+    for (int i = 0; i < nbodies; i++) {
+        snprintf(name, sizeof(name), "api.parse %s", bodies[i].name);
+        bench(name, op_parse, bodies[i].body);
+    }
+
+    int ref = pick_reference_body(bodies, nbodies);
+    printf("Reference body: %s\n", bodies[ref].name);
+
+    UsageData usage;
+    api_parse_usage(bodies[ref].body, &usage);
+    strcpy(usage.subscription_type, "max");
+
+    bench("api.format_usage_json", op_format_json, &usage);
+    bench("util.parse_iso8601", op_parse_iso8601, usage.five_hour_resets);
+    bench("util.iso8601_to_unix", op_iso8601_to_unix, usage.five_hour_resets);
+
+    SYSTEMTIME reset;
+    util_parse_iso8601(usage.seven_day_resets, &reset);
+    bench("util.format_time_remaining", op_time_remaining, &reset);
+
+    wchar_t cred_path[MAX_PATH_LEN];
+    _snwprintf(cred_path, MAX_PATH_LEN, L"%s\\credentials.json", dir);
+    if (GetFileAttributesW(cred_path) != INVALID_FILE_ATTRIBUTES) {
+        bench("config.read_credentials", op_credentials_full, cred_path);
+        bench("config.read_credentials unchanged", op_credentials_unchanged,
+              cred_path);
+    }
+
+    popup_register(GetModuleHandleW(NULL));
+    RenderPair pair;
+    pair.a = usage;
+    pair.b = usage;
+    pair.b.five_hour_util += 1.0;         /* One section redrawn */
+    bench("popup.render changed value", op_render, &pair);
+    pair.b = usage;
+    pair.b.extra_enabled = !usage.extra_enabled;  /* Layout change */
+    bench("popup.render full", op_render, &pair);
+    pair.b = usage;
+    bench("popup.render unchanged", op_render, &pair);
+    popup_shutdown();
+
+    for (int i = 0; i < nbodies; i++)
+        free(bodies[i].body);
+    return 0;
+}
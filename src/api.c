@@ -1,7 +1,10 @@
 #include "api.h"
 #include "http.h"
 #include "util.h"
+#include "arena.h"
+#include "diag.h"
 #include "cJSON.h"
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -24,73 +27,149 @@ static void parse_usage_field(cJSON *root, const char *name,
         strncpy(resets, r->valuestring, resets_len - 1);
 }
 
-void api_fetch_usage(const char *access_token, UsageData *out)
+/* Last successful response per account, for conditional requests.
+ *
+ * Why cache in api.c:
+ * - The usage numbers only change when the user actually uses Claude, so
+ *   most polls could be answered with "304 Not Modified"
+ * - On 304 we hand back the previous UsageData without touching cJSON
+ *
+ * Why keyed by a token hash:
+ * - A cached body belongs to one account; if the token changes to another
+ *   account, its validators must not be reused
+ * - With several accounts configured, each keeps its own slot, so polling
+ *   them in turn doesn't evict each other's validators
+ *
+ * Why an SRW lock:
+ * - Async responses are parsed on WinHTTP worker threads while the UI
+ *   thread builds the next request's headers
+ * - SRWLOCK_INIT needs no runtime initialization
+ */
+typedef struct {
+    ULONGLONG token_hash;
+    char      etag[128];
+    char      last_modified[64];
+    UsageData last;
+    BOOL      valid;
+} UsageCache;
+
+#define API_CACHE_SLOTS 4  /* MAX_ACCOUNTS */
+
+static UsageCache g_cache[API_CACHE_SLOTS];
+static int g_cache_next;   /* Slot to reuse when all are taken */
+static SRWLOCK g_cache_lock = SRWLOCK_INIT;
+
+/* Slot holding 'token_hash', or NULL. Caller holds g_cache_lock. */
+static UsageCache *cache_find(ULONGLONG token_hash)
+{
+    for (int i = 0; i < API_CACHE_SLOTS; i++)
+        if (g_cache[i].valid && g_cache[i].token_hash == token_hash)
+            return &g_cache[i];
+    return NULL;
+}
+
+/* Stack arena for parsing a usage response. The typical body is ~500 bytes
+ * and its cJSON tree needs ~2KB; larger bodies spill over to malloc. */
+#define API_JSON_ARENA_SIZE 8192
+
+struct ApiRequest {
+    HttpRequest *http;
+    HWND         hwnd;
+    UINT         msg;
+    WPARAM       id;
+    ULONGLONG    token_hash;
+};
+
+static void init_usage(UsageData *out)
 {
     memset(out, 0, sizeof(*out));
     out->opus_util = -1.0;
     out->sonnet_util = -1.0;
     out->five_hour_util = -1.0;
     out->seven_day_util = -1.0;
+}
 
-    /* Build headers */
-    wchar_t headers[1024];
-    _snwprintf(headers, 1024,
+static void build_headers(const char *access_token, wchar_t *headers, int len)
+{
+    int n = _snwprintf(headers, len,
         L"Authorization: Bearer %hs\r\n"
         L"anthropic-beta: oauth-2025-04-20\r\n"
         L"Accept: application/json\r\n",
         access_token);
+    if (n < 0 || n >= len) return;
 
-    HttpResponse resp = http_get(L"api.anthropic.com",
-                                  INTERNET_DEFAULT_HTTPS_PORT,
-                                  L"/api/oauth/usage",
-                                  headers);
-
-    if (resp.error_code != 0) {
-        DWORD ec = resp.error_code;
-        if (ec == 12029) /* ERROR_WINHTTP_CANNOT_CONNECT */
-            snprintf(out->error, sizeof(out->error),
-                     "Cannot connect to api.anthropic.com");
-        else if (ec == 12002) /* ERROR_WINHTTP_TIMEOUT */
-            snprintf(out->error, sizeof(out->error), "Request timed out");
-        else if (ec == 12007) /* ERROR_WINHTTP_NAME_NOT_RESOLVED */
-            snprintf(out->error, sizeof(out->error), "DNS resolution failed");
-        else
-            snprintf(out->error, sizeof(out->error),
-                     "Network error (code %lu)", ec);
-        http_response_free(&resp);
-        return;
+    /* Validators from the last 200 for this token, if any */
+    ULONGLONG hash = util_hash_string(access_token);
+    AcquireSRWLockShared(&g_cache_lock);
+    const UsageCache *c = cache_find(hash);
+    if (c) {
+        if (c->etag[0])
+            n += _snwprintf(headers + n, len - n,
+                            L"If-None-Match: %hs\r\n", c->etag);
+        if (c->last_modified[0] && n >= 0 && n < len)
+            _snwprintf(headers + n, len - n,
+                       L"If-Modified-Since: %hs\r\n", c->last_modified);
     }
+    ReleaseSRWLockShared(&g_cache_lock);
+}
 
-    if (resp.status_code == 401) {
-        snprintf(out->error, sizeof(out->error),
-                 "Token expired - reopen Claude Code");
-        http_response_free(&resp);
-        return;
-    }
-    if (resp.status_code == 403) {
-        snprintf(out->error, sizeof(out->error), "Access denied");
-        http_response_free(&resp);
-        return;
-    }
-    if (resp.status_code != 200) {
-        snprintf(out->error, sizeof(out->error),
-                 "API error (HTTP %d)", resp.status_code);
-        http_response_free(&resp);
-        return;
+/* Remember a successful response so the next poll can be conditional */
+static void cache_store(ULONGLONG token_hash, const HttpResponse *resp,
+                        const UsageData *data)
+{
+    AcquireSRWLockExclusive(&g_cache_lock);
+    UsageCache *c = cache_find(token_hash);
+    if (resp->etag[0] || resp->last_modified[0]) {
+        if (!c) {
+            for (int i = 0; i < API_CACHE_SLOTS && !c; i++)
+                if (!g_cache[i].valid)
+                    c = &g_cache[i];
+            if (!c) {
+                c = &g_cache[g_cache_next];
+                g_cache_next = (g_cache_next + 1) % API_CACHE_SLOTS;
+            }
+        }
+        c->token_hash = token_hash;
+        memcpy(c->etag, resp->etag, sizeof(c->etag));
+        memcpy(c->last_modified, resp->last_modified, sizeof(c->last_modified));
+        c->last = *data;
+        c->valid = TRUE;
+    } else if (c) {
+        c->valid = FALSE;  /* Server stopped sending validators */
     }
+    ReleaseSRWLockExclusive(&g_cache_lock);
+}
 
-    if (!resp.body) {
-        snprintf(out->error, sizeof(out->error), "Empty response");
-        http_response_free(&resp);
-        return;
+static BOOL cache_load(ULONGLONG token_hash, UsageData *out)
+{
+    BOOL hit = FALSE;
+    AcquireSRWLockShared(&g_cache_lock);
+    const UsageCache *c = cache_find(token_hash);
+    if (c) {
+        *out = c->last;
+        hit = TRUE;
     }
+    ReleaseSRWLockShared(&g_cache_lock);
+    return hit;
+}
 
-    cJSON *root = cJSON_Parse(resp.body);
-    http_response_free(&resp);
+/* Extract the usage fields from a response body into 'out'.
+ * The whole cJSON tree lives in a stack arena, so this makes no heap
+ * allocations for typical responses. */
+static BOOL parse_usage_json(const char *body, UsageData *out)
+{
+    char arena_mem[API_JSON_ARENA_SIZE];
+    Arena arena;
+    arena_init(&arena, arena_mem, sizeof(arena_mem));
+    arena_json_begin(&arena);
+
+    LONGLONG t0 = diag_begin();
+    cJSON *root = cJSON_Parse(body);
 
     if (!root) {
+        /* Still timed: a failed parse is the case worth seeing */
         snprintf(out->error, sizeof(out->error), "JSON parse error");
-        return;
+        goto done;
     }
 
     parse_usage_field(root, "five_hour",
@@ -126,4 +205,251 @@ void api_fetch_usage(const char *access_token, UsageData *out)
 
     out->valid = TRUE;
     cJSON_Delete(root);
+
+done:
+    arena_json_end();
+    diag_end(DIAG_PARSE, t0);
+    return out->valid;
+}
+
+BOOL api_parse_usage(const char *body, UsageData *out)
+{
+    init_usage(out);
+    return parse_usage_json(body, out);
+}
+
+/* Retry-After is a DWORD (an HTTP-date can be years away); keep it from
+ * going negative as an int. retry.c caps what we actually wait. */
+static int clamp_retry_after(DWORD sec)
+{
+    return sec > 0x7FFFFFFF ? 0x7FFFFFFF : (int)sec;
+}
+
+/* Map an HTTP result to UsageData. Shared by the blocking and async paths. */
+static void parse_response(HttpResponse *resp, ULONGLONG token_hash,
+                           UsageData *out)
+{
+    init_usage(out);
+
+    if (resp->error_code != 0) {
+        DWORD ec = resp->error_code;
+        /* Anything but our own cancellation may clear up on its own */
+        out->retryable = (ec != 12017); /* ERROR_WINHTTP_OPERATION_CANCELLED */
+        if (ec == 12029) /* ERROR_WINHTTP_CANNOT_CONNECT */
+            snprintf(out->error, sizeof(out->error),
+                     "Cannot connect to api.anthropic.com");
+        else if (ec == 12002) /* ERROR_WINHTTP_TIMEOUT */
+            snprintf(out->error, sizeof(out->error), "Request timed out");
+        else if (ec == 12007) /* ERROR_WINHTTP_NAME_NOT_RESOLVED */
+            snprintf(out->error, sizeof(out->error), "DNS resolution failed");
+        else
+            snprintf(out->error, sizeof(out->error),
+                     "Network error (code %lu)", ec);
+        return;
+    }
+
+    if (resp->status_code == 401) {
+        snprintf(out->error, sizeof(out->error),
+                 "Token expired - reopen Claude Code");
+        out->auth_failed = TRUE;
+        return;
+    }
+    if (resp->status_code == 403) {
+        snprintf(out->error, sizeof(out->error), "Access denied");
+        return;
+    }
+    if (resp->not_modified && cache_load(token_hash, out)) {
+        out->fetched_at = util_unix_now();  /* The server just confirmed them */
+        return;
+    }
+    if (resp->status_code == 429) {
+        snprintf(out->error, sizeof(out->error), "Rate limited by API");
+        out->retryable = TRUE;
+        out->retry_after_sec = clamp_retry_after(resp->retry_after_sec);
+        return;
+    }
+    if (resp->status_code >= 500) {
+        snprintf(out->error, sizeof(out->error),
+                 "API error (HTTP %d)", resp->status_code);
+        out->retryable = TRUE;
+        out->retry_after_sec = clamp_retry_after(resp->retry_after_sec);
+        return;
+    }
+    if (resp->status_code != 200) {
+        snprintf(out->error, sizeof(out->error),
+                 "API error (HTTP %d)", resp->status_code);
+        return;
+    }
+
+    if (!resp->body) {
+        snprintf(out->error, sizeof(out->error), "Empty response");
+        return;
+    }
+
+    if (!parse_usage_json(resp->body, out))
+        return;
+    out->fetched_at = util_unix_now();
+    cache_store(token_hash, resp, out);
+}
+
+void api_fetch_usage(const char *access_token, UsageData *out)
+{
+    wchar_t headers[1024];
+    build_headers(access_token, headers, 1024);
+
+    HttpResponse resp = http_get(L"api.anthropic.com",
+                                  INTERNET_DEFAULT_HTTPS_PORT,
+                                  L"/api/oauth/usage",
+                                  headers);
+    parse_response(&resp, util_hash_string(access_token), out);
+    http_response_free(&resp);
+}
+
+/* Async completion: runs on a WinHTTP worker thread.
+ *
+ * Why parse here instead of on the UI thread:
+ * - Keeps the message loop free of everything but applying the result
+ * - parse_response() only touches the response and the new UsageData
+ *
+ * Why post a heap UsageData instead of writing into g_app directly:
+ * - The UI thread owns g_app; handing over a private copy needs no locking
+ */
+static void on_usage_response(HttpResponse *resp, void *ctx)
+{
+    ApiRequest *req = (ApiRequest *)ctx;
+    UsageData *data = (UsageData *)malloc(sizeof(*data));
+    if (data)
+        parse_response(resp, req->token_hash, data);
+    if (!PostMessageW(req->hwnd, req->msg, req->id, (LPARAM)data))
+        free(data);
+}
+
+ApiRequest *api_fetch_usage_async(const char *access_token,
+                                  HWND hwnd, UINT msg, WPARAM id)
+{
+    ApiRequest *req = (ApiRequest *)calloc(1, sizeof(*req));
+    if (!req) return NULL;
+    req->hwnd = hwnd;
+    req->msg  = msg;
+    req->id   = id;
+    req->token_hash = util_hash_string(access_token);
+
+    wchar_t headers[1024];
+    build_headers(access_token, headers, 1024);
+
+    req->http = http_get_async(L"api.anthropic.com",
+                               INTERNET_DEFAULT_HTTPS_PORT,
+                               L"/api/oauth/usage",
+                               headers, on_usage_response, req);
+    if (!req->http) {
+        free(req);
+        return NULL;
+    }
+    return req;
+}
+
+void api_request_cancel(ApiRequest *req)
+{
+    if (!req) return;
+    http_cancel(req->http);  /* After this, on_usage_response can't touch req */
+    free(req);
+}
+
+void api_request_release(ApiRequest *req)
+{
+    if (!req) return;
+    http_release(req->http);
+    free(req);
+}
+
+void api_warmup(void)
+{
+    http_warmup(L"api.anthropic.com", INTERNET_DEFAULT_HTTPS_PORT);
+}
+
+/* Bounded append for api_format_usage_json(). Once the buffer overflows,
+ * 'pos' sticks past 'len' and further appends are no-ops. */
+typedef struct {
+    char *buf;
+    int   len;
+    int   pos;
+} JsonWriter;
+
+static void json_printf(JsonWriter *w, const char *fmt, ...)
+{
+    if (w->pos >= w->len)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(w->buf + w->pos, w->len - w->pos, fmt, ap);
+    va_end(ap);
+    w->pos = (n < 0) ? w->len : w->pos + n;
+}
+
+static void json_string(JsonWriter *w, const char *s)
+{
+    json_printf(w, "\"");
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            json_printf(w, "\\%c", c);
+        else if (c < 0x20)
+            json_printf(w, "\\u%04x", c);
+        else
+            json_printf(w, "%c", c);
+    }
+    json_printf(w, "\"");
+}
+
+static void json_window(JsonWriter *w, const char *name,
+                        double util, const char *resets)
+{
+    json_printf(w, "\"%s\":", name);
+    if (util < 0) {
+        json_printf(w, "null,");
+        return;
+    }
+    json_printf(w, "{\"utilization\":%.1f,\"resets_at\":", util);
+    if (resets && resets[0])
+        json_string(w, resets);
+    else
+        json_printf(w, "null");
+    json_printf(w, "},");
+}
+
+/* Field names follow the API response, so scripts written against
+ * /api/oauth/usage can switch to the local copy unchanged. */
+int api_format_usage_json(const UsageData *usage, char *buf, int len)
+{
+    JsonWriter w = {buf, len, 0};
+
+    json_printf(&w, "{\"valid\":%s,", usage->valid ? "true" : "false");
+    if (usage->valid) {
+        json_window(&w, "five_hour", usage->five_hour_util,
+                    usage->five_hour_resets);
+        json_window(&w, "seven_day", usage->seven_day_util,
+                    usage->seven_day_resets);
+        json_window(&w, "seven_day_opus", usage->opus_util, NULL);
+        json_window(&w, "seven_day_sonnet", usage->sonnet_util, NULL);
+        if (usage->extra_enabled)
+            json_printf(&w, "\"extra_usage\":{\"is_enabled\":true,"
+                        "\"monthly_limit\":%.0f,\"used_credits\":%.2f},",
+                        usage->extra_limit, usage->extra_used);
+        else
+            json_printf(&w, "\"extra_usage\":null,");
+    } else {
+        json_printf(&w, "\"error\":");
+        json_string(&w, usage->error);
+        json_printf(&w, ",");
+    }
+    json_printf(&w, "\"subscription_type\":");
+    json_string(&w, usage->subscription_type);
+    json_printf(&w, "}\n");
+
+    if (w.pos >= len) {
+        if (len > 0)
+            buf[0] = '\0';
+        return -1;
+    }
+    return w.pos;
 }
@@ -16,11 +16,44 @@ typedef struct {
     char   subscription_type[32]; /* e.g., "pro", "max", "max_200" */
     BOOL   valid;
     char   error[256];
+    BOOL   retryable;            /* Transient failure (429, 5xx, network): worth retrying */
+    int    retry_after_sec;      /* Server-requested delay (Retry-After), 0 if none */
+    BOOL   auth_failed;          /* 401: the token was rejected (expired or revoked) */
+    int    five_hour_limit_sec;  /* Forecast: seconds until 100% at the current rate, */
+    int    seven_day_limit_sec;  /*   0 if not before the reset (see forecast.c) */
+    LONGLONG fetched_at;         /* Unix time these numbers came from the API, 0 if unknown */
 } UsageData;
 
+/* Opaque handle for an asynchronous usage fetch. */
+typedef struct ApiRequest ApiRequest;
+
 /* Fetch usage data from the Anthropic OAuth endpoint.
    access_token: OAuth bearer token (sk-ant-oat01-...)
    out: populated with results on return */
 void api_fetch_usage(const char *access_token, UsageData *out);
 
+/* Fetch usage data without blocking.
+   On completion, posts 'msg' to 'hwnd' with wParam = id and
+   lParam = heap-allocated UsageData* (receiver must free(); NULL if out
+   of memory). Returns NULL if the request could not be started.
+   Call api_request_release() after the message arrives, or
+   api_request_cancel() to abandon it (no message is posted afterwards,
+   but one posted earlier may still be queued - compare ids). */
+ApiRequest *api_fetch_usage_async(const char *access_token,
+                                  HWND hwnd, UINT msg, WPARAM id);
+
+void api_request_cancel(ApiRequest *req);
+void api_request_release(ApiRequest *req);
+
+/* Parse a usage response body (as returned with HTTP 200) into 'out'.
+   The same parser the fetch paths use; for replaying recorded bodies. */
+BOOL api_parse_usage(const char *body, UsageData *out);
+
+/* Pre-connect to the API host (after startup or resume from sleep). */
+void api_warmup(void);
+
+/* Format 'usage' as one line of JSON (newline-terminated) using the API's
+   field names. Returns the length written, or -1 if 'buf' is too small. */
+int api_format_usage_json(const UsageData *usage, char *buf, int len);
+
 #endif
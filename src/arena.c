@@ -0,0 +1,77 @@
+#include "arena.h"
+#include "cJSON.h"
+#include <stdlib.h>
+
+/* Allocation alignment: enough for any cJSON member (double, pointers) */
+#define ARENA_ALIGN 16
+
+/* Active arena for the current thread.
+ *
+ * Why thread-local:
+ * - cJSON hooks are process-wide, but responses are parsed on WinHTTP
+ *   worker threads while the UI thread may be parsing the credentials
+ *   file; each thread gets its own scope and no locking is needed
+ */
+static _Thread_local Arena *t_arena = NULL;
+
+void arena_init(Arena *a, void *mem, size_t cap)
+{
+    a->base = (char *)mem;
+    a->cap  = cap;
+    a->used = 0;
+}
+
+void *arena_alloc(Arena *a, size_t size)
+{
+    size_t start = (a->used + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1);
+    if (start > a->cap || size > a->cap - start)
+        return NULL;
+    a->used = start + size;
+    return a->base + start;
+}
+
+static void *json_malloc(size_t size)
+{
+    if (t_arena) {
+        void *p = arena_alloc(t_arena, size);
+        if (p) return p;
+    }
+    return malloc(size);
+}
+
+/* Frees of arena memory are no-ops; the whole arena goes away with its
+ * stack frame. Anything that spilled to malloc is freed normally. */
+static void json_free(void *p)
+{
+    Arena *a = t_arena;
+    if (a && (char *)p >= a->base && (char *)p < a->base + a->cap)
+        return;
+    free(p);
+}
+
+/* Route cJSON through the arena hooks.
+ *
+ * Why hook cJSON instead of writing a custom parser:
+ * - cJSON stays the single, battle-tested JSON implementation
+ * - A ~500 byte usage response needs a few dozen nodes; a few KB of stack
+ *   holds the whole tree, so a parse makes zero heap allocations and the
+ *   heap stays flat over weeks of polling
+ * - Outside an arena scope the hooks behave exactly like malloc/free
+ */
+void arena_json_install(void)
+{
+    cJSON_Hooks hooks;
+    hooks.malloc_fn = json_malloc;
+    hooks.free_fn   = json_free;
+    cJSON_InitHooks(&hooks);
+}
+
+void arena_json_begin(Arena *a)
+{
+    t_arena = a;
+}
+
+void arena_json_end(void)
+{
+    t_arena = NULL;
+}
@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Bump allocator over caller-provided memory (typically a stack buffer). */
+typedef struct {
+    char  *base;
+    size_t cap;
+    size_t used;
+} Arena;
+
+void arena_init(Arena *a, void *mem, size_t cap);
+
+/* Returns NULL when the arena is exhausted. */
+void *arena_alloc(Arena *a, size_t size);
+
+/* Install cJSON allocation hooks that honour arena_json_begin().
+   Call once at startup, before any cJSON use. */
+void arena_json_install(void);
+
+/* Route cJSON allocations made on the calling thread into 'a' (falling back
+   to malloc when it is full) until arena_json_end(). cJSON_Delete() on a
+   tree parsed inside the scope must also happen inside it. */
+void arena_json_begin(Arena *a);
+void arena_json_end(void);
+
+#endif
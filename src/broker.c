@@ -0,0 +1,294 @@
+#include "broker.h"
+#include <aclapi.h>
+#include <sddl.h>
+#include <shlobj.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BROKER_MAGIC 0x4B524243  /* "CBRK" */
+/* Give up on a torn read after this many tries (owner died mid-write) */
+#define BROKER_READ_SPINS 1000
+
+/* Owned by, and only open to, the current user (plus SYSTEM): another
+ * user must not read these numbers, publish forged ones, or hold the
+ * owner mutex. %s is the user's SID. */
+#define BROKER_SDDL_FMT L"O:%sD:P(A;;GA;;;SY)(A;;GA;;;%s)"
+
+/* Layout of the shared file.
+ *
+ * Why a seqlock instead of a named mutex around reads:
+ * - There is exactly one writer (the owner, elected by the owner mutex),
+ *   so readers never need to block it or each other
+ * - The owner makes 'seq' odd, writes, and makes it even again; a reader
+ *   retries if it saw an odd value or 'seq' moved during its copy
+ * - A reader that crashes can't leave a lock held and stall the owner
+ *
+ * 'size' guards against a different build with a different UsageData
+ * layout sharing the same file.
+ */
+typedef struct BrokerShared {
+    DWORD         magic;
+    DWORD         size;
+    volatile LONG seq;        /* Odd while being written; generation = seq / 2 */
+    DWORD         owner_pid;
+    UsageData     usage;
+} BrokerShared;
+
+static BOOL header_valid(const BrokerShared *sh)
+{
+    return sh->magic == BROKER_MAGIC && sh->size == sizeof(BrokerShared);
+}
+
+/* Take over the shared file as its single writer */
+static void init_owner(Broker *b)
+{
+    BrokerShared *sh = b->shared;
+    if (!header_valid(sh)) {
+        memset(sh, 0, sizeof(*sh));
+        sh->magic = BROKER_MAGIC;
+        sh->size = sizeof(BrokerShared);
+    } else if (sh->seq & 1) {
+        /* The previous owner died mid-write: drop the torn data */
+        memset(&sh->usage, 0, sizeof(sh->usage));
+        InterlockedIncrement(&sh->seq);
+    }
+    sh->owner_pid = GetCurrentProcessId();
+    b->role = BROKER_OWNER;
+}
+
+/* The current user's SID, as a SID (caller LocalFree()s) and a string
+ * (caller LocalFree()s) */
+static BOOL current_user_sid(PSID *sid, wchar_t **sid_str)
+{
+    HANDLE token;
+    BYTE buf[sizeof(TOKEN_USER) + SECURITY_MAX_SID_SIZE];
+    DWORD len = 0;
+    BOOL ok = FALSE;
+
+    *sid = NULL;
+    *sid_str = NULL;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+        return FALSE;
+    if (!GetTokenInformation(token, TokenUser, buf, sizeof(buf), &len))
+        goto cleanup;
+
+    PSID user = ((TOKEN_USER *)buf)->User.Sid;
+    DWORD size = GetLengthSid(user);
+    *sid = LocalAlloc(LMEM_FIXED, size);
+    if (!*sid || !CopySid(size, *sid, user))
+        goto cleanup;
+    ok = ConvertSidToStringSidW(*sid, sid_str);
+
+cleanup:
+    CloseHandle(token);
+    if (!ok) {
+        LocalFree(*sid);
+        *sid = NULL;
+    }
+    return ok;
+}
+
+/* Refuse objects someone else created first under our name: whoever owns
+ * one can change its DACL, so its contents can't be trusted */
+static BOOL owned_by(HANDLE h, SE_OBJECT_TYPE type, PSID user)
+{
+    PSID owner = NULL;
+    PSECURITY_DESCRIPTOR sd = NULL;
+    if (GetSecurityInfo(h, type, OWNER_SECURITY_INFORMATION, &owner,
+                        NULL, NULL, NULL, &sd) != ERROR_SUCCESS)
+        return FALSE;
+    BOOL ok = owner && EqualSid(owner, user);
+    LocalFree(sd);
+    return ok;
+}
+
+/* Why these objects:
+ * - Owner election: a Global\ mutex. Whoever holds it polls; when that
+ *   process exits the mutex is released (or abandoned), and a reader
+ *   waiting on it in its message loop takes over
+ * - Data: a file-backed mapping in the user's local profile. A named
+ *   Global\ section would be simpler, but creating one requires
+ *   SeCreateGlobalPrivilege, which ordinary RDS users don't have;
+ *   mapping the same file gives every session the same pages
+ * - Notification: two manual-reset Global\ events used alternately. The
+ *   owner resets the next generation's event before publishing and sets
+ *   the current one after, so every waiting reader wakes exactly once per
+ *   generation without PulseEvent's lost wake-ups
+ *
+ * Why per Windows user:
+ * - The numbers are one person's usage, and a reader displays whatever
+ *   is in the file; letting other users open it would let them read it
+ *   or plant forged values. Sessions of the same user still share
+ * - The Global\ names carry the user's SID, the DACL admits only that
+ *   user and SYSTEM, and objects (or a file) with a different owner are
+ *   refused, so another user can't squat a name first
+ */
+BOOL broker_open(Broker *b, ULONGLONG account_hash)
+{
+    PSECURITY_DESCRIPTOR sd = NULL;
+    SECURITY_ATTRIBUTES sa;
+    PSID user = NULL;
+    wchar_t *user_str = NULL;
+    wchar_t key[32];
+    wchar_t sddl[512];
+    wchar_t name[320];
+    wchar_t dir[MAX_PATH];
+    wchar_t path[MAX_PATH + 64];
+
+    memset(b, 0, sizeof(*b));
+    b->file = INVALID_HANDLE_VALUE;
+
+    if (!current_user_sid(&user, &user_str))
+        return FALSE;
+    _snwprintf(sddl, 512, BROKER_SDDL_FMT, user_str, user_str);
+    sddl[511] = L'\0';
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(
+            sddl, SDDL_REVISION_1, &sd, NULL))
+        goto fail;
+    sa.nLength = sizeof(sa);
+    sa.lpSecurityDescriptor = sd;
+    sa.bInheritHandle = FALSE;
+
+    _snwprintf(key, 32, L"%08lx%08lx",
+               (unsigned long)(account_hash >> 32),
+               (unsigned long)(account_hash & 0xFFFFFFFF));
+
+    _snwprintf(name, 320, L"Global\\ClaudeUsage-%s-%s-Owner", user_str, key);
+    b->mutex = CreateMutexW(&sa, FALSE, name);
+    if (!b->mutex || !owned_by(b->mutex, SE_KERNEL_OBJECT, user))
+        goto fail;
+
+    for (int i = 0; i < 2; i++) {
+        _snwprintf(name, 320, L"Global\\ClaudeUsage-%s-%s-Update%d",
+                   user_str, key, i);
+        b->events[i] = CreateEventW(&sa, TRUE, FALSE, name);
+        if (!b->events[i] || !owned_by(b->events[i], SE_KERNEL_OBJECT, user))
+            goto fail;
+    }
+
+    if (FAILED(SHGetFolderPathW(NULL, CSIDL_LOCAL_APPDATA, NULL, 0, dir)))
+        goto fail;
+    wcsncat(dir, L"\\claudeusage", MAX_PATH - wcslen(dir) - 1);
+    CreateDirectoryW(dir, NULL);  /* Usually exists already */
+
+    _snwprintf(path, MAX_PATH + 64, L"%s\\broker-%s.bin", dir, key);
+    b->file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                          &sa, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (b->file == INVALID_HANDLE_VALUE ||
+        !owned_by(b->file, SE_FILE_OBJECT, user))
+        goto fail;
+
+    b->mapping = CreateFileMappingW(b->file, NULL, PAGE_READWRITE,
+                                    0, sizeof(BrokerShared), NULL);
+    if (!b->mapping)
+        goto fail;
+    b->shared = (BrokerShared *)MapViewOfFile(b->mapping,
+                                              FILE_MAP_READ | FILE_MAP_WRITE,
+                                              0, 0, sizeof(BrokerShared));
+    if (!b->shared)
+        goto fail;
+
+    LocalFree(sd);
+    LocalFree(user);
+    LocalFree(user_str);
+
+    DWORD w = WaitForSingleObject(b->mutex, 0);
+    if (w == WAIT_OBJECT_0 || w == WAIT_ABANDONED)
+        init_owner(b);
+    else
+        b->role = BROKER_READER;
+    return TRUE;
+
+fail:
+    LocalFree(sd);
+    LocalFree(user);
+    LocalFree(user_str);
+    broker_close(b);
+    return FALSE;
+}
+
+void broker_close(Broker *b)
+{
+    if (b->role == BROKER_OWNER)
+        ReleaseMutex(b->mutex);
+    if (b->shared)
+        UnmapViewOfFile(b->shared);
+    if (b->mapping)
+        CloseHandle(b->mapping);
+    if (b->file && b->file != INVALID_HANDLE_VALUE)
+        CloseHandle(b->file);
+    for (int i = 0; i < 2; i++) {
+        if (b->events[i])
+            CloseHandle(b->events[i]);
+    }
+    if (b->mutex)
+        CloseHandle(b->mutex);
+    memset(b, 0, sizeof(*b));
+}
+
+void broker_publish(Broker *b, const UsageData *usage)
+{
+    if (b->role != BROKER_OWNER)
+        return;
+
+    BrokerShared *sh = b->shared;
+    LONG gen = sh->seq / 2 + 1;
+
+    /* Readers that see this generation wait on the other event next */
+    ResetEvent(b->events[(gen + 1) & 1]);
+
+    InterlockedIncrement(&sh->seq);           /* Odd: write in progress */
+    memcpy((void *)&sh->usage, usage, sizeof(*usage));
+    InterlockedIncrement(&sh->seq);           /* Even: seq == gen * 2 */
+
+    SetEvent(b->events[gen & 1]);
+}
+
+BOOL broker_read(Broker *b, UsageData *out)
+{
+    if (b->role != BROKER_READER)
+        return FALSE;
+
+    BrokerShared *sh = b->shared;
+    if (!header_valid(sh))
+        return FALSE;
+
+    for (int i = 0; i < BROKER_READ_SPINS; i++) {
+        LONG seq = sh->seq;
+        if (seq == b->seen_seq)
+            return FALSE;
+        if (seq & 1) {
+            YieldProcessor();
+            continue;
+        }
+
+        UsageData copy;
+        MemoryBarrier();
+        memcpy(&copy, (const void *)&sh->usage, sizeof(copy));
+        MemoryBarrier();
+        if (sh->seq != seq)
+            continue;
+
+        *out = copy;
+        b->seen_seq = seq;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+HANDLE broker_update_event(Broker *b)
+{
+    return b->events[(b->seen_seq / 2 + 1) & 1];
+}
+
+HANDLE broker_owner_mutex(Broker *b)
+{
+    return b->mutex;
+}
+
+void broker_promote(Broker *b)
+{
+    if (b->role == BROKER_READER)
+        init_owner(b);
+}
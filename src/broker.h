@@ -0,0 +1,52 @@
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <windows.h>
+#include "api.h"
+
+typedef enum {
+    BROKER_OFF,     /* Standalone: poll on our own */
+    BROKER_OWNER,   /* We poll and publish for every instance of this account */
+    BROKER_READER   /* Another instance polls; we display what it publishes */
+} BrokerRole;
+
+struct BrokerShared;
+
+/* Shared usage cache for one account across one user's sessions. */
+typedef struct {
+    BrokerRole           role;
+    HANDLE               mutex;      /* Held by the owner */
+    HANDLE               events[2];  /* Alternating "generation published" events */
+    HANDLE               file;
+    HANDLE               mapping;
+    struct BrokerShared *shared;
+    LONG                 seen_seq;   /* Reader: last sequence number read */
+} Broker;
+
+/* Join the current Windows user's broker for the account identified by
+   'account_hash' (util_hash_string() of the token), becoming its owner if
+   nobody else is. Returns FALSE if the shared objects can't be created or
+   belong to someone else; poll standalone. */
+BOOL broker_open(Broker *b, ULONGLONG account_hash);
+
+/* Leave the broker. An owner hands polling over to one of the readers. */
+void broker_close(Broker *b);
+
+/* Owner: publish a fetch result to every reader. */
+void broker_publish(Broker *b, const UsageData *usage);
+
+/* Reader: copy the latest published data into 'out'.
+   Returns FALSE if nothing new has been published since the last call. */
+BOOL broker_read(Broker *b, UsageData *out);
+
+/* Reader: event that is signaled when the next generation is published. */
+HANDLE broker_update_event(Broker *b);
+
+/* Reader: the owner mutex. A wait on it succeeds when the owner exits,
+   after which the caller owns it and must call broker_promote(). */
+HANDLE broker_owner_mutex(Broker *b);
+
+/* Reader -> owner, after a wait on broker_owner_mutex() succeeded. */
+void broker_promote(Broker *b);
+
+#endif
@@ -0,0 +1,264 @@
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "config.h"
+#include "http.h"
+#include "api.h"
+#include "retry.h"
+#include "util.h"
+
+/* Exit codes, for monitoring agents that only look at $? */
+#define EXIT_OK          0
+#define EXIT_FETCH_ERROR 1  /* API or network error; details on stdout/stderr */
+#define EXIT_NO_CONFIG   2  /* No credentials path or no token */
+#define EXIT_USAGE       64
+
+/* Longest --watch interval accepted (one day) */
+#define WATCH_MAX_SEC    86400
+
+/* Set by Ctrl+C / Ctrl+Break / closing the console; ends --watch */
+static HANDLE g_stop;
+
+/* Headless front end over the same api.c/http.c/config.c core as the tray.
+ *
+ * Why a separate console binary instead of a flag on claudeusage.exe:
+ * - The tray is linked -mwindows, so it has no console to print to
+ * - Keeping window classes, icons and the message loop out of this
+ *   target means it starts in milliseconds and runs on CI runners and
+ *   schedulers without a desktop
+ */
+static void print_usage(void)
+{
+    fputs("Usage: claudeusage-cli [--json] [--watch [seconds]]\n"
+          "\n"
+          "  (no options)       print current usage once, human-readable\n"
+          "  --json             print current usage once as JSON\n"
+          "  --watch [seconds]  keep polling and print a line whenever usage\n"
+          "                     changes, until Ctrl+C (seconds: 1-86400,\n"
+          "                     default: api_poll_interval from config)\n",
+          stderr);
+}
+
+static void format_remaining(const char *resets_iso, char *out, int len)
+{
+    SYSTEMTIME st;
+    wchar_t remaining[32];
+
+    out[0] = '\0';
+    if (!resets_iso[0] || !util_parse_iso8601(resets_iso, &st))
+        return;
+    util_format_time_remaining(&st, remaining, 32);
+    WideCharToMultiByte(CP_UTF8, 0, remaining, -1, out, len, NULL, NULL);
+    out[len - 1] = '\0';
+}
+
+/* One line for humans, e.g.
+ * "5h 30% (resets in 2h 14m) | 7d 6% (resets in 3d 8h)" */
+static void format_text(const UsageData *u, char *buf, int len)
+{
+    if (!u->valid) {
+        snprintf(buf, len, "error: %s\n", u->error);
+        return;
+    }
+
+    char five[32], seven[32];
+    format_remaining(u->five_hour_resets, five, sizeof(five));
+    format_remaining(u->seven_day_resets, seven, sizeof(seven));
+
+    int n = snprintf(buf, len, "5h %.0f%%", u->five_hour_util);
+    if (five[0] && n < len)
+        n += snprintf(buf + n, len - n, " (resets in %s)", five);
+    if (n < len)
+        n += snprintf(buf + n, len - n, " | 7d %.0f%%", u->seven_day_util);
+    if (seven[0] && n < len)
+        n += snprintf(buf + n, len - n, " (resets in %s)", seven);
+    if (n < len)
+        snprintf(buf + n, len - n, "\n");
+}
+
+static void format_output(const UsageData *u, BOOL json, char *buf, int len)
+{
+    if (json) {
+        if (api_format_usage_json(u, buf, len) < 0)
+            snprintf(buf, len, "{\"valid\":false,\"error\":\"Output too long\"}\n");
+    } else {
+        format_text(u, buf, len);
+    }
+}
+
+/* Re-read credentials (cheap when unchanged) and fetch once */
+static void fetch(const AppConfig *cfg, Credentials *creds, UsageData *out)
+{
+    config_read_credentials(cfg->credentials_path, creds);
+    if (creds->access_token[0] == '\0') {
+        memset(out, 0, sizeof(*out));
+        snprintf(out->error, sizeof(out->error), "No access token found");
+        return;
+    }
+    api_fetch_usage(creds->access_token, out);
+    memcpy(out->subscription_type, creds->subscription_type,
+           sizeof(out->subscription_type));
+}
+
+static BOOL WINAPI on_console_ctrl(DWORD type)
+{
+    if (type != CTRL_C_EVENT && type != CTRL_BREAK_EVENT &&
+        type != CTRL_CLOSE_EVENT)
+        return FALSE;
+    SetEvent(g_stop);
+    return TRUE;  /* watch() returns and main cleans up */
+}
+
+/* Wait 'ms', or less if asked to stop. Returns TRUE to keep going. */
+static BOOL watch_sleep(DWORD ms)
+{
+    return WaitForSingleObject(g_stop, ms) == WAIT_TIMEOUT;
+}
+
+/* Poll until Ctrl+C, printing only when the output changes.
+ *
+ * Transient failures are retried with the tray's backoff policy; the
+ * error line is printed only once retries run out, like the tray's
+ * balloon. Returns the exit code for the last result. */
+static int watch(const AppConfig *cfg, Credentials *creds, BOOL json,
+                 int interval_sec)
+{
+    RetryPolicy retry;
+    char last[1024] = "";
+    char line[1024];
+    int rc = EXIT_OK;
+
+    g_stop = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!g_stop || !SetConsoleCtrlHandler(on_console_ctrl, TRUE)) {
+        fputs("error: cannot install the Ctrl+C handler\n", stderr);
+        if (g_stop)
+            CloseHandle(g_stop);
+        return EXIT_FETCH_ERROR;
+    }
+
+    retry_init(&retry);
+    for (;;) {
+        UsageData usage;
+        fetch(cfg, creds, &usage);
+
+        DWORD delay_ms = (DWORD)interval_sec * 1000;
+        if (usage.valid) {
+            retry_reset(&retry);
+        } else {
+            DWORD retry_ms = retry_next_delay_ms(&retry, &usage);
+            if (retry_ms) {
+                if (!watch_sleep(retry_ms))
+                    break;
+                continue;
+            }
+            DWORD server_ms = (DWORD)retry_after_sec(&usage) * 1000;
+            if (server_ms > delay_ms)
+                delay_ms = server_ms;
+        }
+
+        format_output(&usage, json, line, sizeof(line));
+        if (strcmp(line, last) != 0) {
+            fputs(line, stdout);
+            fflush(stdout);
+            strcpy(last, line);
+        }
+        rc = usage.valid ? EXIT_OK : EXIT_FETCH_ERROR;
+        if (!watch_sleep(delay_ms))
+            break;
+    }
+
+    SetConsoleCtrlHandler(on_console_ctrl, FALSE);
+    CloseHandle(g_stop);
+    return rc;
+}
+
+/* Strict "--watch <seconds>": digits only, 1..WATCH_MAX_SEC */
+static BOOL parse_interval(const wchar_t *arg, int *out)
+{
+    int v = 0;
+    if (!arg[0])
+        return FALSE;
+    for (const wchar_t *c = arg; *c; c++) {
+        if (*c < L'0' || *c > L'9')
+            return FALSE;
+        v = v * 10 + (*c - L'0');
+        if (v > WATCH_MAX_SEC)
+            return FALSE;
+    }
+    if (v < 1)
+        return FALSE;
+    *out = v;
+    return TRUE;
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+    BOOL json = FALSE;
+    BOOL watching = FALSE;
+    int interval_sec = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (wcscmp(argv[i], L"--json") == 0) {
+            json = TRUE;
+        } else if (wcscmp(argv[i], L"--watch") == 0) {
+            watching = TRUE;
+            /* Optional seconds; anything there that isn't another option
+             * must be a valid interval, not silently ignored */
+            if (i + 1 < argc && wcsncmp(argv[i + 1], L"--", 2) != 0) {
+                if (!parse_interval(argv[++i], &interval_sec)) {
+                    fwprintf(stderr, L"error: bad --watch interval '%s'\n", argv[i]);
+                    print_usage();
+                    return EXIT_USAGE;
+                }
+            }
+        } else {
+            print_usage();
+            return EXIT_USAGE;
+        }
+    }
+
+    /* Before any cJSON use */
+    arena_json_install();
+
+    AppConfig cfg;
+    if (!config_load_headless(&cfg)) {
+        fputs("error: no config and no credentials found; "
+              "run claudeusage.exe once or create config.ini\n", stderr);
+        return EXIT_NO_CONFIG;
+    }
+    if (interval_sec <= 0)
+        interval_sec = cfg.api_poll_interval_sec;
+
+    Credentials creds;
+    memset(&creds, 0, sizeof(creds));
+    if (!config_read_credentials(cfg.credentials_path, &creds)) {
+        fputs("error: could not read access token from the credentials file\n",
+              stderr);
+        return EXIT_NO_CONFIG;
+    }
+
+    if (!http_init()) {
+        fputs("error: failed to initialize HTTP\n", stderr);
+        return EXIT_FETCH_ERROR;
+    }
+    http_set_proxy(cfg.proxy, cfg.proxy_bypass, cfg.proxy_pac_url);
+
+    if (watching) {
+        int rc = watch(&cfg, &creds, json, interval_sec);
+        http_shutdown();
+        return rc;
+    }
+
+    UsageData usage;
+    char line[1024];
+    fetch(&cfg, &creds, &usage);
+    format_output(&usage, json, line, sizeof(line));
+    fputs(line, stdout);
+    int rc = usage.valid ? EXIT_OK : EXIT_FETCH_ERROR;
+
+    http_shutdown();
+    return rc;
+}
@@ -1,4 +1,6 @@
 #include "config.h"
+#include "arena.h"
+#include "diag.h"
 #include "cJSON.h"
 #include <shlobj.h>
 #include <stdio.h>
@@ -89,12 +91,56 @@ static BOOL parse_config_file(const wchar_t *config_path, AppConfig *cfg)
                     wcsncpy(cfg->credentials_path, w, MAX_PATH_LEN - 1);
                     free(w);
                 }
+            } else if (strncmp(key, "credentials_path", 16) == 0 &&
+                       key[16] >= '2' && key[16] < '1' + MAX_ACCOUNTS &&
+                       key[17] == '\0') {
+                MultiByteToWideChar(CP_UTF8, 0, val, -1,
+                                    cfg->extra_credentials_path[key[16] - '2'],
+                                    MAX_PATH_LEN - 1);
+            } else if (strncmp(key, "account_name", 12) == 0 &&
+                       (key[12] == '\0' ||
+                        (key[12] >= '2' && key[12] < '1' + MAX_ACCOUNTS &&
+                         key[13] == '\0'))) {
+                int i = key[12] ? key[12] - '1' : 0;
+                MultiByteToWideChar(CP_UTF8, 0, val, -1, cfg->account_name[i],
+                                    MAX_ACCOUNT_NAME - 1);
             } else if (strcmp(key, "api_poll_interval") == 0) {
                 int v = atoi(val);
                 if (v > 0) cfg->api_poll_interval_sec = v;
             } else if (strcmp(key, "subscription_poll_interval") == 0) {
                 int v = atoi(val);
                 if (v > 0) cfg->subscription_poll_interval_sec = v;
+            } else if (strcmp(key, "adaptive_polling") == 0) {
+                cfg->adaptive_polling = (atoi(val) != 0);
+            } else if (strcmp(key, "min_poll_interval") == 0) {
+                int v = atoi(val);
+                if (v > 0) cfg->min_poll_interval_sec = v;
+            } else if (strcmp(key, "max_poll_interval") == 0) {
+                int v = atoi(val);
+                if (v > 0) cfg->max_poll_interval_sec = v;
+            } else if (strcmp(key, "broker_mode") == 0) {
+                cfg->broker_mode = (atoi(val) != 0);
+            } else if (strcmp(key, "pipe_server") == 0) {
+                cfg->pipe_server = (atoi(val) != 0);
+            } else if (strcmp(key, "forecast_warn") == 0) {
+                int v = atoi(val);
+                if (v >= 0) cfg->forecast_warn_min = v;
+            } else if (strcmp(key, "proxy") == 0) {
+                MultiByteToWideChar(CP_UTF8, 0, val, -1, cfg->proxy, 255);
+            } else if (strcmp(key, "proxy_bypass") == 0) {
+                MultiByteToWideChar(CP_UTF8, 0, val, -1, cfg->proxy_bypass, 255);
+            } else if (strcmp(key, "proxy_pac_url") == 0) {
+                MultiByteToWideChar(CP_UTF8, 0, val, -1, cfg->proxy_pac_url,
+                                    MAX_PATH_LEN - 1);
+            } else if (strcmp(key, "export_url") == 0) {
+                MultiByteToWideChar(CP_UTF8, 0, val, -1, cfg->export_url,
+                                    MAX_PATH_LEN - 1);
+            } else if (strcmp(key, "export_auth") == 0) {
+                MultiByteToWideChar(CP_UTF8, 0, val, -1, cfg->export_auth,
+                                    MAX_TOKEN_LEN - 1);
+            } else if (strcmp(key, "export_interval") == 0) {
+                int v = atoi(val);
+                if (v > 0) cfg->export_interval_min = v > 1440 ? 1440 : v;
             }
         }
         line = strtok(NULL, "\r\n");
@@ -113,7 +159,7 @@ static void write_template_config(const wchar_t *config_path, const wchar_t *cre
                                CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
     if (hFile == INVALID_HANDLE_VALUE) return;
 
-    char content[2048];
+    char content[4096];
     char cred_narrow[MAX_PATH_LEN];
     WideCharToMultiByte(CP_UTF8, 0, cred_path, -1, cred_narrow, MAX_PATH_LEN, NULL, NULL);
 
@@ -124,13 +170,54 @@ static void write_template_config(const wchar_t *config_path, const wchar_t *cre
         "# Example: C:\\Users\\<user>\\.claude\\.credentials.json\n"
         "credentials_path=%s\n"
         "\n"
+        "# More accounts to show in the same tray icon (up to 3), each with its\n"
+        "# own credentials file and an optional name for the tooltip and popup\n"
+        "# account_name=Personal\n"
+        "# credentials_path2=C:\\Users\\<user>\\.claude-team\\.credentials.json\n"
+        "# account_name2=Team\n"
+        "\n"
         "# HTTP API poll interval in seconds (default: 300 = 5 minutes)\n"
         "# How often to fetch usage data from Claude API\n"
         "api_poll_interval=300\n"
         "\n"
         "# Subscription file poll interval in seconds (default: 1200 = 20 minutes)\n"
-        "# How often to re-read credentials file from disk\n"
-        "subscription_poll_interval=1200\n",
+        "# How often to re-read credentials file from disk, if the credentials\n"
+        "# directory can't be watched for changes\n"
+        "subscription_poll_interval=1200\n"
+        "\n"
+        "# Adapt the API poll interval to current usage (default: 1 = on)\n"
+        "# Polls faster near the 80%%/95%% thresholds, slower when usage is low\n"
+        "# or unchanged or on battery, right after a window resets, and rarely\n"
+        "# while locked; polls due while the display is off wait until it's on\n"
+        "adaptive_polling=1\n"
+        "min_poll_interval=60\n"
+        "max_poll_interval=1800\n"
+        "\n"
+        "# Terminal servers: let one instance per account poll and share the\n"
+        "# result with this user's other sessions using the same token\n"
+        "# (default: 0)\n"
+        "broker_mode=0\n"
+        "\n"
+        "# Answer local queries on \\\\.\\pipe\\claudeusage-<session id> with the\n"
+        "# current usage as JSON, for shell prompts and scripts (default: 1)\n"
+        "pipe_server=1\n"
+        "\n"
+        "# Show a balloon when, at the current rate, a usage limit will be\n"
+        "# reached within this many minutes (default: 30, 0 = off)\n"
+        "forecast_warn=30\n"
+        "\n"
+        "# Proxy, if the system settings don't work: a fixed proxy with an\n"
+        "# optional bypass list, or a PAC script (evaluated once per network)\n"
+        "# proxy=proxy.example.com:8080\n"
+        "# proxy_bypass=<local>;*.example.com\n"
+        "# proxy_pac_url=http://wpad.example.com/wpad.dat\n"
+        "\n"
+        "# Send every sample to an InfluxDB-style line-protocol endpoint, in\n"
+        "# batches every export_interval minutes (default: 15). Samples taken\n"
+        "# while offline are kept and sent later. https only.\n"
+        "# export_url=https://influx.example.com/api/v2/write?org=it&bucket=claude&precision=s\n"
+        "# export_auth=Token <api token>\n"
+        "# export_interval=15\n",
         cred_narrow);
 
     DWORD written;
@@ -138,11 +225,36 @@ static void write_template_config(const wchar_t *config_path, const wchar_t *cre
     CloseHandle(hFile);
 }
 
-BOOL config_load(AppConfig *cfg)
+static void set_defaults(AppConfig *cfg)
 {
     memset(cfg, 0, sizeof(*cfg));
     cfg->api_poll_interval_sec = 300;         /* 5 minutes */
     cfg->subscription_poll_interval_sec = 1200; /* 20 minutes */
+    cfg->adaptive_polling = TRUE;
+    cfg->min_poll_interval_sec = 60;
+    cfg->max_poll_interval_sec = 1800;          /* 30 minutes */
+    cfg->broker_mode = FALSE;
+    cfg->pipe_server = TRUE;
+    cfg->forecast_warn_min = 30;
+    cfg->export_interval_min = 15;
+}
+
+BOOL config_load_headless(AppConfig *cfg)
+{
+    set_defaults(cfg);
+
+    wchar_t config_path[MAX_PATH_LEN];
+    config_get_path(config_path, MAX_PATH_LEN);
+    if (file_exists(config_path) && parse_config_file(config_path, cfg))
+        return TRUE;
+
+    /* No config yet: auto-detect, but leave writing one to the tray app */
+    return try_find_credentials(cfg->credentials_path, MAX_PATH_LEN);
+}
+
+BOOL config_load(AppConfig *cfg)
+{
+    set_defaults(cfg);
 
     wchar_t config_path[MAX_PATH_LEN];
     config_get_path(config_path, MAX_PATH_LEN);
@@ -177,63 +289,37 @@ BOOL config_load(AppConfig *cfg)
     return FALSE;
 }
 
-BOOL config_read_access_token(const wchar_t *credentials_path,
-                              char *token, int token_len)
-{
-    HANDLE hFile = CreateFileW(credentials_path, GENERIC_READ, FILE_SHARE_READ,
-                               NULL, OPEN_EXISTING, 0, NULL);
-    if (hFile == INVALID_HANDLE_VALUE) return FALSE;
-
-    DWORD fileSize = GetFileSize(hFile, NULL);
-    if (fileSize == INVALID_FILE_SIZE || fileSize > 8192) {
-        CloseHandle(hFile);
-        return FALSE;
-    }
-
-    char *buf = (char *)malloc(fileSize + 1);
-    if (!buf) { CloseHandle(hFile); return FALSE; }
-
-    DWORD bytesRead;
-    if (!ReadFile(hFile, buf, fileSize, &bytesRead, NULL)) {
-        free(buf);
-        CloseHandle(hFile);
-        return FALSE;
-    }
-    CloseHandle(hFile);
-    buf[bytesRead] = '\0';
-
-    cJSON *root = cJSON_Parse(buf);
-    free(buf);
-    if (!root) return FALSE;
+/* Credentials files are capped at 8KB; their cJSON tree fits comfortably */
+#define CREDENTIALS_ARENA_SIZE 16384
 
-    cJSON *oauth = cJSON_GetObjectItem(root, "claudeAiOauth");
-    if (!oauth) { cJSON_Delete(root); return FALSE; }
-
-    cJSON *at = cJSON_GetObjectItem(oauth, "accessToken");
-    if (!at || !cJSON_IsString(at)) { cJSON_Delete(root); return FALSE; }
-
-    strncpy(token, at->valuestring, token_len - 1);
-    token[token_len - 1] = '\0';
-
-    cJSON_Delete(root);
-    return TRUE;
-}
-
-/* Read the subscription type from credentials JSON.
+/* Read everything we need from the credentials file.
  *
- * Why a separate function instead of combining with token read:
- * - Separation of concerns: callers might only need one or the other
- * - Keeps each function focused on a single task
- * - File I/O cost is negligible compared to network I/O
+ * Why one function for token, subscription type and expiry:
+ * - They live in the same claudeAiOauth object, so one read and one
+ *   cJSON_Parse serve all three
+ * - On roaming profiles %USERPROFILE% can sit on a network share, where
+ *   every CreateFileW is an SMB round trip
  *
- * Why not cache the result:
- * - Subscription type could change (user upgrades/downgrades plan)
- * - Re-reading picks up changes automatically
- * - File read is fast (~1ms), happens once per minute
+ * Why a stat check first:
+ * - GetFileAttributesExW is a single metadata query; if size and
+ *   last-write time are unchanged, the contents are too, and we skip the
+ *   open/read/parse entirely
+ * - Claude Code rewrites the whole file when it rotates the token, which
+ *   always bumps the last-write time
  */
-BOOL config_read_subscription_type(const wchar_t *credentials_path,
-                                   char *type, int type_len)
+BOOL config_read_credentials(const wchar_t *credentials_path, Credentials *creds)
 {
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExW(credentials_path, GetFileExInfoStandard, &fad))
+        return FALSE;
+
+    if (creds->loaded &&
+        fad.nFileSizeHigh == creds->size_high &&
+        fad.nFileSizeLow == creds->size_low &&
+        CompareFileTime(&fad.ftLastWriteTime, &creds->last_write) == 0)
+        return (creds->access_token[0] != '\0');
+
+    LONGLONG t0 = diag_begin();
     HANDLE hFile = CreateFileW(credentials_path, GENERIC_READ, FILE_SHARE_READ,
                                NULL, OPEN_EXISTING, 0, NULL);
     if (hFile == INVALID_HANDLE_VALUE) return FALSE;
@@ -256,25 +342,47 @@ BOOL config_read_subscription_type(const wchar_t *credentials_path,
     CloseHandle(hFile);
     buf[bytesRead] = '\0';
 
+    /* Parse into a stack arena: the tree is discarded as soon as the three
+     * fields are copied out, so there's no reason to heap-allocate it */
+    char arena_mem[CREDENTIALS_ARENA_SIZE];
+    Arena arena;
+    arena_init(&arena, arena_mem, sizeof(arena_mem));
+    arena_json_begin(&arena);
+
+    BOOL ok = FALSE;
     cJSON *root = cJSON_Parse(buf);
     free(buf);
-    if (!root) return FALSE;
+    if (!root) goto done;
 
     cJSON *oauth = cJSON_GetObjectItem(root, "claudeAiOauth");
-    if (!oauth) { cJSON_Delete(root); return FALSE; }
+    if (!oauth) goto done;
 
-    cJSON *st = cJSON_GetObjectItem(oauth, "subscriptionType");
-    if (!st || !cJSON_IsString(st)) {
-        /* Default to "pro" if field is missing (for backwards compatibility) */
-        strncpy(type, "pro", type_len - 1);
-        type[type_len - 1] = '\0';
-        cJSON_Delete(root);
-        return TRUE;
-    }
+    cJSON *at = cJSON_GetObjectItem(oauth, "accessToken");
+    if (!at || !cJSON_IsString(at)) goto done;
 
-    strncpy(type, st->valuestring, type_len - 1);
-    type[type_len - 1] = '\0';
+    strncpy(creds->access_token, at->valuestring, MAX_TOKEN_LEN - 1);
+    creds->access_token[MAX_TOKEN_LEN - 1] = '\0';
 
-    cJSON_Delete(root);
-    return TRUE;
+    /* Default to "pro" if field is missing (for backwards compatibility) */
+    cJSON *st = cJSON_GetObjectItem(oauth, "subscriptionType");
+    strncpy(creds->subscription_type,
+            (st && cJSON_IsString(st)) ? st->valuestring : "pro",
+            sizeof(creds->subscription_type) - 1);
+    creds->subscription_type[sizeof(creds->subscription_type) - 1] = '\0';
+
+    cJSON *exp = cJSON_GetObjectItem(oauth, "expiresAt");
+    creds->expires_at_ms = (exp && cJSON_IsNumber(exp) && exp->valuedouble > 0)
+                           ? (ULONGLONG)exp->valuedouble : 0;
+
+    creds->last_write = fad.ftLastWriteTime;
+    creds->size_high  = fad.nFileSizeHigh;
+    creds->size_low   = fad.nFileSizeLow;
+    creds->loaded     = TRUE;
+    ok = TRUE;
+
+done:
+    cJSON_Delete(root);  /* NULL-safe */
+    arena_json_end();
+    diag_end(DIAG_CREDENTIALS, t0);
+    return ok;
 }
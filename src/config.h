@@ -5,11 +5,29 @@
 
 #define MAX_PATH_LEN  1024
 #define MAX_TOKEN_LEN 512
+#define MAX_ACCOUNTS  4   /* credentials_path plus credentials_path2..4 */
+#define MAX_ACCOUNT_NAME 32
 
 typedef struct {
     wchar_t credentials_path[MAX_PATH_LEN];
+    /* Further accounts (credentials_path2..4), "" if unused */
+    wchar_t extra_credentials_path[MAX_ACCOUNTS - 1][MAX_PATH_LEN];
+    /* Display names (account_name, account_name2..4), "" for the default */
+    wchar_t account_name[MAX_ACCOUNTS][MAX_ACCOUNT_NAME];
     int     api_poll_interval_sec;          /* HTTP API poll interval (default 300 = 5 min) */
-    int     subscription_poll_interval_sec; /* Credentials file poll interval (default 1200 = 20 min) */
+    int     subscription_poll_interval_sec; /* Credentials poll fallback if unwatchable (default 1200 = 20 min) */
+    BOOL    adaptive_polling;               /* Adapt poll interval to usage (default on) */
+    int     min_poll_interval_sec;          /* Adaptive lower bound (default 60) */
+    int     max_poll_interval_sec;          /* Adaptive upper bound (default 1800 = 30 min) */
+    BOOL    broker_mode;                    /* Share one poller per account across sessions (default off) */
+    BOOL    pipe_server;                    /* Serve usage on a local named pipe (default on) */
+    int     forecast_warn_min;              /* Warn when a limit is forecast this close, 0 = off (default 30) */
+    wchar_t proxy[256];                     /* Explicit proxy "host:port", "" for the system settings */
+    wchar_t proxy_bypass[256];              /* Hosts that skip 'proxy', "" for none */
+    wchar_t proxy_pac_url[MAX_PATH_LEN];    /* PAC script URL, "" for the system settings */
+    wchar_t export_url[MAX_PATH_LEN];       /* https line-protocol write URL, "" = no export */
+    wchar_t export_auth[MAX_TOKEN_LEN];     /* Authorization header value for export_url */
+    int     export_interval_min;            /* Minutes between export batches (default 15) */
 } AppConfig;
 
 /* Load config from %APPDATA%\claudeusage\config.ini.
@@ -17,15 +35,29 @@ typedef struct {
    Returns TRUE if a valid config was loaded or created. */
 BOOL config_load(AppConfig *cfg);
 
-/* Read the OAuth access token from the credentials JSON file.
-   Returns TRUE if token was successfully extracted. */
-BOOL config_read_access_token(const wchar_t *credentials_path,
-                              char *token, int token_len);
+/* Load config without any UI and without creating files: for the CLI and
+   other headless callers. Returns FALSE if no credentials path is known. */
+BOOL config_load_headless(AppConfig *cfg);
 
-/* Read the subscription type from the credentials JSON file.
-   Returns TRUE if subscription type was successfully extracted. */
-BOOL config_read_subscription_type(const wchar_t *credentials_path,
-                                   char *type, int type_len);
+/* Values extracted from Claude Code's .credentials.json. */
+typedef struct {
+    char      access_token[MAX_TOKEN_LEN];
+    char      subscription_type[32];  /* e.g. "pro", "max"; "pro" if missing */
+    ULONGLONG expires_at_ms;          /* claudeAiOauth.expiresAt (Unix ms), 0 if absent */
+
+    /* Size and last-write time of the file these values came from */
+    FILETIME  last_write;
+    DWORD     size_high;
+    DWORD     size_low;
+    BOOL      loaded;
+} Credentials;
+
+/* Read token, subscription type and expiry from the credentials JSON file
+   in a single read and parse. If the file's size and last-write time still
+   match what 'creds' was loaded from, returns without opening the file.
+   On failure 'creds' is left unchanged.
+   Returns TRUE if 'creds' holds an access token. */
+BOOL config_read_credentials(const wchar_t *credentials_path, Credentials *creds);
 
 /* Get the config directory path (%APPDATA%\claudeusage\). */
 void config_get_dir(wchar_t *path, int max_len);
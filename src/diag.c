@@ -0,0 +1,194 @@
+#include "diag.h"
+#include <evntprov.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Recent samples kept per span (power of two) */
+#define DIAG_RING 64
+
+/* Per-span sample ring.
+ *
+ * Why lock-free:
+ * - Spans end on WinHTTP worker threads as well as the UI thread, and a
+ *   timing hook must never make the thing it measures wait on a lock
+ * - A writer claims a slot with one InterlockedIncrement and stores a
+ *   32-bit microsecond value; an aligned DWORD store can't tear, so a
+ *   reader copying the ring sees each slot either old or new
+ * - The ring is only read for the diagnostics view, where a sample
+ *   landing mid-copy doesn't matter
+ */
+typedef struct {
+    volatile LONG next;            /* Total samples written */
+    DWORD         us[DIAG_RING];   /* Microseconds */
+} DiagRing;
+
+static DiagRing g_rings[DIAG_SPAN_COUNT];
+static LONGLONG g_freq;  /* QPC ticks per second */
+
+static const wchar_t *const g_names[DIAG_SPAN_COUNT] = {
+    L"http.proxy",
+    L"http.dns",
+    L"http.connect",
+    L"http.send",
+    L"http.receive",
+    L"http.body",
+    L"api.parse",
+    L"config.credentials",
+    L"popup.render",
+};
+
+/* ETW provider "ClaudeUsage" {6c1f3a2e-8b4d-4e7a-9f2c-5d8e1b3a7c40}
+ *
+ * Why EventWriteString, loaded at runtime:
+ * - One string per span ("http.send 12.345 ms") is all the fleet tooling
+ *   needs, and needs no manifest or TraceLogging metadata
+ * - Nothing is formatted unless a trace session has enabled the provider
+ * - The CLI links the same core without advapi32; resolving the three
+ *   functions at runtime keeps that working
+ */
+static const GUID g_provider_guid =
+    { 0x6c1f3a2e, 0x8b4d, 0x4e7a, { 0x9f, 0x2c, 0x5d, 0x8e, 0x1b, 0x3a, 0x7c, 0x40 } };
+
+typedef ULONG (WINAPI *EventRegisterFunc)(LPCGUID, PENABLECALLBACK, PVOID, PREGHANDLE);
+typedef ULONG (WINAPI *EventUnregisterFunc)(REGHANDLE);
+typedef ULONG (WINAPI *EventWriteStringFunc)(REGHANDLE, UCHAR, ULONGLONG, PCWSTR);
+
+static REGHANDLE g_etw;
+static volatile LONG g_etw_enabled;
+static EventUnregisterFunc g_event_unregister;
+static EventWriteStringFunc g_event_write_string;
+
+static VOID NTAPI etw_enable_callback(LPCGUID source, ULONG is_enabled,
+                                      UCHAR level, ULONGLONG any_keyword,
+                                      ULONGLONG all_keyword,
+                                      PEVENT_FILTER_DESCRIPTOR filter,
+                                      PVOID ctx)
+{
+    (void)source; (void)level; (void)any_keyword; (void)all_keyword;
+    (void)filter; (void)ctx;
+    InterlockedExchange(&g_etw_enabled, is_enabled ? 1 : 0);
+}
+
+void diag_init(void)
+{
+    HMODULE advapi = GetModuleHandleW(L"advapi32.dll");
+    if (!advapi)
+        advapi = LoadLibraryW(L"advapi32.dll");
+    if (!advapi)
+        return;
+
+    EventRegisterFunc reg =
+        (EventRegisterFunc)GetProcAddress(advapi, "EventRegister");
+    g_event_unregister =
+        (EventUnregisterFunc)GetProcAddress(advapi, "EventUnregister");
+    g_event_write_string =
+        (EventWriteStringFunc)GetProcAddress(advapi, "EventWriteString");
+    if (!reg || !g_event_unregister || !g_event_write_string ||
+        reg(&g_provider_guid, etw_enable_callback, NULL, &g_etw) != ERROR_SUCCESS)
+        g_etw = 0;
+}
+
+void diag_shutdown(void)
+{
+    if (g_etw)
+        g_event_unregister(g_etw);
+    g_etw = 0;
+    g_etw_enabled = 0;
+}
+
+LONGLONG diag_begin(void)
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+void diag_end(DiagSpan span, LONGLONG start)
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+
+    if (!g_freq) {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        g_freq = f.QuadPart;  /* Fixed at boot, so racing writers agree */
+    }
+
+    LONGLONG us = (t.QuadPart - start) * 1000000 / g_freq;
+    if (us < 0) us = 0;
+    if (us > 0xFFFFFFFF) us = 0xFFFFFFFF;
+
+    DiagRing *r = &g_rings[span];
+    LONG slot = InterlockedIncrement(&r->next) - 1;
+    r->us[slot & (DIAG_RING - 1)] = (DWORD)us;
+
+    if (g_etw && g_etw_enabled) {
+        wchar_t msg[64];
+        _snwprintf(msg, 64, L"%s %.3f ms", g_names[span], us / 1000.0);
+        msg[63] = L'\0';
+        g_event_write_string(g_etw, 4 /* TRACE_LEVEL_INFORMATION */, 0, msg);
+    }
+}
+
+static int compare_dword(const void *a, const void *b)
+{
+    DWORD x = *(const DWORD *)a, y = *(const DWORD *)b;
+    return (x > y) - (x < y);
+}
+
+BOOL diag_stats(DiagSpan span, DiagStats *out)
+{
+    const DiagRing *r = &g_rings[span];
+    DWORD samples[DIAG_RING];
+    LONG total = r->next;
+    DWORD n = total < DIAG_RING ? (DWORD)total : DIAG_RING;
+
+    memset(out, 0, sizeof(*out));
+    if (n == 0)
+        return FALSE;
+
+    memcpy(samples, (const void *)r->us, sizeof(samples));
+    out->last_ms = samples[(total - 1) & (DIAG_RING - 1)] / 1000.0;
+    qsort(samples, n, sizeof(DWORD), compare_dword);
+
+    ULONGLONG sum = 0;
+    for (DWORD i = 0; i < n; i++)
+        sum += samples[i];
+
+    out->count  = (DWORD)total;
+    out->window = n;
+    out->min_ms = samples[0] / 1000.0;
+    out->avg_ms = (double)sum / n / 1000.0;
+    out->p95_ms = samples[(n * 95 - 1) / 100] / 1000.0;
+    return TRUE;
+}
+
+const wchar_t *diag_span_name(DiagSpan span)
+{
+    return (span >= 0 && span < DIAG_SPAN_COUNT) ? g_names[span] : L"?";
+}
+
+void diag_format_report(wchar_t *buf, int len)
+{
+    int used = _snwprintf(buf, len, L"Timings in ms over the last %d samples\n\n",
+                          DIAG_RING);
+    if (used < 0) used = 0;
+
+    BOOL any = FALSE;
+    for (int i = 0; i < DIAG_SPAN_COUNT && used < len; i++) {
+        DiagStats st;
+        if (!diag_stats((DiagSpan)i, &st))
+            continue;
+        any = TRUE;
+        int n = _snwprintf(buf + used, len - used,
+            L"%s: n=%lu  min %.1f  avg %.1f  p95 %.1f  last %.1f\n",
+            g_names[i], st.count, st.min_ms, st.avg_ms, st.p95_ms, st.last_ms);
+        if (n < 0)
+            break;
+        used += n;
+    }
+    if (!any && used < len)
+        _snwprintf(buf + used, len - used, L"No samples yet.\n");
+    buf[len - 1] = L'\0';
+}
@@ -0,0 +1,49 @@
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <windows.h>
+
+/* Timed stages of a poll and of the popup. */
+typedef enum {
+    DIAG_PROXY,        /* PAC evaluation (proxy_pac_url, cache misses only) */
+    DIAG_DNS,          /* Name resolution (new connections only) */
+    DIAG_CONNECT,      /* TCP connect (new connections only) */
+    DIAG_SEND,         /* WinHttpSendRequest to SENDREQUEST_COMPLETE, incl. TLS */
+    DIAG_RECEIVE,      /* WinHttpReceiveResponse to HEADERS_AVAILABLE */
+    DIAG_BODY,         /* First WinHttpReadData to end of body */
+    DIAG_PARSE,        /* cJSON_Parse plus field extraction of a usage body */
+    DIAG_CREDENTIALS,  /* Reading and parsing .credentials.json */
+    DIAG_POPUP_RENDER, /* Drawing changed popup sections into the surface */
+    DIAG_SPAN_COUNT
+} DiagSpan;
+
+typedef struct {
+    DWORD  count;  /* Samples recorded since startup */
+    DWORD  window; /* Recent samples the figures below are computed over */
+    double min_ms;
+    double avg_ms;
+    double p95_ms;
+    double last_ms;
+} DiagStats;
+
+/* Register the ETW provider. Optional: spans are recorded either way. */
+void diag_init(void);
+void diag_shutdown(void);
+
+/* Start a span: returns a QueryPerformanceCounter timestamp. */
+LONGLONG diag_begin(void);
+
+/* Record the time since 'start' (from diag_begin()) for 'span'.
+   Lock-free; callable from any thread. */
+void diag_end(DiagSpan span, LONGLONG start);
+
+/* Aggregate the recent samples of 'span'. Returns FALSE if there are none. */
+BOOL diag_stats(DiagSpan span, DiagStats *out);
+
+/* Short stage name, e.g. L"http.send" */
+const wchar_t *diag_span_name(DiagSpan span);
+
+/* Multi-line table of every span with samples, for display. */
+void diag_format_report(wchar_t *buf, int len);
+
+#endif
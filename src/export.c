@@ -0,0 +1,226 @@
+#include "export.h"
+#include "http.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* One POST carries at most this much line protocol (about 500 samples);
+ * a larger backlog goes out in several back-to-back batches */
+#define EXPORT_MAX_BATCH 65536
+#define EXPORT_MAX_LINE  384
+
+/* Exporter state.
+ *
+ * Why the history ring is the buffer:
+ * - Every valid poll is already appended to the memory-mapped ring, so
+ *   keeping a second in-memory queue would only duplicate it
+ * - The ring is on disk as well: samples taken while offline (or while
+ *   the collector is down) are still there at the next flush, and the
+ *   sequence number of the next undelivered sample lives in the ring's
+ *   header (not a timestamp: several samples can share a second), so
+ *   they survive a restart too. Nothing is dropped unless the backlog
+ *   outgrows the ring (16384 polls, weeks at the default interval)
+ *
+ * Why only the UI thread touches it:
+ * - The POST completes on a WinHTTP worker thread, which only posts
+ *   the status back; the cursor moves in export_on_done()
+ */
+typedef struct {
+    BOOL          enabled;
+    HistoryRing  *history;
+    HWND          hwnd;
+    UINT          msg;
+    wchar_t       host[128];
+    INTERNET_PORT port;
+    wchar_t       path[1024];
+    wchar_t       headers[640];
+    char          tags[256];      /* ",host=...,user=..." */
+    HttpRequest  *req;            /* In-flight POST, NULL when idle */
+    DWORD         pending_seq;    /* Sequence number just past the in-flight batch */
+    BOOL          more;           /* The batch was cut at EXPORT_MAX_BATCH */
+} Exporter;
+
+static Exporter g_export;
+
+/* Line protocol tag values escape commas, spaces and equals signs */
+static void append_tag(char *out, int len, const char *key, const wchar_t *value)
+{
+    char utf8[128];
+    WideCharToMultiByte(CP_UTF8, 0, value, -1, utf8, sizeof(utf8), NULL, NULL);
+    utf8[sizeof(utf8) - 1] = '\0';
+
+    int pos = (int)strlen(out);
+    pos += snprintf(out + pos, len - pos, ",%s=", key);
+    for (const char *c = utf8; *c && pos < len - 2; c++) {
+        if (*c == ',' || *c == ' ' || *c == '=')
+            out[pos++] = '\\';
+        out[pos++] = *c;
+    }
+    out[pos < len ? pos : len - 1] = '\0';
+}
+
+BOOL export_init(const wchar_t *url, const wchar_t *auth,
+                 HistoryRing *h, HWND hwnd, UINT msg)
+{
+    memset(&g_export, 0, sizeof(g_export));
+    if (!url || !url[0] || !h->header)
+        return FALSE;
+
+    URL_COMPONENTS uc;
+    wchar_t extra[512];
+    memset(&uc, 0, sizeof(uc));
+    uc.dwStructSize     = sizeof(uc);
+    uc.lpszHostName     = g_export.host;
+    uc.dwHostNameLength = sizeof(g_export.host) / sizeof(wchar_t);
+    uc.lpszUrlPath      = g_export.path;
+    uc.dwUrlPathLength  = sizeof(g_export.path) / sizeof(wchar_t);
+    uc.lpszExtraInfo    = extra;
+    uc.dwExtraInfoLength = sizeof(extra) / sizeof(wchar_t);
+    /* http.c only speaks TLS, and the token would travel in the clear */
+    if (!WinHttpCrackUrl(url, 0, 0, &uc) || uc.nScheme != INTERNET_SCHEME_HTTPS)
+        goto fail;
+    if (wcslen(g_export.path) + wcslen(extra) >= sizeof(g_export.path) / sizeof(wchar_t))
+        goto fail;
+    wcscat(g_export.path, extra);  /* Query string, e.g. ?bucket=...&precision=s */
+    g_export.port = uc.nPort;
+
+    int n = _snwprintf(g_export.headers, 640,
+                       L"Content-Type: text/plain; charset=utf-8%s%s",
+                       (auth && auth[0]) ? L"\r\nAuthorization: " : L"",
+                       (auth && auth[0]) ? auth : L"");
+    if (n < 0 || n >= 640)
+        goto fail;
+
+    wchar_t name[256];
+    DWORD size = 256;
+    g_export.tags[0] = '\0';
+    if (GetComputerNameW(name, &size))
+        append_tag(g_export.tags, sizeof(g_export.tags), "host", name);
+    size = 256;
+    if (GetUserNameW(name, &size))
+        append_tag(g_export.tags, sizeof(g_export.tags), "user", name);
+
+    g_export.history = h;
+    g_export.hwnd    = hwnd;
+    g_export.msg     = msg;
+    g_export.enabled = TRUE;
+    return TRUE;
+
+fail:
+    memset(&g_export, 0, sizeof(g_export));
+    return FALSE;
+}
+
+/* One sample as a line of InfluxDB line protocol (seconds precision);
+ * returns its length, 0 if it has no values */
+static int format_line(const HistoryRecord *r, char *out, int len)
+{
+    static const char *const names[4] = {
+        "five_hour", "seven_day", "opus", "sonnet"
+    };
+    WORD values[4] = {
+        r->five_hour_util, r->seven_day_util, r->opus_util, r->sonnet_util
+    };
+
+    int pos = snprintf(out, len, "claude_usage%s,account=%u ",
+                       g_export.tags, (unsigned)r->account);
+    BOOL any = FALSE;
+    for (int i = 0; i < 4 && pos < len; i++) {
+        if (values[i] == HISTORY_NO_VALUE)
+            continue;
+        pos += snprintf(out + pos, len - pos, "%s%s=%.2f", any ? "," : "",
+                        names[i], history_util(values[i]));
+        any = TRUE;
+    }
+    if (!any)
+        return 0;
+    if (r->flags & HISTORY_EXTRA_ENABLED && pos < len)
+        pos += snprintf(out + pos, len - pos, ",extra_used=%.0f,extra_limit=%.0f",
+                        r->extra_used, r->extra_limit);
+    if (pos < len)
+        pos += snprintf(out + pos, len - pos, " %lu\n", r->timestamp);
+    return pos < len ? pos : 0;
+}
+
+static void post_done(HttpResponse *resp, void *ctx)
+{
+    (void)ctx;
+    /* Worker thread: hand the status to the UI thread and nothing else */
+    PostMessageW(g_export.hwnd, g_export.msg,
+                 resp->error_code ? 0 : (WPARAM)resp->status_code, 0);
+}
+
+/* Why batches on a timer instead of a request per poll:
+ * - Collectors and the network both prefer one request every 15 minutes
+ *   per seat over one a minute; the samples keep their own timestamps,
+ *   so nothing is lost by sending them late
+ * - No gzip: WinHTTP only decompresses responses and there is no zlib
+ *   here; a batch of ~100-byte lines stays small enough as is
+ */
+void export_flush(void)
+{
+    if (!g_export.enabled || g_export.req)
+        return;
+
+    const HistoryRing *h = g_export.history;
+    DWORD end = history_appended(h);
+    DWORD oldest = end - history_count(h);
+    DWORD seq = history_exported(h);
+    if (seq - oldest > end - oldest)
+        seq = oldest;  /* Unsent samples were overwritten; start at the oldest */
+    if (seq == end)
+        return;  /* Nothing new */
+
+    char *body = (char *)malloc(EXPORT_MAX_BATCH);
+    if (!body)
+        return;
+
+    DWORD len = 0;
+    g_export.more = FALSE;
+    for (; seq != end; seq++) {
+        const HistoryRecord *r = history_at(h, seq - oldest);
+        char line[EXPORT_MAX_LINE];
+        int n = format_line(r, line, sizeof(line));
+        if (len + n > EXPORT_MAX_BATCH) {
+            g_export.more = TRUE;
+            break;
+        }
+        memcpy(body + len, line, n);
+        len += n;
+    }
+
+    if (len == 0) {
+        /* Only empty samples: skip past them */
+        history_set_exported(g_export.history, seq);
+        free(body);
+        return;
+    }
+
+    g_export.pending_seq = seq;
+    g_export.req = http_post_async(g_export.host, g_export.port, g_export.path,
+                                   g_export.headers, body, len, post_done, NULL);
+    free(body);  /* http.c keeps its own copy */
+}
+
+void export_on_done(WPARAM status)
+{
+    if (!g_export.req)
+        return;
+    http_release(g_export.req);
+    g_export.req = NULL;
+
+    /* Anything else (network error, 4xx, 5xx) keeps the cursor where it
+     * was; the same samples go out with the next flush */
+    if (status < 200 || status >= 300)
+        return;
+    history_set_exported(g_export.history, g_export.pending_seq);
+    if (g_export.more)
+        export_flush();
+}
+
+void export_shutdown(void)
+{
+    if (g_export.req)
+        http_cancel(g_export.req);
+    memset(&g_export, 0, sizeof(g_export));
+}
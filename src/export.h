@@ -0,0 +1,27 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <windows.h>
+#include "history.h"
+
+/* Start exporting samples from 'h' to 'url' (https only), with 'auth' as
+   the Authorization header value ("" for none). Completions are posted
+   to 'hwnd' as 'msg'; pass them to export_on_done(). Returns FALSE (and
+   stays off) if the URL is empty or unusable. Requires http_init(). */
+BOOL export_init(const wchar_t *url, const wchar_t *auth,
+                 HistoryRing *h, HWND hwnd, UINT msg);
+
+/* POST the samples recorded since the last delivered one, at most one
+   batch at a time. A no-op while off, with nothing new, or while a POST
+   is still in flight. */
+void export_flush(void);
+
+/* Handle the completion message: wParam is the HTTP status (0 on a
+   network error). Advances the export cursor on success and sends the
+   next batch if more are waiting. */
+void export_on_done(WPARAM status);
+
+/* Abandon an in-flight POST. Unsent samples stay in the ring. */
+void export_shutdown(void);
+
+#endif
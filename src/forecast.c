@@ -0,0 +1,140 @@
+#include "forecast.h"
+#include "util.h"
+#include <math.h>
+#include <string.h>
+
+/* Smoothing time constants: how quickly the rate follows a change in
+ * pace. The 5-hour window reacts within tens of minutes; the 7-day one
+ * looks at hours so one busy afternoon doesn't dominate the week. */
+#define FORECAST_TAU_FIVE_HOUR (20.0 * 60.0)
+#define FORECAST_TAU_SEVEN_DAY (6.0 * 3600.0)
+/* A reset time that moves by more than this belongs to a new window */
+#define FORECAST_RESET_SLACK_SEC 60
+/* Samples closer together than this only update the last value */
+#define FORECAST_MIN_DT_SEC 1
+/* Replay this much history at startup */
+#define FORECAST_PRIME_SEC (24 * 3600)
+
+static void window_clear(ForecastWindow *w)
+{
+    w->util = -1.0;
+    w->time = 0;
+    w->resets = 0;
+    w->rate = 0.0;
+    w->has_rate = FALSE;
+}
+
+void forecast_init(Forecast *f)
+{
+    window_clear(&f->five_hour);
+    window_clear(&f->seven_day);
+}
+
+/* Fold one sample into the window.
+ *
+ * Why an exponentially weighted rate instead of a regression over history:
+ * - Each sample costs a subtraction, a division and one exp(); nothing
+ *   is kept but the previous sample and the smoothed rate
+ * - The weight depends on the time since the previous sample
+ *   (alpha = 1 - e^(-dt/tau)), so adaptive polling or a missed poll
+ *   doesn't skew the estimate the way a per-sample weight would
+ * - A drop in utilization or a new reset time means the window rolled
+ *   over; the old pace says nothing about the new window, so it starts
+ *   from scratch
+ */
+static void window_add(ForecastWindow *w, double util, LONGLONG resets,
+                       LONGLONG now, double tau)
+{
+    if (util < 0)
+        return;
+
+    BOOL rolled = w->util < 0 || util < w->util - 0.5 ||
+                  (resets && w->resets &&
+                   (resets > w->resets + FORECAST_RESET_SLACK_SEC ||
+                    resets < w->resets - FORECAST_RESET_SLACK_SEC));
+    if (rolled) {
+        window_clear(w);
+        w->util = util;
+        w->time = now;
+        w->resets = resets;
+        return;
+    }
+
+    LONGLONG dt = now - w->time;
+    if (dt >= FORECAST_MIN_DT_SEC) {
+        double inst = (util - w->util) / (double)dt;
+        if (w->has_rate) {
+            double alpha = 1.0 - exp(-(double)dt / tau);
+            w->rate += alpha * (inst - w->rate);
+        } else {
+            w->rate = inst;
+            w->has_rate = TRUE;
+        }
+        w->time = now;
+    }
+    w->util = util;
+    if (resets)
+        w->resets = resets;
+}
+
+/* Seconds from 'now' until the window reaches 100% at the current rate;
+ * 0 if it won't before it resets, or if there's no rate yet */
+static int window_limit_sec(const ForecastWindow *w, LONGLONG now)
+{
+    if (!w->has_rate || w->rate <= 0.0 || w->util < 0 || w->util >= 100.0)
+        return 0;
+
+    double at = (double)w->time + (100.0 - w->util) / w->rate;
+    if (w->resets && at >= (double)w->resets)
+        return 0;
+    double left = at - (double)now;
+    if (left < 60.0)
+        left = 60.0;  /* Due any moment: still show "1m", not nothing */
+    if (left > 0x7FFFFFFF)
+        return 0;
+    return (int)left;
+}
+
+static LONGLONG reset_time(const char *iso)
+{
+    LONGLONG t;
+    return util_iso8601_to_unix(iso, &t) ? t : 0;
+}
+
+void forecast_estimate(const Forecast *f, UsageData *usage, LONGLONG now)
+{
+    usage->five_hour_limit_sec = window_limit_sec(&f->five_hour, now);
+    usage->seven_day_limit_sec = window_limit_sec(&f->seven_day, now);
+}
+
+void forecast_update(Forecast *f, UsageData *usage, LONGLONG now)
+{
+    if (!usage->valid)
+        return;
+    window_add(&f->five_hour, usage->five_hour_util,
+               reset_time(usage->five_hour_resets), now, FORECAST_TAU_FIVE_HOUR);
+    window_add(&f->seven_day, usage->seven_day_util,
+               reset_time(usage->seven_day_resets), now, FORECAST_TAU_SEVEN_DAY);
+    forecast_estimate(f, usage, now);
+}
+
+void forecast_prime(Forecast *f, const HistoryRing *h,
+                    WORD account, LONGLONG now)
+{
+    DWORD n = history_count(h);
+    DWORD i = n;
+
+    while (i > 0 &&
+           (LONGLONG)history_at(h, i - 1)->timestamp + FORECAST_PRIME_SEC > now)
+        i--;
+
+    for (; i < n; i++) {
+        const HistoryRecord *r = history_at(h, i);
+        if (r->account != account)
+            continue;
+        window_add(&f->five_hour, history_util(r->five_hour_util),
+                   r->five_hour_resets, r->timestamp, FORECAST_TAU_FIVE_HOUR);
+        window_add(&f->seven_day, history_util(r->seven_day_util),
+                   r->seven_day_resets, r->timestamp, FORECAST_TAU_SEVEN_DAY);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef FORECAST_H
+#define FORECAST_H
+
+#include <windows.h>
+#include "api.h"
+#include "history.h"
+
+/* Running burn-rate state for one usage window. */
+typedef struct {
+    double   util;      /* Last sample, -1 before the first */
+    LONGLONG time;      /* Unix time of the last sample */
+    LONGLONG resets;    /* Reset time of the window the samples belong to, 0 if unknown */
+    double   rate;      /* Smoothed growth, percentage points per second */
+    BOOL     has_rate;  /* At least two samples in this window */
+} ForecastWindow;
+
+typedef struct {
+    ForecastWindow five_hour;
+    ForecastWindow seven_day;
+} Forecast;
+
+void forecast_init(Forecast *f);
+
+/* Replay recent samples of one account (see HistoryRecord) from the
+   history ring, so the first fetch after startup already has a rate. */
+void forecast_prime(Forecast *f, const HistoryRing *h,
+                    WORD account, LONGLONG now);
+
+/* Add a fetch result taken at 'now' (O(1)) and fill its
+   five_hour_limit_sec / seven_day_limit_sec. Invalid results are ignored. */
+void forecast_update(Forecast *f, UsageData *usage, LONGLONG now);
+
+/* Fill usage->*_limit_sec from the current state without adding a sample. */
+void forecast_estimate(const Forecast *f, UsageData *usage, LONGLONG now);
+
+#endif
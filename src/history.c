@@ -0,0 +1,253 @@
+#include "history.h"
+#include "config.h"
+#include "util.h"
+#include <stdio.h>
+#include <string.h>
+
+#define HISTORY_MAGIC    0x53484355  /* "UCHS" */
+/* 2: 'account' is the configured account index
+ * 3: 'exported' is a sequence number, 'appended' counts all appends */
+#define HISTORY_VERSION  3
+/* A week of one-minute polls (10080) with room to spare: 512 KB on disk */
+#define HISTORY_CAPACITY 16384
+/* FlushViewOfFile every this many appends (and on close) */
+#define HISTORY_FLUSH_EVERY 16
+
+typedef struct HistoryHeader {
+    DWORD magic;
+    DWORD version;
+    DWORD record_size;
+    DWORD capacity;
+    DWORD head;         /* Next slot to write */
+    DWORD count;        /* Valid records, <= capacity */
+    DWORD appended;     /* Records ever appended: the next one's sequence number */
+    DWORD exported;     /* Sequence number of the first sample export.c hasn't delivered */
+} HistoryHeader;
+
+#define HISTORY_FILE_SIZE \
+    (sizeof(HistoryHeader) + (SIZE_T)HISTORY_CAPACITY * sizeof(HistoryRecord))
+
+void history_default_path(wchar_t *path, int max_len)
+{
+    wchar_t dir[MAX_PATH_LEN];
+    config_get_dir(dir, MAX_PATH_LEN);
+    _snwprintf(path, max_len, L"%s\\history.bin", dir);
+}
+
+static WORD pack_util(double util)
+{
+    if (util < 0)
+        return HISTORY_NO_VALUE;
+    double v = util * 100.0 + 0.5;
+    if (v >= HISTORY_NO_VALUE)
+        return HISTORY_NO_VALUE - 1;
+    return (WORD)v;
+}
+
+double history_util(WORD stored)
+{
+    return stored == HISTORY_NO_VALUE ? -1.0 : stored / 100.0;
+}
+
+static DWORD pack_time(const char *iso)
+{
+    LONGLONG t;
+    if (!util_iso8601_to_unix(iso, &t) || t <= 0)
+        return 0;
+    return (DWORD)t;
+}
+
+/* Bring an older ring up to HISTORY_VERSION in place */
+static void migrate(HistoryRing *h)
+{
+    HistoryHeader *hdr = h->header;
+
+    /* Version 1 tagged samples with a token hash, which changed with
+     * every token refresh. Only the main account was ever recorded, so
+     * all of them belong to account 0. */
+    if (hdr->version == 1)
+        for (DWORD i = 0; i < HISTORY_CAPACITY; i++)
+            h->records[i].account = HISTORY_MAIN_ACCOUNT;
+
+    /* Versions 1-2 had no sequence numbers. Their export cursor was the
+     * timestamp of the last exported sample, at the offset that is now
+     * 'appended' (0 in version 1 files older than the exporter, where it
+     * was reserved). Number the stored records from 0 and point past the
+     * exported ones. */
+    DWORD exported_ts = hdr->appended;
+    hdr->appended = hdr->count;
+    hdr->exported = 0;
+    while (hdr->exported < hdr->count &&
+           history_at(h, hdr->exported)->timestamp <= exported_ts)
+        hdr->exported++;
+
+    hdr->version = HISTORY_VERSION;
+}
+
+/* Why a memory-mapped ring of fixed-width records:
+ * - An append is a 32-byte store into the mapped view plus a head update;
+ *   there is no file rewrite, no seek and no serialization format
+ * - The file never grows: old samples are overwritten in place, so it
+ *   stays at 512 KB however long the tray runs
+ * - The OS writes dirty pages back lazily; FlushViewOfFile every few
+ *   appends and on close bounds what a crash or power cut can lose
+ * - Fixed 32-byte records (utilization in hundredths, Unix-second times)
+ *   keep a week of one-minute samples small enough to scan for the popup
+ *
+ * Why no sharing:
+ * - Two instances of the same user (two RDS sessions) would race on
+ *   'head'. The file is opened without FILE_SHARE_WRITE, so the second
+ *   instance simply runs without history.
+ */
+BOOL history_open(HistoryRing *h, const wchar_t *path)
+{
+    memset(h, 0, sizeof(*h));
+    h->file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                          NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h->file == INVALID_HANDLE_VALUE) {
+        h->file = NULL;
+        return FALSE;
+    }
+
+    ULARGE_INTEGER size;
+    size.QuadPart = HISTORY_FILE_SIZE;
+    h->mapping = CreateFileMappingW(h->file, NULL, PAGE_READWRITE,
+                                    size.HighPart, size.LowPart, NULL);
+    if (!h->mapping)
+        goto fail;
+
+    h->header = (HistoryHeader *)MapViewOfFile(h->mapping,
+                                               FILE_MAP_READ | FILE_MAP_WRITE,
+                                               0, 0, HISTORY_FILE_SIZE);
+    if (!h->header)
+        goto fail;
+    h->records = (HistoryRecord *)(h->header + 1);
+
+    HistoryHeader *hdr = h->header;
+    if (hdr->magic == HISTORY_MAGIC && hdr->version < HISTORY_VERSION &&
+        hdr->record_size == sizeof(HistoryRecord) &&
+        hdr->capacity == HISTORY_CAPACITY &&
+        hdr->head < HISTORY_CAPACITY && hdr->count <= HISTORY_CAPACITY)
+        migrate(h);
+
+    /* New file (all zeros), another build's layout, or a corrupt header:
+     * start over */
+    if (hdr->magic != HISTORY_MAGIC || hdr->version != HISTORY_VERSION ||
+        hdr->record_size != sizeof(HistoryRecord) ||
+        hdr->capacity != HISTORY_CAPACITY ||
+        hdr->head >= HISTORY_CAPACITY || hdr->count > HISTORY_CAPACITY) {
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->magic = HISTORY_MAGIC;
+        hdr->version = HISTORY_VERSION;
+        hdr->record_size = sizeof(HistoryRecord);
+        hdr->capacity = HISTORY_CAPACITY;
+    }
+    return TRUE;
+
+fail:
+    history_close(h);
+    return FALSE;
+}
+
+void history_close(HistoryRing *h)
+{
+    if (h->header) {
+        FlushViewOfFile(h->header, 0);
+        UnmapViewOfFile(h->header);
+    }
+    if (h->mapping)
+        CloseHandle(h->mapping);
+    if (h->file)
+        CloseHandle(h->file);
+    memset(h, 0, sizeof(*h));
+}
+
+void history_append(HistoryRing *h, const UsageData *usage,
+                    WORD account, LONGLONG now)
+{
+    if (!h->header || !usage->valid)
+        return;
+
+    HistoryHeader *hdr = h->header;
+    HistoryRecord *r = &h->records[hdr->head];
+
+    r->timestamp        = (DWORD)now;
+    r->five_hour_resets = pack_time(usage->five_hour_resets);
+    r->seven_day_resets = pack_time(usage->seven_day_resets);
+    r->five_hour_util   = pack_util(usage->five_hour_util);
+    r->seven_day_util   = pack_util(usage->seven_day_util);
+    r->opus_util        = pack_util(usage->opus_util);
+    r->sonnet_util      = pack_util(usage->sonnet_util);
+    r->extra_used       = (float)usage->extra_used;
+    r->extra_limit      = (float)usage->extra_limit;
+    r->flags            = usage->extra_enabled ? HISTORY_EXTRA_ENABLED : 0;
+    r->account          = account;
+
+    /* Publish the record only once it is complete */
+    hdr->head = (hdr->head + 1) % HISTORY_CAPACITY;
+    if (hdr->count < HISTORY_CAPACITY)
+        hdr->count++;
+    hdr->appended++;
+
+    if (++h->unflushed >= HISTORY_FLUSH_EVERY) {
+        FlushViewOfFile(h->header, 0);
+        h->unflushed = 0;
+    }
+}
+
+DWORD history_appended(const HistoryRing *h)
+{
+    return h->header ? h->header->appended : 0;
+}
+
+DWORD history_exported(const HistoryRing *h)
+{
+    return h->header ? h->header->exported : 0;
+}
+
+void history_set_exported(HistoryRing *h, DWORD seq)
+{
+    if (h->header)
+        h->header->exported = seq;  /* Flushed with the next batch of appends */
+}
+
+DWORD history_count(const HistoryRing *h)
+{
+    return h->header ? h->header->count : 0;
+}
+
+const HistoryRecord *history_at(const HistoryRing *h, DWORD i)
+{
+    const HistoryHeader *hdr = h->header;
+    DWORD oldest = (hdr->head + HISTORY_CAPACITY - hdr->count) % HISTORY_CAPACITY;
+    return &h->records[(oldest + i) % HISTORY_CAPACITY];
+}
+
+BOOL history_latest(const HistoryRing *h, WORD account,
+                    UsageData *out, LONGLONG *when)
+{
+    DWORD n = history_count(h);
+
+    for (DWORD i = n; i-- > 0; ) {
+        const HistoryRecord *r = history_at(h, i);
+        if (r->account != account)
+            continue;
+
+        memset(out, 0, sizeof(*out));
+        out->five_hour_util = history_util(r->five_hour_util);
+        out->seven_day_util = history_util(r->seven_day_util);
+        out->opus_util      = history_util(r->opus_util);
+        out->sonnet_util    = history_util(r->sonnet_util);
+        util_unix_to_iso8601(r->five_hour_resets, out->five_hour_resets,
+                             sizeof(out->five_hour_resets));
+        util_unix_to_iso8601(r->seven_day_resets, out->seven_day_resets,
+                             sizeof(out->seven_day_resets));
+        out->extra_enabled  = (r->flags & HISTORY_EXTRA_ENABLED) != 0;
+        out->extra_used     = r->extra_used;
+        out->extra_limit    = r->extra_limit;
+        out->valid          = TRUE;
+        *when = r->timestamp;
+        return TRUE;
+    }
+    return FALSE;
+}
@@ -0,0 +1,80 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <windows.h>
+#include "api.h"
+
+/* Utilizations are stored in hundredths of a percent; this marks "n/a". */
+#define HISTORY_NO_VALUE 0xFFFF
+
+#define HISTORY_EXTRA_ENABLED 0x0001
+
+/* Samples are keyed by the account's position in config.ini, not by its
+   token: the token is refreshed every few hours. */
+#define HISTORY_MAIN_ACCOUNT 0
+
+/* One sample, 32 bytes. Times are Unix seconds (UTC), 0 if unknown. */
+typedef struct {
+    DWORD timestamp;
+    DWORD five_hour_resets;
+    DWORD seven_day_resets;
+    WORD  five_hour_util;   /* Hundredths of a percent, or HISTORY_NO_VALUE */
+    WORD  seven_day_util;
+    WORD  opus_util;
+    WORD  sonnet_util;
+    float extra_used;       /* Cents */
+    float extra_limit;      /* Cents */
+    WORD  flags;            /* HISTORY_EXTRA_ENABLED */
+    WORD  account;          /* Configured account index (HISTORY_MAIN_ACCOUNT = credentials_path) */
+} HistoryRecord;
+
+struct HistoryHeader;
+
+/* Fixed-size ring of samples in a memory-mapped file. */
+typedef struct {
+    HANDLE                file;
+    HANDLE                mapping;
+    struct HistoryHeader *header;
+    HistoryRecord        *records;
+    DWORD                 unflushed;  /* Appends since the last flush */
+} HistoryRing;
+
+/* Default location: %APPDATA%\claudeusage\history.bin */
+void history_default_path(wchar_t *path, int max_len);
+
+/* Open (creating if needed) the history file. Returns FALSE if it can't be
+   opened, e.g. because another instance of the same user has it. */
+BOOL history_open(HistoryRing *h, const wchar_t *path);
+
+/* Flush and close. Safe on a ring that failed to open. */
+void history_close(HistoryRing *h);
+
+/* Record a valid fetch result taken at 'now' (Unix seconds). */
+void history_append(HistoryRing *h, const UsageData *usage,
+                    WORD account, LONGLONG now);
+
+/* Every appended sample gets the next sequence number. history_at(h, i)
+   has sequence history_appended() - history_count() + i. */
+DWORD history_appended(const HistoryRing *h);
+
+/* Sequence number of the first sample not yet exported (see export.c);
+   kept in the file so unsent samples survive a restart. It may point
+   before the oldest stored sample if unsent ones were overwritten. */
+DWORD history_exported(const HistoryRing *h);
+void history_set_exported(HistoryRing *h, DWORD seq);
+
+/* Number of stored samples. */
+DWORD history_count(const HistoryRing *h);
+
+/* Sample i, oldest first (0 <= i < history_count()). */
+const HistoryRecord *history_at(const HistoryRing *h, DWORD i);
+
+/* Most recent sample for 'account', converted back into UsageData.
+   'when' receives its timestamp. Returns FALSE if there is none. */
+BOOL history_latest(const HistoryRing *h, WORD account,
+                    UsageData *out, LONGLONG *when);
+
+/* Convert a stored utilization back to a percentage (-1 for n/a). */
+double history_util(WORD stored);
+
+#endif
@@ -1,17 +1,152 @@
 #include "http.h"
+#include "diag.h"
 #include <stdlib.h>
 #include <string.h>
 
+/* State for one asynchronous request.
+ *
+ * Why reference counted:
+ * - The caller (UI thread) and WinHTTP (worker threads) both hold on to it
+ * - The caller drops its reference via http_release()/http_cancel()
+ * - WinHTTP's reference is dropped on WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING,
+ *   which is guaranteed to be the last callback for the request handle
+ * - Whichever happens last frees the struct, so neither side can touch
+ *   freed memory regardless of how the two threads interleave
+ *
+ * Why a per-request lock:
+ * - http_cancel() must be able to promise that 'done' will not run after it
+ *   returns. Completion and cancellation both take the lock, so a cancel
+ *   either waits for a running 'done' to finish or prevents it entirely.
+ */
+struct HttpRequest {
+    volatile LONG    refs;
+    CRITICAL_SECTION lock;
+    HINTERNET        hConnect;   /* Only set if not from the connection cache */
+    HINTERNET        hRequest;
+    BOOL             cancelled;
+    BOOL             completed;
+    HttpCompletion   done;
+    void            *ctx;
+    HttpResponse     resp;
+    DWORD            buf_cap;
+    int              buf_slot;        /* Index into g_buffers, -1 if unpooled */
+    DWORD            content_length;  /* From the response headers, 0 if unknown */
+    BOOL             length_exact;    /* content_length is the body size (not compressed) */
+    BOOL             head;            /* HEAD request: no body to read */
+    char            *send_body;       /* Copy of a POST body, NULL otherwise */
+    DWORD            send_len;
+    LONGLONG         t_dns;           /* diag_begin() of the running stages */
+    LONGLONG         t_connect;
+    LONGLONG         t_stage;         /* Send, receive or body, in turn */
+    wchar_t          pac_host[128];   /* Host to run the PAC file for, see pac_worker() */
+};
+
 /* Global session handle.
  *
  * Why global and persistent:
  * - Creating a session is expensive (involves registry lookups, proxy detection)
  * - We make requests every 60 seconds to the same host
  * - Reusing the session enables connection pooling and keep-alive
- * - WinHTTP is documented as thread-safe for separate handles, but since
- *   we're single-threaded, we don't need any synchronization
+ * - WinHTTP is documented as thread-safe for separate handles; per-request
+ *   state touched from worker threads lives in HttpRequest
  */
 static HINTERNET g_session = NULL;
+static BOOL g_decompress;  /* WinHTTP decodes gzip/deflate for us (8.1+) */
+
+/* Cached connection handles, one per (host, port).
+ *
+ * Why cache them:
+ * - Every poll targets the same api.anthropic.com:443, so opening and
+ *   closing a connection handle per request is pure overhead
+ * - Keeping the handle alive keeps WinHTTP's keep-alive socket (and its
+ *   TLS session) associated with it, which is what http_warmup() relies on
+ *
+ * Why a lock:
+ * - http_get() may be called from threads other than the UI thread
+ *   (e.g. the CLI), so lookups and inserts must not race
+ */
+#define HTTP_MAX_CONNECTIONS 4
+
+typedef struct {
+    wchar_t       host[128];
+    INTERNET_PORT port;
+    HINTERNET     handle;
+} CachedConnection;
+
+static CachedConnection g_connections[HTTP_MAX_CONNECTIONS];
+static CRITICAL_SECTION g_conn_lock;
+
+/* Session-owned receive buffers, reused across requests.
+ *
+ * Why pool instead of malloc per request:
+ * - Every poll for the app's lifetime would otherwise malloc a body
+ *   buffer, maybe realloc it, and free it again, fragmenting the heap
+ *   over weeks of uptime
+ * - A handful of slots covers every request that can overlap (a poll,
+ *   a warm-up, a cancelled fetch still winding down); if they're all
+ *   busy we fall back to malloc
+ * - A slot keeps its capacity, so after the first response no further
+ *   allocation happens at all
+ *
+ * Why a lock:
+ * - Buffers are taken on worker threads and returned by whichever thread
+ *   calls http_response_free()
+ */
+#define HTTP_BUFFER_POOL     4
+#define HTTP_BUFFER_INITIAL  4096
+#define HTTP_PRESIZE_MAX     (1024 * 1024)  /* Don't trust larger Content-Lengths */
+
+typedef struct {
+    char *data;
+    DWORD cap;
+    BOOL  in_use;
+} PooledBuffer;
+
+static PooledBuffer g_buffers[HTTP_BUFFER_POOL];
+static SRWLOCK g_buffer_lock = SRWLOCK_INIT;
+
+/* Proxy resolved from a PAC file, one entry per host.
+ *
+ * Why cache the result:
+ * - WinHttpGetProxyForUrl downloads and runs the PAC script; behind a
+ *   corporate proxy that's 100-500ms (more when the PAC host is slow),
+ *   and without a cache every poll paid it again
+ * - The answer only changes with the network (or the PAC file), so an
+ *   entry lives until http_proxy_invalidate() is called on a network
+ *   change, or HTTP_PROXY_CACHE_MS at most
+ *
+ * Why a failed lookup is kept only briefly:
+ * - Keeping it for HTTP_PROXY_CACHE_MS left requests on the fallback route
+ *   for half an hour after the PAC host came back
+ * - Not keeping it at all would put the PAC host's timeout in front of
+ *   every request while it's down, so the entry lives HTTP_PROXY_RETRY_MS,
+ *   doubling with each failure in a row up to HTTP_PROXY_RETRY_MAX_MS
+ * - Meanwhile requests use the session's own proxy settings (system
+ *   proxy or WPAD), not DIRECT: on a proxy-only network a direct route
+ *   can't work, and the system settings often can
+ */
+#define HTTP_PROXY_CACHE_MS     (30 * 60 * 1000)
+#define HTTP_PROXY_RETRY_MS     (30 * 1000)
+#define HTTP_PROXY_RETRY_MAX_MS (10 * 60 * 1000)
+#define HTTP_PROXY_MAX          256
+
+typedef struct {
+    wchar_t   host[128];
+    BOOL      failed;                    /* Lookup failed: keep the session's proxy */
+    BOOL      direct;                    /* PAC said DIRECT */
+    wchar_t   proxy[HTTP_PROXY_MAX];
+    wchar_t   bypass[HTTP_PROXY_MAX];
+    ULONGLONG resolved_at;               /* GetTickCount64(), 0 if unused */
+    DWORD     lifetime;                  /* ms after resolved_at the entry is valid */
+    int       failures;                  /* Failed lookups in a row */
+} CachedProxy;
+
+static CachedProxy g_proxies[HTTP_MAX_CONNECTIONS];
+static SRWLOCK g_proxy_lock = SRWLOCK_INIT;
+static wchar_t g_pac_url[1024];          /* "" when not using a PAC file */
+
+static void CALLBACK http_callback(HINTERNET hInternet, DWORD_PTR context,
+                                   DWORD status, LPVOID info, DWORD info_len);
 
 /* Initialize the HTTP subsystem.
  *
@@ -20,19 +155,60 @@ static HINTERNET g_session = NULL;
  * - Session setup can take 100-500ms on some systems (proxy detection), so
  *   doing it at startup avoids a delay on the first API call
  *
- * Why WINHTTP_ACCESS_TYPE_DEFAULT_PROXY:
- * - Automatically respects system proxy settings (Internet Options → Connections)
- * - Handles corporate proxies, VPNs, and WPAD auto-configuration
- * - Alternative would be WINHTTP_ACCESS_TYPE_NO_PROXY which breaks in
- *   corporate environments
+ * Why WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY:
+ * - On Windows 8.1+ WinHTTP then follows the system settings, including
+ *   WPAD, and keeps its own PAC results per network, so a poll doesn't
+ *   re-evaluate the script
+ * - Older versions reject it; there we fall back to
+ *   WINHTTP_ACCESS_TYPE_DEFAULT_PROXY (the netsh winhttp settings)
+ * - An explicit proxy or PAC URL from config.ini overrides either, via
+ *   http_set_proxy()
+ *
+ * Why WINHTTP_FLAG_ASYNC:
+ * - A synchronous request blocks the tray's message loop for the full
+ *   timeout budget (up to ~45s) on a bad network, freezing the context
+ *   menu, popup and TaskbarCreated handling
+ * - The session-wide status callback drives every request through its
+ *   states on WinHTTP's worker threads instead
  */
 BOOL http_init(void)
 {
     g_session = WinHttpOpen(L"ClaudeUsage/1.0",  /* User-Agent for server logs */
-                            WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+                            4 /* WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY */,
                             WINHTTP_NO_PROXY_NAME,
-                            WINHTTP_NO_PROXY_BYPASS, 0);
-    return (g_session != NULL);
+                            WINHTTP_NO_PROXY_BYPASS, WINHTTP_FLAG_ASYNC);
+    if (!g_session)
+        g_session = WinHttpOpen(L"ClaudeUsage/1.0",
+                                WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+                                WINHTTP_NO_PROXY_NAME,
+                                WINHTTP_NO_PROXY_BYPASS, WINHTTP_FLAG_ASYNC);
+    if (!g_session)
+        return FALSE;
+
+    /* Child handles inherit the callback, so setting it once covers every
+     * connection and request opened on this session. */
+    if (WinHttpSetStatusCallback(g_session, http_callback,
+                                 WINHTTP_CALLBACK_FLAG_ALL_COMPLETIONS |
+                                 WINHTTP_CALLBACK_FLAG_HANDLES |
+                                 WINHTTP_CALLBACK_FLAG_RESOLVE_NAME |
+                                 WINHTTP_CALLBACK_FLAG_CONNECT_TO_SERVER, 0)
+            == WINHTTP_INVALID_STATUS_CALLBACK) {
+        WinHttpCloseHandle(g_session);
+        g_session = NULL;
+        return FALSE;
+    }
+
+    /* Why let WinHTTP decompress:
+     * - With the option set it sends Accept-Encoding: gzip, deflate and
+     *   inflates the body before we read it, so no zlib is linked in
+     * - Windows 7 and 8 reject the option; there we simply don't
+     *   advertise compression and get identity bodies as before */
+    DWORD decompression = 3;  /* WINHTTP_DECOMPRESSION_FLAG_GZIP | _DEFLATE */
+    g_decompress = WinHttpSetOption(g_session, 118 /* WINHTTP_OPTION_DECOMPRESSION */,
+                                    &decompression, sizeof(decompression));
+
+    InitializeCriticalSection(&g_conn_lock);
+    return TRUE;
 }
 
 /* Cleanup the HTTP subsystem.
@@ -44,19 +220,617 @@ BOOL http_init(void)
 void http_shutdown(void)
 {
     if (g_session) {
+        for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+            if (g_connections[i].handle) {
+                WinHttpCloseHandle(g_connections[i].handle);
+                g_connections[i].handle = NULL;
+            }
+        }
+        DeleteCriticalSection(&g_conn_lock);
         WinHttpCloseHandle(g_session);
+
+        AcquireSRWLockExclusive(&g_buffer_lock);
+        for (int i = 0; i < HTTP_BUFFER_POOL; i++) {
+            if (!g_buffers[i].in_use) {
+                free(g_buffers[i].data);
+                g_buffers[i].data = NULL;
+                g_buffers[i].cap = 0;
+            }
+        }
+        ReleaseSRWLockExclusive(&g_buffer_lock);
         g_session = NULL;
     }
 }
 
-/* Perform a synchronous HTTPS GET request.
+void http_set_proxy(const wchar_t *proxy, const wchar_t *bypass,
+                    const wchar_t *pac_url)
+{
+    if (!g_session)
+        return;
+
+    if (proxy && proxy[0]) {
+        /* Fixed proxy: a session option, inherited by every request */
+        WINHTTP_PROXY_INFO info;
+        info.dwAccessType    = WINHTTP_ACCESS_TYPE_NAMED_PROXY;
+        info.lpszProxy       = (LPWSTR)proxy;
+        info.lpszProxyBypass = (bypass && bypass[0]) ? (LPWSTR)bypass : NULL;
+        WinHttpSetOption(g_session, WINHTTP_OPTION_PROXY, &info, sizeof(info));
+        return;
+    }
+
+    AcquireSRWLockExclusive(&g_proxy_lock);
+    g_pac_url[0] = L'\0';
+    if (pac_url && wcslen(pac_url) < sizeof(g_pac_url) / sizeof(g_pac_url[0]))
+        wcscpy(g_pac_url, pac_url);
+    memset(g_proxies, 0, sizeof(g_proxies));
+    ReleaseSRWLockExclusive(&g_proxy_lock);
+}
+
+void http_proxy_invalidate(void)
+{
+    AcquireSRWLockExclusive(&g_proxy_lock);
+    memset(g_proxies, 0, sizeof(g_proxies));
+    ReleaseSRWLockExclusive(&g_proxy_lock);
+}
+
+/* Copy the cached PAC result for 'host' into 'out'. FALSE if none. */
+static BOOL proxy_lookup(const wchar_t *host, CachedProxy *out)
+{
+    BOOL found = FALSE;
+    ULONGLONG now = GetTickCount64();
+
+    AcquireSRWLockShared(&g_proxy_lock);
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        const CachedProxy *p = &g_proxies[i];
+        if (p->resolved_at && now - p->resolved_at < p->lifetime &&
+            wcscmp(p->host, host) == 0) {
+            *out = *p;
+            found = TRUE;
+            break;
+        }
+    }
+    ReleaseSRWLockShared(&g_proxy_lock);
+    return found;
+}
+
+/* Run the PAC file for https://host/ and remember the answer.
+ *
+ * Why resolve per host rather than per URL:
+ * - Every request to a host goes through the same proxy in practice, and
+ *   keying on the host keeps the cache to one entry per connection
  *
- * Why synchronous instead of async:
- * - This runs on a timer in a hidden window - there's no UI to keep responsive
- * - Async WinHTTP requires setting up callbacks and handling state transitions
- * - For a simple tray app making one request per minute, blocking is fine
- * - The main thread will block for ~1-2 seconds during the request, but since
- *   there's no visible window, the user never notices
+ * Blocks for as long as the PAC host takes, so only pac_worker() calls it.
+ */
+static void proxy_resolve(const wchar_t *host, CachedProxy *out)
+{
+    wchar_t url[160];
+    memset(out, 0, sizeof(*out));
+    out->failed = TRUE;
+    if (wcslen(host) >= 128)
+        return;
+    wcscpy(out->host, host);
+    _snwprintf(url, 160, L"https://%s/", host);
+    url[159] = L'\0';
+
+    WINHTTP_AUTOPROXY_OPTIONS opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.dwFlags                = WINHTTP_AUTOPROXY_CONFIG_URL;
+    opts.lpszAutoConfigUrl      = g_pac_url;
+    opts.fAutoLogonIfChallenged = TRUE;
+
+    WINHTTP_PROXY_INFO info;
+    memset(&info, 0, sizeof(info));
+    LONGLONG t0 = diag_begin();
+    if (WinHttpGetProxyForUrl(g_session, url, &opts, &info)) {
+        out->failed = FALSE;
+        out->direct = TRUE;
+        if (info.dwAccessType == WINHTTP_ACCESS_TYPE_NAMED_PROXY && info.lpszProxy) {
+            if (wcslen(info.lpszProxy) < HTTP_PROXY_MAX) {
+                out->direct = FALSE;
+                wcscpy(out->proxy, info.lpszProxy);
+                if (info.lpszProxyBypass && wcslen(info.lpszProxyBypass) < HTTP_PROXY_MAX)
+                    wcscpy(out->bypass, info.lpszProxyBypass);
+            } else {
+                out->failed = TRUE;  /* Unusable answer, not a DIRECT one */
+            }
+        }
+        if (info.lpszProxy)       GlobalFree(info.lpszProxy);
+        if (info.lpszProxyBypass) GlobalFree(info.lpszProxyBypass);
+    }
+    diag_end(DIAG_PROXY, t0);
+    out->resolved_at = GetTickCount64();
+
+    AcquireSRWLockExclusive(&g_proxy_lock);
+    int slot = 0;
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        if (!g_proxies[i].resolved_at || wcscmp(g_proxies[i].host, host) == 0) {
+            slot = i;
+            break;
+        }
+        if (g_proxies[i].resolved_at < g_proxies[slot].resolved_at)
+            slot = i;  /* Oldest, if every slot is taken */
+    }
+    if (out->failed) {
+        out->failures = 1;
+        if (g_proxies[slot].resolved_at && wcscmp(g_proxies[slot].host, host) == 0)
+            out->failures = g_proxies[slot].failures + 1;
+        out->lifetime = HTTP_PROXY_RETRY_MS;
+        for (int i = 1; i < out->failures && out->lifetime < HTTP_PROXY_RETRY_MAX_MS; i++)
+            out->lifetime *= 2;
+        if (out->lifetime > HTTP_PROXY_RETRY_MAX_MS)
+            out->lifetime = HTTP_PROXY_RETRY_MAX_MS;
+    } else {
+        out->lifetime = HTTP_PROXY_CACHE_MS;
+    }
+    g_proxies[slot] = *out;
+    ReleaseSRWLockExclusive(&g_proxy_lock);
+}
+
+static BOOL pac_configured(void)
+{
+    BOOL use_pac;
+    AcquireSRWLockShared(&g_proxy_lock);
+    use_pac = (g_pac_url[0] != L'\0');
+    ReleaseSRWLockShared(&g_proxy_lock);
+    return use_pac;
+}
+
+/* Point the request at the proxy a PAC lookup named. After a failed
+ * lookup the session's own proxy settings stay in effect. */
+static void apply_pac_proxy(HINTERNET hRequest, const CachedProxy *p)
+{
+    if (p->failed)
+        return;
+
+    WINHTTP_PROXY_INFO info;
+    info.dwAccessType    = p->direct ? WINHTTP_ACCESS_TYPE_NO_PROXY
+                                     : WINHTTP_ACCESS_TYPE_NAMED_PROXY;
+    info.lpszProxy       = p->direct ? NULL : (LPWSTR)p->proxy;
+    info.lpszProxyBypass = (!p->direct && p->bypass[0]) ? (LPWSTR)p->bypass : NULL;
+    WinHttpSetOption(hRequest, WINHTTP_OPTION_PROXY, &info, sizeof(info));
+}
+
+/* Look up (or open and remember) the connection handle for host:port.
+ * Sets *owned when the cache is full and the caller must close the handle. */
+static HINTERNET get_connection(const wchar_t *host, INTERNET_PORT port,
+                                BOOL *owned)
+{
+    HINTERNET h = NULL;
+    *owned = FALSE;
+
+    EnterCriticalSection(&g_conn_lock);
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        if (g_connections[i].handle && g_connections[i].port == port &&
+            wcscmp(g_connections[i].host, host) == 0) {
+            h = g_connections[i].handle;
+            break;
+        }
+    }
+    if (!h) {
+        h = WinHttpConnect(g_session, host, port, 0);
+        if (h) {
+            *owned = TRUE;
+            if (wcslen(host) < 128) {
+                for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+                    if (!g_connections[i].handle) {
+                        wcscpy(g_connections[i].host, host);
+                        g_connections[i].port = port;
+                        g_connections[i].handle = h;
+                        *owned = FALSE;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    LeaveCriticalSection(&g_conn_lock);
+    return h;
+}
+
+void http_release(HttpRequest *req)
+{
+    if (!req) return;
+    if (InterlockedDecrement(&req->refs) == 0) {
+        http_response_free(&req->resp);
+        DeleteCriticalSection(&req->lock);
+        free(req->send_body);
+        free(req);
+    }
+}
+
+/* Close the request handle exactly once, from whichever thread gets here
+ * first. WinHTTP answers with HANDLE_CLOSING, which drops its reference. */
+static void close_request(HttpRequest *req)
+{
+    HINTERNET h = (HINTERNET)InterlockedExchangePointer(
+        (PVOID volatile *)&req->hRequest, NULL);
+    if (h) WinHttpCloseHandle(h);
+}
+
+/* Finish a request: report the result to the caller (unless cancelled)
+ * and close the handle. Safe to reach more than once; only the first
+ * call reports. */
+static void complete(HttpRequest *req, DWORD error)
+{
+    EnterCriticalSection(&req->lock);
+    if (!req->completed) {
+        req->completed = TRUE;
+        req->resp.error_code = error;
+        if (error) {
+            /* Partial bodies are not useful to any caller */
+            http_response_free(&req->resp);
+        } else if (req->resp.body) {
+            /* Null-terminate for cJSON (it expects a C string) */
+            req->resp.body[req->resp.body_len] = '\0';
+        }
+        if (!req->cancelled && req->done)
+            req->done(&req->resp, req->ctx);
+        http_response_free(&req->resp);
+    }
+    LeaveCriticalSection(&req->lock);
+    close_request(req);
+}
+
+/* Copy a string response header (ASCII by definition) into a narrow buffer.
+ * Leaves 'out' empty if the header is absent or too long. */
+static void query_header(HINTERNET hRequest, DWORD info_level,
+                         char *out, int out_len)
+{
+    wchar_t value[128];
+    DWORD size = sizeof(value);
+    out[0] = '\0';
+    if (!WinHttpQueryHeaders(hRequest, info_level, WINHTTP_HEADER_NAME_BY_INDEX,
+                             value, &size, WINHTTP_NO_HEADER_INDEX))
+        return;
+    WideCharToMultiByte(CP_UTF8, 0, value, -1, out, out_len, NULL, NULL);
+    out[out_len - 1] = '\0';
+}
+
+/* Read Retry-After as a number of seconds from now.
+ *
+ * Why handle both forms:
+ * - RFC 9110 allows either delta-seconds ("120") or an HTTP-date; servers
+ *   behind different proxies send either
+ * - WinHttpTimeToSystemTime parses the HTTP-date form for us
+ */
+static DWORD query_retry_after(HINTERNET hRequest)
+{
+    wchar_t value[64];
+    DWORD size = sizeof(value);
+    if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RETRY_AFTER,
+                             WINHTTP_HEADER_NAME_BY_INDEX,
+                             value, &size, WINHTTP_NO_HEADER_INDEX))
+        return 0;
+
+    if (value[0] >= L'0' && value[0] <= L'9')
+        return (DWORD)wcstoul(value, NULL, 10);
+
+    SYSTEMTIME st;
+    FILETIME at, now;
+    if (!WinHttpTimeToSystemTime(value, &st) || !SystemTimeToFileTime(&st, &at))
+        return 0;
+    GetSystemTimeAsFileTime(&now);
+
+    ULARGE_INTEGER a, n;
+    a.LowPart = at.dwLowDateTime;  a.HighPart = at.dwHighDateTime;
+    n.LowPart = now.dwLowDateTime; n.HighPart = now.dwHighDateTime;
+    if (a.QuadPart <= n.QuadPart)
+        return 0;
+    return (DWORD)((a.QuadPart - n.QuadPart) / 10000000ULL);
+}
+
+/* Take a receive buffer of at least min_cap bytes, preferring the pool. */
+static BOOL buffer_acquire(HttpRequest *req, DWORD min_cap)
+{
+    HttpResponse *r = &req->resp;
+    DWORD cap = (min_cap > HTTP_BUFFER_INITIAL) ? min_cap : HTTP_BUFFER_INITIAL;
+
+    AcquireSRWLockExclusive(&g_buffer_lock);
+    req->buf_slot = -1;
+    for (int i = 0; i < HTTP_BUFFER_POOL; i++) {
+        if (!g_buffers[i].in_use) {
+            g_buffers[i].in_use = TRUE;
+            req->buf_slot = i;
+            break;
+        }
+    }
+    if (req->buf_slot >= 0) {
+        PooledBuffer *b = &g_buffers[req->buf_slot];
+        if (b->cap < cap) {
+            char *newbuf = (char *)realloc(b->data, cap);
+            if (newbuf) {
+                b->data = newbuf;
+                b->cap = cap;
+            }
+        }
+        r->body = b->data;
+        req->buf_cap = b->cap;
+        if (!r->body || req->buf_cap < min_cap) {
+            b->in_use = FALSE;  /* Couldn't grow it, hand it back */
+            r->body = NULL;
+            req->buf_slot = -1;
+        }
+    }
+    ReleaseSRWLockExclusive(&g_buffer_lock);
+
+    if (!r->body) {
+        r->body = (char *)malloc(cap);
+        req->buf_cap = cap;
+    }
+    return (r->body != NULL);
+}
+
+/* Hand a body back to the pool. Returns FALSE if it wasn't pooled. */
+static BOOL buffer_return(char *body)
+{
+    BOOL found = FALSE;
+    AcquireSRWLockExclusive(&g_buffer_lock);
+    for (int i = 0; i < HTTP_BUFFER_POOL; i++) {
+        if (g_buffers[i].in_use && g_buffers[i].data == body) {
+            g_buffers[i].in_use = FALSE;
+            found = TRUE;
+            break;
+        }
+    }
+    ReleaseSRWLockExclusive(&g_buffer_lock);
+    return found;
+}
+
+/* Make room for 'more' bytes plus a null terminator.
+ *
+ * Why dynamic buffer with doubling:
+ * - Content-Length is optional (and absent with chunked encoding), so we
+ *   can't always know the size in advance
+ * - Pool buffers start at 4KB because typical API response is ~500 bytes
+ * - Doubling strategy (4K→8K→16K) minimizes realloc calls
+ */
+static BOOL reserve_body(HttpRequest *req, DWORD more)
+{
+    HttpResponse *r = &req->resp;
+    if (!r->body)
+        return buffer_acquire(req, more + 1);
+    if (r->body_len + more + 1 <= req->buf_cap)
+        return TRUE;
+
+    DWORD cap = req->buf_cap;
+    while (r->body_len + more + 1 > cap)
+        cap *= 2;
+
+    /* Original stays valid on failure and is released by http_response_free() */
+    char *newbuf;
+    if (req->buf_slot >= 0) {
+        AcquireSRWLockExclusive(&g_buffer_lock);
+        newbuf = (char *)realloc(r->body, cap);
+        if (newbuf) {
+            g_buffers[req->buf_slot].data = newbuf;
+            g_buffers[req->buf_slot].cap = cap;
+        }
+        ReleaseSRWLockExclusive(&g_buffer_lock);
+    } else {
+        newbuf = (char *)realloc(r->body, cap);
+    }
+    if (!newbuf) return FALSE;
+    r->body = newbuf;
+    req->buf_cap = cap;
+    return TRUE;
+}
+
+/* Issue the next body read straight into the receive buffer.
+ *
+ * Why not WinHttpQueryDataAvailable first:
+ * - It costs an extra async round trip per chunk just to learn a size we
+ *   don't need: WinHttpReadData fills whatever space we offer and
+ *   reports how much it wrote (0 at end of body)
+ * - With a Content-Length the buffer is sized up front, so the whole
+ *   body typically arrives in a single read
+ */
+static void read_body(HttpRequest *req, HINTERNET hRequest)
+{
+    HttpResponse *r = &req->resp;
+    DWORD want = 1;
+    if (req->content_length > r->body_len)
+        want = req->content_length - r->body_len;
+
+    if (!reserve_body(req, want)) {
+        complete(req, ERROR_NOT_ENOUGH_MEMORY);
+        return;
+    }
+    if (!WinHttpReadData(hRequest, r->body + r->body_len,
+                         req->buf_cap - r->body_len - 1, NULL))
+        complete(req, GetLastError());
+}
+
+/* Drive a request through its states.
+ *
+ * The async WinHTTP pattern is a chain: each completion notification
+ * issues the next call, whose own completion arrives as another
+ * notification:
+ *   SendRequest → SENDREQUEST_COMPLETE → ReceiveResponse → HEADERS_AVAILABLE
+ *   → ReadData → READ_COMPLETE → ReadData → ... → READ_COMPLETE (0 bytes)
+ * Any failure, synchronous or reported via REQUEST_ERROR, ends in complete().
+ *
+ * Why use hInternet rather than req->hRequest:
+ * - req->hRequest is cleared as soon as someone starts closing it; WinHTTP
+ *   may still deliver notifications (with a cancellation error) until
+ *   HANDLE_CLOSING
+ */
+static void CALLBACK http_callback(HINTERNET hInternet, DWORD_PTR context,
+                                   DWORD status, LPVOID info, DWORD info_len)
+{
+    HttpRequest *req = (HttpRequest *)context;
+    if (!req) return;  /* Connection handles carry no context */
+
+    switch (status) {
+    /* Timing only (see diag.c); these fire only for a new connection */
+    case WINHTTP_CALLBACK_STATUS_RESOLVING_NAME:
+        req->t_dns = diag_begin();
+        break;
+    case WINHTTP_CALLBACK_STATUS_NAME_RESOLVED:
+        if (req->t_dns)
+            diag_end(DIAG_DNS, req->t_dns);
+        break;
+    case WINHTTP_CALLBACK_STATUS_CONNECTING_TO_SERVER:
+        req->t_connect = diag_begin();
+        break;
+    case WINHTTP_CALLBACK_STATUS_CONNECTED_TO_SERVER:
+        if (req->t_connect)
+            diag_end(DIAG_CONNECT, req->t_connect);
+        break;
+
+    case WINHTTP_CALLBACK_STATUS_SENDREQUEST_COMPLETE:
+        if (!req->head)
+            diag_end(DIAG_SEND, req->t_stage);
+        req->t_stage = diag_begin();
+
+        /* Wait for and receive the response headers */
+        if (!WinHttpReceiveResponse(hInternet, NULL))
+            complete(req, GetLastError());
+        break;
+
+    case WINHTTP_CALLBACK_STATUS_HEADERS_AVAILABLE: {
+        /* Extract HTTP status code (200, 401, etc.)
+         *
+         * Why query as number instead of string:
+         * - Saves a string-to-int conversion
+         * - WINHTTP_QUERY_FLAG_NUMBER tells WinHTTP to parse it for us
+         *
+         * Why not check the return value:
+         * - If the query fails, status_code stays 0
+         * - Caller interprets 0 as "unknown/error" which is correct
+         */
+        DWORD status_code = 0;
+        DWORD size = sizeof(status_code);
+        WinHttpQueryHeaders(hInternet,
+                            WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+                            WINHTTP_HEADER_NAME_BY_INDEX,
+                            &status_code, &size, WINHTTP_NO_HEADER_INDEX);
+        req->resp.status_code = (int)status_code;
+        req->resp.not_modified = (status_code == 304);
+
+        /* Validators for the caller's next conditional request */
+        query_header(hInternet, WINHTTP_QUERY_ETAG,
+                     req->resp.etag, sizeof(req->resp.etag));
+        query_header(hInternet, WINHTTP_QUERY_LAST_MODIFIED,
+                     req->resp.last_modified, sizeof(req->resp.last_modified));
+        if (status_code == 429 || status_code == 503)
+            req->resp.retry_after_sec = query_retry_after(hInternet);
+
+        if (req->head) {
+            complete(req, 0);
+            break;
+        }
+        diag_end(DIAG_RECEIVE, req->t_stage);
+        req->t_stage = diag_begin();
+
+        /* Size the buffer from Content-Length when the server sends it.
+         * With decompression on it is the compressed size: still a fine
+         * first guess for the buffer, but the body only ends at a 0-byte
+         * read. */
+        DWORD length = 0;
+        size = sizeof(length);
+        if (WinHttpQueryHeaders(hInternet,
+                                WINHTTP_QUERY_CONTENT_LENGTH | WINHTTP_QUERY_FLAG_NUMBER,
+                                WINHTTP_HEADER_NAME_BY_INDEX,
+                                &length, &size, WINHTTP_NO_HEADER_INDEX)) {
+            if (length == 0) {
+                complete(req, 0);
+                break;
+            }
+            if (length <= HTTP_PRESIZE_MAX) {
+                req->content_length = length;
+                req->length_exact = !g_decompress;
+            }
+        }
+
+        read_body(req, hInternet);
+        break;
+    }
+
+    case WINHTTP_CALLBACK_STATUS_READ_COMPLETE: {
+        HttpResponse *r = &req->resp;
+        r->body_len += info_len;
+        if (info_len == 0 ||
+            (req->length_exact && r->body_len >= req->content_length)) {
+            diag_end(DIAG_BODY, req->t_stage);
+            complete(req, 0);  /* End of body */
+        } else
+            read_body(req, hInternet);
+        break;
+    }
+
+    case WINHTTP_CALLBACK_STATUS_REQUEST_ERROR: {
+        WINHTTP_ASYNC_RESULT *result = (WINHTTP_ASYNC_RESULT *)info;
+        complete(req, result->dwError);
+        break;
+    }
+
+    case WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING:
+        /* Last notification for this request. Report cancellation if nothing
+         * else did, then close an uncached connection and drop WinHTTP's
+         * reference.
+         *
+         * Why this order:
+         * - Request handle must be closed before connection handle
+         * - Closing in wrong order can cause resource leaks or crashes */
+        complete(req, ERROR_WINHTTP_OPERATION_CANCELLED);
+        if (req->hConnect) {
+            WinHttpCloseHandle(req->hConnect);
+            req->hConnect = NULL;
+        }
+        http_release(req);
+        break;
+    }
+}
+
+/* Send the request (headers, plus the body for POST). The rest
+ * happens in http_callback(). */
+static void send_request(HttpRequest *req)
+{
+    req->t_stage = diag_begin();
+    if (!WinHttpSendRequest(req->hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0,
+                            req->send_body ? req->send_body : WINHTTP_NO_REQUEST_DATA,
+                            req->send_len, req->send_len, (DWORD_PTR)req))
+        complete(req, GetLastError());
+}
+
+/* Run the PAC file for a request that found no cached answer, then send it.
+ *
+ * Why on a worker thread:
+ * - WinHttpGetProxyForUrl downloads and runs the script synchronously, so
+ *   inline in start_request() it held up the caller (the tray's UI thread
+ *   for every poll) for 100-500ms, or the PAC host's whole timeout
+ * - The request is already open with its headers and timeouts set; only
+ *   the proxy option and the send wait for the answer
+ *
+ * Why req->lock is held from the cancel check through the send:
+ * - http_cancel() sets 'cancelled' under the lock before it closes the
+ *   handle, so a cancel either lands first and the request is never sent,
+ *   or closes it after the send like any other request in flight
+ */
+static DWORD WINAPI pac_worker(LPVOID param)
+{
+    HttpRequest *req = (HttpRequest *)param;
+    CachedProxy p;
+
+    /* Another request to the host may have resolved it meanwhile */
+    if (!proxy_lookup(req->pac_host, &p))
+        proxy_resolve(req->pac_host, &p);
+
+    EnterCriticalSection(&req->lock);
+    if (req->cancelled || !req->hRequest) {
+        LeaveCriticalSection(&req->lock);
+        complete(req, ERROR_WINHTTP_OPERATION_CANCELLED);
+    } else {
+        apply_pac_proxy(req->hRequest, &p);
+        send_request(req);
+        LeaveCriticalSection(&req->lock);
+    }
+
+    http_release(req);
+    return 0;
+}
+
+/* Start an asynchronous HTTPS GET request.
  *
  * Why separate hConnect and hRequest handles:
  * - This is the required WinHTTP calling pattern
@@ -69,37 +843,82 @@ void http_shutdown(void)
  * - WinHTTP validates the server certificate automatically
  * - Uses the system's trusted root certificate store
  * - Will fail if the certificate is invalid (expired, wrong domain, self-signed)
+ *
+ * Why report early failures through 'done' as well:
+ * - Callers then have a single result path whether the request failed
+ *   before or after it hit the network
  */
-HttpResponse http_get(const wchar_t *host, INTERNET_PORT port,
-                      const wchar_t *url_path, const wchar_t *headers)
+static HttpRequest *start_request(const wchar_t *verb,
+                                  const wchar_t *host, INTERNET_PORT port,
+                                  const wchar_t *url_path, const wchar_t *headers,
+                                  const void *body, DWORD body_len,
+                                  HttpCompletion done, void *ctx)
 {
-    HttpResponse resp;
-    memset(&resp, 0, sizeof(resp));
+    if (!g_session) return NULL;
+
+    HttpRequest *req = (HttpRequest *)calloc(1, sizeof(*req));
+    if (!req) return NULL;
 
-    HINTERNET hConnect = NULL;
-    HINTERNET hRequest = NULL;
+    /* WinHTTP reads the body during the async send, after we return */
+    if (body_len) {
+        req->send_body = (char *)malloc(body_len);
+        if (!req->send_body) {
+            free(req);
+            return NULL;
+        }
+        memcpy(req->send_body, body, body_len);
+        req->send_len = body_len;
+    }
 
-    /* Create connection to host (reuses existing connection if available) */
-    hConnect = WinHttpConnect(g_session, host, port, 0);
+    req->refs = 2;  /* One for the caller, one for WinHTTP (HANDLE_CLOSING) */
+    InitializeCriticalSection(&req->lock);
+    req->done = done;
+    req->ctx  = ctx;
+    req->buf_slot = -1;
+    req->head = (wcscmp(verb, L"HEAD") == 0);
+
+    /* Connection to host, cached across requests */
+    BOOL owned;
+    HINTERNET hConnect = get_connection(host, port, &owned);
     if (!hConnect) {
-        resp.error_code = GetLastError();
-        goto cleanup;
+        complete(req, GetLastError());
+        http_release(req);  /* No request handle, so no HANDLE_CLOSING */
+        return req;
     }
+    if (owned)
+        req->hConnect = hConnect;
 
-    /* Create GET request */
-    hRequest = WinHttpOpenRequest(hConnect, L"GET", url_path, NULL,
-                                  WINHTTP_NO_REFERER,
-                                  WINHTTP_DEFAULT_ACCEPT_TYPES,
-                                  WINHTTP_FLAG_SECURE);
-    if (!hRequest) {
-        resp.error_code = GetLastError();
-        goto cleanup;
+    req->hRequest = WinHttpOpenRequest(hConnect, verb, url_path, NULL,
+                                       WINHTTP_NO_REFERER,
+                                       WINHTTP_DEFAULT_ACCEPT_TYPES,
+                                       WINHTTP_FLAG_SECURE);
+    if (!req->hRequest) {
+        complete(req, GetLastError());
+        if (req->hConnect) {
+            WinHttpCloseHandle(req->hConnect);
+            req->hConnect = NULL;
+        }
+        http_release(req);
+        return req;
     }
 
+    /* Attach our state before anything can trigger a notification, so that
+     * even an immediate close reaches HANDLE_CLOSING with the right context */
+    DWORD_PTR context = (DWORD_PTR)req;
+    WinHttpSetOption(req->hRequest, WINHTTP_OPTION_CONTEXT_VALUE,
+                     &context, sizeof(context));
+
+    /* Offer HTTP/2 (Windows 10 1607+; older versions reject the option
+     * and stay on HTTP/1.1). Concurrent requests to the same host, such
+     * as several accounts' fetches, then share one TLS connection. */
+    DWORD protocols = 1;  /* WINHTTP_PROTOCOL_FLAG_HTTP2 */
+    WinHttpSetOption(req->hRequest, 133 /* WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL */,
+                     &protocols, sizeof(protocols));
+
     /* Add custom headers (OAuth bearer token, anthropic-beta header) */
     if (headers && headers[0]) {
         /* -1L means "headers is null-terminated, calculate length" */
-        WinHttpAddRequestHeaders(hRequest, (LPWSTR)headers, (DWORD)-1L,
+        WinHttpAddRequestHeaders(req->hRequest, (LPWSTR)headers, (DWORD)-1L,
                                  WINHTTP_ADDREQ_FLAG_ADD);
     }
 
@@ -115,124 +934,137 @@ HttpResponse http_get(const wchar_t *host, INTERNET_PORT port,
      * Why fail fast instead of infinite timeout:
      * - If the network is down, we want to know immediately (show error balloon)
      * - Next poll cycle will retry anyway
-     * - Don't want to block the UI thread indefinitely
+     * - A stuck request would hold back the next poll indefinitely
      */
-    WinHttpSetTimeouts(hRequest, 10000, 10000, 10000, 15000);
+    WinHttpSetTimeouts(req->hRequest, 10000, 10000, 10000, 15000);
 
-    /* Send the request (headers + empty body for GET) */
-    if (!WinHttpSendRequest(hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-                            WINHTTP_NO_REQUEST_DATA, 0, 0, 0)) {
-        resp.error_code = GetLastError();
-        goto cleanup;
+    /* With a PAC URL configured, a cached answer applies here. Without
+     * one the script runs on a worker thread, which sends the request
+     * when it has the answer. */
+    if (pac_configured()) {
+        CachedProxy p;
+        if (proxy_lookup(host, &p)) {
+            apply_pac_proxy(req->hRequest, &p);
+        } else if (wcslen(host) < 128) {
+            wcscpy(req->pac_host, host);
+            InterlockedIncrement(&req->refs);  /* Held by the worker */
+            if (QueueUserWorkItem(pac_worker, req, WT_EXECUTELONGFUNCTION))
+                return req;
+            http_release(req);  /* No worker: keep the session's proxy */
+        }
     }
 
-    /* Wait for and receive the response headers */
-    if (!WinHttpReceiveResponse(hRequest, NULL)) {
-        resp.error_code = GetLastError();
-        goto cleanup;
-    }
+    send_request(req);
+    return req;
+}
 
-    /* Extract HTTP status code (200, 401, etc.)
-     *
-     * Why query as number instead of string:
-     * - Saves a string-to-int conversion
-     * - WINHTTP_QUERY_FLAG_NUMBER tells WinHTTP to parse it for us
-     *
-     * Why not check the return value:
-     * - If the query fails, status_code stays 0
-     * - Caller interprets 0 as "unknown/error" which is correct
-     */
-    DWORD status_code = 0;
-    DWORD size = sizeof(status_code);
-    WinHttpQueryHeaders(hRequest,
-                        WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
-                        WINHTTP_HEADER_NAME_BY_INDEX,
-                        &status_code, &size, WINHTTP_NO_HEADER_INDEX);
-    resp.status_code = (int)status_code;
-
-    /* Read response body in a loop.
-     *
-     * Why dynamic buffer with doubling:
-     * - We don't know the response size in advance (no Content-Length header required)
-     * - Starting at 4KB because typical API response is ~500 bytes
-     * - Doubling strategy (4K→8K→16K) minimizes realloc calls
-     * - Adding +1 for null terminator so cJSON can parse it as a string
-     *
-     * Why QueryDataAvailable + ReadData loop:
-     * - This is the documented WinHTTP pattern for reading responses
-     * - QueryDataAvailable tells us how many bytes are ready without blocking
-     * - ReadData reads those bytes
-     * - Loop continues until QueryDataAvailable returns 0 (EOF)
-     */
-    DWORD buf_cap = 4096;
-    DWORD buf_len = 0;
-    char *buf = (char *)malloc(buf_cap);
-    if (!buf) {
-        resp.error_code = ERROR_NOT_ENOUGH_MEMORY;
-        goto cleanup;
-    }
-
-    for (;;) {
-        DWORD available = 0;
-        if (!WinHttpQueryDataAvailable(hRequest, &available))
-            break;  /* Error or connection closed */
-        if (available == 0)
-            break;  /* EOF */
-
-        /* Grow buffer if needed (ensure space for data + null terminator) */
-        while (buf_len + available + 1 > buf_cap) {
-            buf_cap *= 2;
-            char *newbuf = (char *)realloc(buf, buf_cap);
-            if (!newbuf) {
-                /* realloc failed - free original and bail out */
-                free(buf);
-                buf = NULL;
-                break;
-            }
-            buf = newbuf;
-        }
-        if (!buf) break;
+HttpRequest *http_get_async(const wchar_t *host, INTERNET_PORT port,
+                            const wchar_t *url_path, const wchar_t *headers,
+                            HttpCompletion done, void *ctx)
+{
+    return start_request(L"GET", host, port, url_path, headers, NULL, 0,
+                         done, ctx);
+}
 
-        /* Read the available bytes */
-        DWORD bytesRead = 0;
-        if (!WinHttpReadData(hRequest, buf + buf_len, available, &bytesRead))
-            break;
-        buf_len += bytesRead;
+HttpRequest *http_post_async(const wchar_t *host, INTERNET_PORT port,
+                             const wchar_t *url_path, const wchar_t *headers,
+                             const void *body, DWORD body_len,
+                             HttpCompletion done, void *ctx)
+{
+    return start_request(L"POST", host, port, url_path, headers,
+                         body, body_len, done, ctx);
+}
+
+/* Pre-establish a connection to host:port.
+ *
+ * Why a HEAD request:
+ * - It pays for DNS, TCP and the TLS handshake but transfers no body
+ * - The socket then sits in WinHTTP's keep-alive pool, so the next real
+ *   request skips the ~400ms of setup that dominates a "first fetch"
+ *
+ * Why fire-and-forget:
+ * - Nothing depends on the result; if it fails, the next real request
+ *   simply does the handshake itself
+ */
+void http_warmup(const wchar_t *host, INTERNET_PORT port)
+{
+    http_release(start_request(L"HEAD", host, port, L"/", NULL, NULL, 0,
+                               NULL, NULL));
+}
+
+void http_cancel(HttpRequest *req)
+{
+    if (!req) return;
+
+    EnterCriticalSection(&req->lock);
+    req->cancelled = TRUE;
+    LeaveCriticalSection(&req->lock);
+
+    close_request(req);
+    http_release(req);
+}
+
+/* Blocking GET built on the async engine.
+ *
+ * Why not a separate synchronous code path:
+ * - A WinHTTP session is either sync or async, and a second session would
+ *   repeat proxy detection and lose connection reuse with the async one
+ * - One request state machine means one place to get timeouts and
+ *   error handling right
+ */
+typedef struct {
+    HANDLE       event;
+    HttpResponse resp;
+} SyncWait;
+
+static void sync_done(HttpResponse *resp, void *ctx)
+{
+    SyncWait *w = (SyncWait *)ctx;
+    w->resp = *resp;
+    resp->body = NULL;  /* Take ownership */
+    SetEvent(w->event);
+}
+
+HttpResponse http_get(const wchar_t *host, INTERNET_PORT port,
+                      const wchar_t *url_path, const wchar_t *headers)
+{
+    SyncWait w;
+    memset(&w, 0, sizeof(w));
+
+    w.event = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!w.event) {
+        w.resp.error_code = GetLastError();
+        return w.resp;
     }
 
-    /* Null-terminate for cJSON (it expects a C string) */
-    if (buf) {
-        buf[buf_len] = '\0';
-        resp.body = buf;
-        resp.body_len = buf_len;
+    HttpRequest *req = http_get_async(host, port, url_path, headers,
+                                      sync_done, &w);
+    if (req) {
+        /* WinHTTP timeouts bound this wait */
+        WaitForSingleObject(w.event, INFINITE);
+        http_release(req);
+    } else {
+        w.resp.error_code = g_session ? ERROR_NOT_ENOUGH_MEMORY
+                                      : ERROR_INVALID_HANDLE;
     }
 
-cleanup:
-    /* Close handles in reverse order of creation.
-     *
-     * Why this order:
-     * - Request handle must be closed before connection handle
-     * - Connection handle must be closed before session handle (but session
-     *   is global and closed separately in http_shutdown)
-     * - Closing in wrong order can cause resource leaks or crashes
-     */
-    if (hRequest) WinHttpCloseHandle(hRequest);
-    if (hConnect) WinHttpCloseHandle(hConnect);
-    return resp;
+    CloseHandle(w.event);
+    return w.resp;
 }
 
-/* Free heap-allocated response body.
+/* Release a response body.
  *
  * Why a separate function instead of expecting caller to free():
- * - Encapsulation: caller doesn't need to know body is malloc'd
- * - Future-proofing: if we change to a different allocator or pool,
- *   only this function needs to change
+ * - Encapsulation: caller doesn't need to know where the body lives
+ * - Bodies usually live in a pooled receive buffer, which goes back to
+ *   the pool here rather than to the heap
  * - Symmetric with http_get() for API clarity
  */
 void http_response_free(HttpResponse *resp)
 {
     if (resp->body) {
-        free(resp->body);
+        if (!buffer_return(resp->body))
+            free(resp->body);
         resp->body = NULL;
     }
     resp->body_len = 0;
@@ -6,18 +6,47 @@
 
 typedef struct {
     int    status_code;   /* HTTP status (200, 401, etc.), 0 on connection failure */
-    char  *body;          /* Heap-allocated response body (caller frees), NULL on failure */
+    char  *body;          /* Response body (release with http_response_free()), NULL on failure */
     DWORD  body_len;
     DWORD  error_code;    /* Win32 error on failure, 0 on success */
+    BOOL   not_modified;  /* 304: the caller's cached copy (If-None-Match) is current */
+    char   etag[128];     /* ETag response header, "" if absent */
+    char   last_modified[64]; /* Last-Modified response header, "" if absent */
+    DWORD  retry_after_sec;   /* Retry-After (seconds or HTTP-date), 0 if absent */
 } HttpResponse;
 
+/* Opaque handle for an in-flight asynchronous request. */
+typedef struct HttpRequest HttpRequest;
+
+/* Completion callback for http_get_async().
+   Runs exactly once per request unless the request was cancelled: usually
+   on a WinHTTP worker thread (or the PAC lookup's thread-pool thread), but
+   on the calling thread, before http_*_async() returns, when the request
+   fails early (no connection, no request handle, or a send that fails
+   synchronously). Don't rely on the returned handle having been stored
+   by the time it runs. The callback may take ownership of resp->body by
+   setting it to NULL; otherwise the body is freed when the callback returns. */
+typedef void (*HttpCompletion)(HttpResponse *resp, void *ctx);
+
 /* Initialize the HTTP session. Call once at startup. */
 BOOL http_init(void);
 
-/* Shutdown the HTTP session. Call once at exit. */
+/* Shutdown the HTTP session. Call once at exit, after cancelling any
+   outstanding asynchronous requests. */
 void http_shutdown(void);
 
-/* Perform an HTTPS GET request.
+/* Override the system proxy settings (call after http_init()).
+   proxy: "host:port" (or WinHTTP proxy list) for every request, with an
+   optional 'bypass' list; takes precedence over 'pac_url'.
+   pac_url: PAC script to evaluate per host, results cached until
+   http_proxy_invalidate(). NULL or "" for either means not configured. */
+void http_set_proxy(const wchar_t *proxy, const wchar_t *bypass,
+                    const wchar_t *pac_url);
+
+/* Forget cached PAC results, e.g. after the network changed. */
+void http_proxy_invalidate(void);
+
+/* Perform an HTTPS GET request, blocking until it completes.
    host: e.g. L"api.anthropic.com"
    url_path: e.g. L"/api/oauth/usage"
    headers: additional headers, \r\n separated
@@ -25,6 +54,35 @@ void http_shutdown(void);
 HttpResponse http_get(const wchar_t *host, INTERNET_PORT port,
                       const wchar_t *url_path, const wchar_t *headers);
 
+/* Start an HTTPS GET request without blocking the calling thread.
+   'done' is invoked with the result, normally on a worker thread; early
+   failures report from inside this call (see HttpCompletion).
+   Returns NULL only if the request could not be allocated (or the session
+   is not initialized); in that case 'done' is never called.
+   The returned handle must be passed to http_release() once 'done' has run,
+   or to http_cancel() to abandon the request. */
+HttpRequest *http_get_async(const wchar_t *host, INTERNET_PORT port,
+                            const wchar_t *url_path, const wchar_t *headers,
+                            HttpCompletion done, void *ctx);
+
+/* Start an HTTPS POST of 'body' (copied; 'headers' should name its
+   Content-Type). Otherwise the same contract as http_get_async(). */
+HttpRequest *http_post_async(const wchar_t *host, INTERNET_PORT port,
+                             const wchar_t *url_path, const wchar_t *headers,
+                             const void *body, DWORD body_len,
+                             HttpCompletion done, void *ctx);
+
+/* Open (and cache) a connection to host:port in the background so that
+   the next request finds DNS, TCP and TLS already done. */
+void http_warmup(const wchar_t *host, INTERNET_PORT port);
+
+/* Abort an in-flight request and release the caller's reference.
+   Once this returns, 'done' is guaranteed not to be running or to run later. */
+void http_cancel(HttpRequest *req);
+
+/* Release the caller's reference to a completed request. */
+void http_release(HttpRequest *req);
+
 void http_response_free(HttpResponse *resp);
 
 #endif
@@ -0,0 +1,89 @@
+#include "idle.h"
+#include <malloc.h>
+
+/* SetProcessInformation(ProcessPowerThrottling) is Windows 8+ and the
+ * power throttling class is Windows 10 1709+; the target is Windows 7,
+ * so both the function and its structure are declared here. */
+#define IDLE_PROCESS_POWER_THROTTLING       4  /* PROCESS_INFORMATION_CLASS */
+#define IDLE_THROTTLING_CURRENT_VERSION     1
+#define IDLE_THROTTLING_EXECUTION_SPEED     0x1
+
+typedef struct {
+    ULONG Version;
+    ULONG ControlMask;
+    ULONG StateMask;
+} IdlePowerThrottlingState;
+
+typedef BOOL (WINAPI *SetProcessInformationFunc)(HANDLE, int, LPVOID, DWORD);
+
+/* At most this many heaps are compacted (the process heap, the CRT heap
+ * and whatever the loaded DLLs created) */
+#define IDLE_MAX_HEAPS 32
+
+static void set_eco_qos(BOOL on)
+{
+    static SetProcessInformationFunc set_info;
+    static BOOL resolved;
+
+    if (!resolved) {
+        HMODULE kernel32 = GetModuleHandleW(L"kernel32.dll");
+        set_info = kernel32 ? (SetProcessInformationFunc)
+                   GetProcAddress(kernel32, "SetProcessInformation") : NULL;
+        resolved = TRUE;
+    }
+    if (!set_info)
+        return;
+
+    IdlePowerThrottlingState state;
+    state.Version     = IDLE_THROTTLING_CURRENT_VERSION;
+    state.ControlMask = IDLE_THROTTLING_EXECUTION_SPEED;
+    state.StateMask   = on ? IDLE_THROTTLING_EXECUTION_SPEED : 0;
+    /* Fails harmlessly before Windows 10 1709 (unknown class) */
+    set_info(GetCurrentProcess(), IDLE_PROCESS_POWER_THROTTLING,
+             &state, sizeof(state));
+}
+
+/* Hand back memory the process no longer touches.
+ *
+ * Why all three steps:
+ * - The popup surface, JSON buffers and WinHTTP's receive buffers are
+ *   freed long before the pages behind them are; HeapCompact() (and
+ *   _heapmin() for the CRT heap) decommits free blocks so they stop
+ *   counting as private bytes
+ * - SetProcessWorkingSetSize(-1, -1) then moves every remaining page to
+ *   the standby list. What the next poll needs faults back in from RAM,
+ *   which costs microseconds once a minute
+ * - On a VDI host the sum of idle tray apps is what limits density, so
+ *   an instance sitting at a few hundred KB matters more than the soft
+ *   faults
+ */
+static void trim_memory(void)
+{
+    HANDLE heaps[IDLE_MAX_HEAPS];
+    DWORD n = GetProcessHeaps(IDLE_MAX_HEAPS, heaps);
+    if (n > IDLE_MAX_HEAPS)
+        n = IDLE_MAX_HEAPS;
+    for (DWORD i = 0; i < n; i++)
+        HeapCompact(heaps[i], 0);
+    _heapmin();
+
+    SetProcessWorkingSetSize(GetCurrentProcess(), (SIZE_T)-1, (SIZE_T)-1);
+}
+
+/* Why EcoQoS:
+ * - Between polls the process only services a timer and a file watch;
+ *   on hybrid CPUs EcoQoS keeps that work on efficiency cores at low
+ *   clocks, and Windows coalesces its timers more aggressively
+ * - It's switched off while the popup is up, so drawing and input never
+ *   run throttled
+ */
+void idle_enter(void)
+{
+    set_eco_qos(TRUE);
+    trim_memory();
+}
+
+void idle_leave(void)
+{
+    set_eco_qos(FALSE);
+}
@@ -0,0 +1,15 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <windows.h>
+
+/* Go idle: background (EcoQoS) execution, compacted heaps and a trimmed
+   working set. Call when nothing is on screen but the tray icon, e.g.
+   after the popup is dismissed. */
+void idle_enter(void);
+
+/* Leave idle mode before interactive work (showing the popup), so it
+   isn't throttled. Pages come back on demand either way. */
+void idle_leave(void);
+
+#endif
@@ -1,14 +1,28 @@
 #include <windows.h>
 #include <shellapi.h>
 #include <commctrl.h>
+#include <wtsapi32.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "arena.h"
+#include "broker.h"
 #include "config.h"
+#include "diag.h"
+#include "export.h"
+#include "forecast.h"
+#include "history.h"
 #include "http.h"
+#include "idle.h"
+#include "netwatch.h"
 #include "api.h"
+#include "pipesrv.h"
 #include "popup.h"
+#include "retry.h"
+#include "sched.h"
+#include "trayicon.h"
 #include "util.h"
+#include "watch.h"
 
 /* Resource IDs (must match app.rc) */
 #define IDI_GREEN   1001
@@ -17,52 +31,175 @@
 
 /* Custom messages and IDs */
 #define WM_TRAYICON            (WM_APP + 1)
+#define WM_USAGE_READY         (WM_APP + 2)  /* wParam: fetch id, lParam: UsageData* */
+#define WM_ACCOUNT_READY       (WM_APP + 3)  /* Same, for the other accounts */
+#define WM_EXPORT_DONE         (WM_APP + 4)  /* wParam: HTTP status of an export batch */
 #define IDT_POLL_TIMER         1
-#define IDT_SUBSCRIPTION_TIMER 2
+#define IDT_SUBSCRIPTION_TIMER 2  /* Fallback when the directory watch fails */
+#define IDT_CREDENTIALS_DEBOUNCE 3
+#define IDT_NETWORK_DEBOUNCE   4
+#define IDT_STARTUP_TIMER      5  /* Second startup stage (see start_deferred()) */
+#define IDT_EXPIRY_TIMER       6  /* Just after the access token's expiresAt */
+#define IDT_EXPORT_TIMER       7  /* Periodic export batch (export_url) */
+
+/* Let Windows batch a timer within this fraction of its delay, capped */
+#define TIMER_TOLERANCE_DIVISOR 10
+#define TIMER_TOLERANCE_MAX_MS  15000
+
+/* Power settings (winnt.h only declares some of them for Windows 8+) */
+static const GUID GUID_CONSOLE_DISPLAY =   /* GUID_CONSOLE_DISPLAY_STATE */
+    { 0x6fe69556, 0x704a, 0x47a0, { 0x8f, 0x24, 0xc2, 0x8d, 0x93, 0x6f, 0xda, 0x47 } };
+static const GUID GUID_MONITOR_POWER =     /* GUID_MONITOR_POWER_ON, Windows 7 */
+    { 0x02731015, 0x4510, 0x4526, { 0x99, 0xe6, 0xe5, 0xa1, 0x7e, 0xbd, 0x1a, 0xea } };
+static const GUID GUID_POWER_SOURCE =      /* GUID_ACDC_POWER_SOURCE */
+    { 0x5d3e9a59, 0xe9d5, 0x4b00, { 0xa6, 0xbd, 0xff, 0x34, 0xff, 0x51, 0x65, 0x48 } };
+static const GUID GUID_BATTERY_SAVER =     /* GUID_POWER_SAVING_STATUS */
+    { 0xe00958c0, 0xc213, 0x4ace, { 0xac, 0x77, 0xfe, 0xcc, 0xed, 0x2e, 0xee, 0xa5 } };
 #define IDM_REFRESH            2001
 #define IDM_OPENCONFIG         2002
 #define IDM_EXIT               2003
+#define IDM_DIAGNOSTICS        2004  /* Shift+right-click only */
 
 #define TRAY_UID        100
 
+/* Claude Code writes a temp file and renames it over .credentials.json,
+ * which arrives as a burst of notifications; reload once they settle. */
+#define CREDENTIALS_DEBOUNCE_MS 500
+/* Let DHCP and DNS settle after an interface change before checking */
+#define NETWORK_DEBOUNCE_MS 2000
+/* The network half of startup runs this long after the tray icon is up,
+ * plus up to STARTUP_JITTER_MS so a host's logins don't fetch in step */
+#define STARTUP_DELAY_MS  1000
+#define STARTUP_JITTER_MS 4000
+/* Re-read credentials this long after the token expires, giving Claude
+ * Code time to write the refreshed one; timers further out are re-armed
+ * on the next read */
+#define EXPIRY_GRACE_MS   15000
+#define EXPIRY_MAX_MS     (24 * 3600 * 1000)
+
 static UINT WM_TASKBAR_CREATED;
 
+/* What the shell was last sent for our icon.
+ *
+ * Why keep a snapshot:
+ * - Every Shell_NotifyIconW is handled by Explorer cross-process; on a
+ *   terminal server with many sessions, re-sending an identical icon and
+ *   tooltip every poll adds up to measurable idle Explorer CPU
+ * - Comparing against what was actually published lets each update send
+ *   only the NIF_* fields that changed, or nothing at all
+ */
+typedef struct {
+    HICON   icon;
+    wchar_t tip[128];
+    BOOL    error_balloon;  /* Balloon shown for the current failure streak */
+    LONGLONG limit_warned_5h;  /* Reset time of the 5-hour window last warned about */
+    LONGLONG limit_warned_7d;  /* Same for the 7-day window */
+} TrayShown;
+
+/* An account beyond the main one (credentials_path2..4).
+ *
+ * Why a lighter path than the main account:
+ * - The main account drives the icon, the poll schedule, retries, the
+ *   broker, history and the forecast; the others are shown alongside it
+ *   in the tooltip and popup and are refreshed on the same schedule
+ */
+typedef struct {
+    wchar_t     name[MAX_ACCOUNT_NAME];
+    const wchar_t *credentials_path;  /* Into g_app.config */
+    Credentials creds;
+    UsageData   usage;
+    ApiRequest *fetch_req;   /* In-flight fetch, NULL when idle */
+    WPARAM      fetch_id;    /* (sequence << 2) | index into g_app.extra */
+} ExtraAccount;
+
 typedef struct {
     NOTIFYICONDATAW nid;
     HWND            hwnd;
     HINSTANCE       hInstance;
     AppConfig       config;
     UsageData       usage;
-    char            access_token[MAX_TOKEN_LEN];
-    BOOL            last_fetch_failed;
+    Credentials     creds;
+    TrayShown       shown;       /* Last published icon, tooltip and balloon */
+    ApiRequest     *fetch_req;   /* In-flight usage fetch, NULL when idle */
+    WPARAM          fetch_id;    /* Id of the most recently started fetch */
+    FileWatch       cred_watch;  /* Watches .credentials.json; inactive if unsupported */
+    NetWatch        net_watch;   /* Interface/address changes; inactive if unsupported */
+    BOOL            offline;     /* No route out seen: poll rarely (a hint only) */
+    Scheduler       sched;       /* Picks the delay before the next poll */
+    RetryPolicy     retry;       /* Backoff for transient fetch failures */
+    LONGLONG        last_fetch_time; /* Unix time the last fetch completed */
+    BOOL            poll_deferred;   /* A poll came due while the display was off */
+    Broker          broker;      /* Cross-session shared cache (broker_mode) */
+    HistoryRing     history;     /* Persisted samples; closed if unavailable */
+    Forecast        forecast;    /* Burn rate per window, for the time-to-limit */
+    ExtraAccount    extra[MAX_ACCOUNTS - 1];
+    int             extra_count;
+    WPARAM          extra_seq;   /* Fetch sequence shared by the extra accounts */
+    BOOL            idle;        /* idle_enter() done after the first result */
+    BOOL            http_ready;  /* http_init() done (second startup stage) */
+    BOOL            auth_retried; /* Re-read credentials after a 401 already */
+    BOOL            exporting;   /* export_init() succeeded */
 } AppState;
 
 static AppState g_app;
 
+/* Send only the given NIF_* fields of g_app.nid to the shell */
+static void publish_tray(UINT flags)
+{
+    UINT saved = g_app.nid.uFlags;
+    g_app.nid.uFlags = flags;
+    Shell_NotifyIconW(NIM_MODIFY, &g_app.nid);
+    g_app.nid.uFlags = saved;
+}
+
+/* Show the current percentage on the tray icon.
+ *
+ * Why only NIM_MODIFY on change:
+ * - trayicon_get() returns the same cached HICON for the same rounded
+ *   percentage, so comparing with the published handle tells us whether
+ *   anything changed
+ * - Explorer processes every Shell_NotifyIconW cross-process; most polls
+ *   don't move the number
+ *
+ * The static green/yellow/red resources remain the fallback for errors
+ * (no number to show) and if rendering fails.
+ */
 static void update_tray_icon(void)
 {
-    int icon_id;
     double max_util = g_app.usage.five_hour_util;
     if (g_app.usage.seven_day_util > max_util)
         max_util = g_app.usage.seven_day_util;
 
-    if (max_util >= 95.0)
-        icon_id = IDI_RED;
-    else if (max_util >= 80.0)
-        icon_id = IDI_YELLOW;
-    else
-        icon_id = IDI_GREEN;
+    HICON hIcon = NULL;
+    if (g_app.usage.valid && max_util >= 0)
+        hIcon = trayicon_get((int)(max_util + 0.5));
+
+    if (!hIcon) {
+        int icon_id;
+        if (max_util >= 95.0)
+            icon_id = IDI_RED;
+        else if (max_util >= 80.0)
+            icon_id = IDI_YELLOW;
+        else
+            icon_id = IDI_GREEN;
+        hIcon = LoadIconW(g_app.hInstance, MAKEINTRESOURCEW(icon_id));
+    }
+
+    if (!hIcon || hIcon == g_app.shown.icon)
+        return;
 
-    HICON hIcon = LoadIconW(g_app.hInstance, MAKEINTRESOURCEW(icon_id));
-    if (hIcon)
-        g_app.nid.hIcon = hIcon;
+    g_app.nid.hIcon = hIcon;
+    g_app.shown.icon = hIcon;
+    publish_tray(NIF_ICON);
 }
 
 static void update_tooltip(void)
 {
+    wchar_t tip[128];
+
     if (!g_app.usage.valid) {
         wchar_t *err = util_to_wide(g_app.usage.error);
-        _snwprintf(g_app.nid.szTip, 128, L"Claude: %s",
+        _snwprintf(tip, 128, L"Claude: %s",
                    err ? err : L"Error");
         free(err);
     } else {
@@ -74,74 +211,481 @@ static void update_tooltip(void)
         }
 
         if (remaining[0])
-            _snwprintf(g_app.nid.szTip, 128,
+            _snwprintf(tip, 128,
                 L"Claude: 5h %.0f%% | 7d %.0f%% | Resets %s",
                 g_app.usage.five_hour_util,
                 g_app.usage.seven_day_util,
                 remaining);
         else
-            _snwprintf(g_app.nid.szTip, 128,
+            _snwprintf(tip, 128,
                 L"Claude: 5h %.0f%% | 7d %.0f%%",
                 g_app.usage.five_hour_util,
                 g_app.usage.seven_day_util);
+
+        /* On course to hit the 5-hour cap before it resets */
+        if (g_app.usage.five_hour_limit_sec > 0) {
+            wchar_t eta[32];
+            size_t n = wcslen(tip);
+            util_format_duration(g_app.usage.five_hour_limit_sec, eta, 32);
+            _snwprintf(tip + n, 128 - n, L" | 100%% in %s", eta);
+        }
     }
+    tip[127] = L'\0';
 
-    Shell_NotifyIconW(NIM_MODIFY, &g_app.nid);
+    /* One more line per other account, as far as the tip has room */
+    for (int i = 0; i < g_app.extra_count; i++) {
+        const ExtraAccount *a = &g_app.extra[i];
+        size_t n = wcslen(tip);
+        if (n >= 126)
+            break;
+        if (a->usage.valid)
+            _snwprintf(tip + n, 128 - n, L"\n%s: 5h %.0f%% | 7d %.0f%%",
+                       a->name, a->usage.five_hour_util,
+                       a->usage.seven_day_util);
+        else
+            _snwprintf(tip + n, 128 - n, L"\n%s: %hs", a->name,
+                       a->usage.error[0] ? a->usage.error : "Loading...");
+        tip[127] = L'\0';
+    }
+
+    /* Same numbers and same "Resets" text as last poll: nothing to send */
+    if (wcscmp(tip, g_app.shown.tip) == 0)
+        return;
+
+    wcscpy(g_app.nid.szTip, tip);
+    wcscpy(g_app.shown.tip, tip);
+    publish_tray(NIF_TIP);
 }
 
+/* Raise the error balloon once per failure streak */
 static void show_error_balloon(const char *error)
 {
-    g_app.nid.uFlags |= NIF_INFO;
+    if (g_app.shown.error_balloon)
+        return;
+    g_app.shown.error_balloon = TRUE;
+
     wcscpy(g_app.nid.szInfoTitle, L"Claude Usage Error");
     wchar_t *err = util_to_wide(error);
     if (err) {
         wcsncpy(g_app.nid.szInfo, err, 256);
+        g_app.nid.szInfo[255] = L'\0';
         free(err);
     }
     g_app.nid.dwInfoFlags = NIIF_ERROR;
-    Shell_NotifyIconW(NIM_MODIFY, &g_app.nid);
-    g_app.nid.uFlags &= ~NIF_INFO;
+    publish_tray(NIF_INFO);
+}
+
+/* Warn once per window when the forecast says its limit is near */
+static void show_limit_balloon(const wchar_t *window, int limit_sec,
+                               const char *resets_iso, LONGLONG *warned)
+{
+    int warn_sec = g_app.config.forecast_warn_min * 60;
+    if (limit_sec <= 0 || warn_sec <= 0 || limit_sec > warn_sec)
+        return;
+
+    /* Keyed by the window's reset time; 1 stands for an unknown one */
+    LONGLONG resets = 0;
+    util_iso8601_to_unix(resets_iso, &resets);
+    LONGLONG key = resets ? resets : 1;
+    if (*warned == key)
+        return;
+    *warned = key;
+
+    wchar_t eta[32];
+    util_format_duration(limit_sec, eta, 32);
+    wcscpy(g_app.nid.szInfoTitle, L"Claude Usage Limit Ahead");
+    _snwprintf(g_app.nid.szInfo, 256,
+               L"At the current rate you hit 100%% of the %s in %s.",
+               window, eta);
+    g_app.nid.szInfo[255] = L'\0';
+    g_app.nid.dwInfoFlags = NIIF_WARNING;
+    publish_tray(NIF_INFO);
 }
 
 static void refresh_credentials(void)
 {
-    /* Re-read access token (may have been refreshed by Claude Code) */
-    config_read_access_token(g_app.config.credentials_path,
-                             g_app.access_token, MAX_TOKEN_LEN);
+    /* Re-read access token (may have been refreshed by Claude Code) and
+     * subscription type (user might have upgraded/downgraded). A no-op
+     * beyond one stat if the file hasn't changed. */
+    config_read_credentials(g_app.config.credentials_path, &g_app.creds);
+    memcpy(g_app.usage.subscription_type, g_app.creds.subscription_type,
+           sizeof(g_app.usage.subscription_type));
+
+    /* Why a timer at the expiry moment:
+     * - Without it the first sign of rotation is a 401 on the next poll,
+     *   after which the user sees "Token expired" until another poll
+     * - Claude Code writes the refreshed token at about that time; reading
+     *   it just after lets the next fetch use a valid token right away */
+    KillTimer(g_app.hwnd, IDT_EXPIRY_TIMER);
+    if (g_app.creds.expires_at_ms) {
+        LONGLONG left = (LONGLONG)g_app.creds.expires_at_ms -
+                        util_unix_now() * 1000 + EXPIRY_GRACE_MS;
+        if (left > 0)
+            SetTimer(g_app.hwnd, IDT_EXPIRY_TIMER,
+                     (UINT)(left < EXPIRY_MAX_MS ? left : EXPIRY_MAX_MS), NULL);
+    }
+}
+
+/* SetTimer() with a tolerance window.
+ *
+ * Why coalescable timers:
+ * - A plain timer wakes the CPU at exactly its due time; with a tolerance
+ *   Windows can fire it together with other wakeups, so the package
+ *   stays in deep idle states longer. A minute-scale poll doesn't care
+ *   about a few seconds
+ * - SetCoalescableTimer is Windows 8+; on Windows 7 this is SetTimer()
+ */
+static void set_timer(UINT_PTR id, UINT ms)
+{
+    typedef UINT_PTR (WINAPI *SetCoalescableTimerFunc)(HWND, UINT_PTR, UINT,
+                                                       TIMERPROC, ULONG);
+    static SetCoalescableTimerFunc set_coalescable;
+    static BOOL resolved;
+
+    if (!resolved) {
+        HMODULE user32 = GetModuleHandleW(L"user32.dll");
+        set_coalescable = user32 ? (SetCoalescableTimerFunc)
+                          GetProcAddress(user32, "SetCoalescableTimer") : NULL;
+        resolved = TRUE;
+    }
+
+    ULONG tolerance = ms / TIMER_TOLERANCE_DIVISOR;
+    if (tolerance > TIMER_TOLERANCE_MAX_MS)
+        tolerance = TIMER_TOLERANCE_MAX_MS;
+    if (!set_coalescable ||
+        !set_coalescable(g_app.hwnd, id, ms, NULL, tolerance))
+        SetTimer(g_app.hwnd, id, ms, NULL);
+}
+
+/* Arm the one-shot poll timer for the next fetch: after retry_ms if a
+ * retry is due, otherwise when the scheduler says */
+static void schedule_poll(DWORD retry_ms)
+{
+    LONGLONG now = util_unix_now();
+    /* Probably offline: fast retries can't succeed, the scheduler's
+     * max_poll_interval still gets a try in */
+    UINT ms = g_app.offline ? 0 : retry_ms;
+    if (ms == 0) {
+        int sec = sched_next_poll_sec(&g_app.sched, &g_app.config,
+                                      &g_app.usage, now);
+        /* Out of retries: still don't come back before the server asked
+         * (but retry_after_sec() caps what it may ask for) */
+        int server = retry_after_sec(&g_app.usage);
+        if (server > sec)
+            sec = server;
+        ms = (UINT)sec * 1000;
+    }
+    g_app.last_fetch_time = now;
+    set_timer(IDT_POLL_TIMER, ms);
+}
+
+/* Put g_app.usage on the tray icon, tooltip and popup */
+static void display_usage(void)
+{
+    update_tray_icon();
+    update_tooltip();
+    popup_update(&g_app.usage);
+}
+
+/* Show a fresh result and raise a balloon on the first failure, or when
+ * a limit is forecast to be near */
+static void show_usage(void)
+{
+    display_usage();
+    pipesrv_publish(&g_app.usage);
+
+    /* Startup (config, TLS, first parse) is the peak; once the tray shows
+     * a result nothing else runs until the next poll. Afterwards the
+     * popup re-enters idle mode each time it is dismissed. */
+    if (!g_app.idle && g_app.http_ready) {
+        g_app.idle = TRUE;
+        idle_enter();
+    }
+
+    if (!g_app.usage.valid) {
+        show_error_balloon(g_app.usage.error);
+        return;
+    }
+    g_app.shown.error_balloon = FALSE;
+    show_limit_balloon(L"5-hour limit", g_app.usage.five_hour_limit_sec,
+                       g_app.usage.five_hour_resets, &g_app.shown.limit_warned_5h);
+    show_limit_balloon(L"7-day limit", g_app.usage.seven_day_limit_sec,
+                       g_app.usage.seven_day_resets, &g_app.shown.limit_warned_7d);
+}
+
+static void record_history(void)
+{
+    if (g_app.usage.valid)
+        history_append(&g_app.history, &g_app.usage, HISTORY_MAIN_ACCOUNT,
+                       util_unix_now());
+}
+
+/* A fetch finished: record it, show it, share it with broker readers,
+ * and schedule the next one. Recording first lets an open popup's
+ * sparklines pick up the new sample in the same repaint. */
+static void apply_usage(DWORD retry_ms)
+{
+    schedule_poll(retry_ms);
+    forecast_update(&g_app.forecast, &g_app.usage, util_unix_now());
+    record_history();
+    show_usage();
+    broker_publish(&g_app.broker, &g_app.usage);
+}
+
+/* Show the last recorded numbers for this account until the first fetch
+ * lands, instead of "Loading...".
+ *
+ * Why display_usage() and not show_usage():
+ * - The sample may be hours old; a "limit near" balloon (or a pipe
+ *   answer) based on it would present stale numbers as current. The
+ *   first fetch runs the full path
+ */
+static void restore_last_known(void)
+{
+    UsageData last;
+    LONGLONG when;
+    if (!history_latest(&g_app.history, HISTORY_MAIN_ACCOUNT, &last, &when))
+        return;
+
+    memcpy(last.subscription_type, g_app.creds.subscription_type,
+           sizeof(last.subscription_type));
+    forecast_estimate(&g_app.forecast, &last, util_unix_now());
+    last.fetched_at = when;  /* The popup footer shows how old it is */
+    g_app.usage = last;
+    display_usage();
+}
+
+/* Hand the other accounts' latest results to the tooltip and popup */
+static void publish_accounts(void)
+{
+    PopupAccount list[MAX_ACCOUNTS - 1];
+    for (int i = 0; i < g_app.extra_count; i++) {
+        memcpy(list[i].name, g_app.extra[i].name, sizeof(list[i].name));
+        list[i].usage = g_app.extra[i].usage;
+    }
+    popup_set_accounts(g_app.config.account_name[0], list, g_app.extra_count);
+    update_tooltip();
+}
+
+static void load_extra_accounts(void)
+{
+    g_app.extra_count = 0;
+    for (int i = 0; i < MAX_ACCOUNTS - 1; i++) {
+        if (!g_app.config.extra_credentials_path[i][0])
+            continue;
+        ExtraAccount *a = &g_app.extra[g_app.extra_count++];
+        memset(a, 0, sizeof(*a));
+        a->credentials_path = g_app.config.extra_credentials_path[i];
+        if (g_app.config.account_name[i + 1][0])
+            wcscpy(a->name, g_app.config.account_name[i + 1]);
+        else
+            _snwprintf(a->name, MAX_ACCOUNT_NAME, L"Account %d", i + 2);
+    }
+    if (g_app.extra_count > 0)
+        publish_accounts();
+}
+
+/* Start a fetch for every other account that isn't already fetching.
+ *
+ * Why start them together with the main fetch:
+ * - Every request is asynchronous on the one WinHTTP session, so N
+ *   accounts take about one round trip rather than N; the connection
+ *   cache and keep-alive pool are shared, and api.c keeps conditional
+ *   request validators per token
+ */
+static void fetch_extra_accounts(void)
+{
+    for (int i = 0; i < g_app.extra_count; i++) {
+        ExtraAccount *a = &g_app.extra[i];
+        if (a->fetch_req)
+            continue;
+
+        config_read_credentials(a->credentials_path, &a->creds);
+        if (a->creds.access_token[0] == '\0') {
+            memset(&a->usage, 0, sizeof(a->usage));
+            snprintf(a->usage.error, sizeof(a->usage.error),
+                     "No access token found");
+            continue;
+        }
+
+        a->fetch_id = (++g_app.extra_seq << 2) | (WPARAM)i;
+        a->fetch_req = api_fetch_usage_async(a->creds.access_token,
+                                             g_app.hwnd, WM_ACCOUNT_READY,
+                                             a->fetch_id);
+    }
+}
+
+static void on_account_ready(WPARAM id, UsageData *data)
+{
+    int i = (int)(id & 3);
+    ExtraAccount *a = &g_app.extra[i];
+    if (i >= g_app.extra_count || id != a->fetch_id || !a->fetch_req) {
+        free(data);
+        return;
+    }
+
+    api_request_release(a->fetch_req);
+    a->fetch_req = NULL;
 
-    /* Also read subscription type (user might have upgraded/downgraded) */
-    config_read_subscription_type(g_app.config.credentials_path,
-                                  g_app.usage.subscription_type,
-                                  sizeof(g_app.usage.subscription_type));
+    if (data) {
+        /* Transient failure: keep the last good numbers until the next poll */
+        if (data->valid || !data->retryable || !a->usage.valid)
+            a->usage = *data;
+        free(data);
+    }
+    publish_accounts();
+}
+
+static void cancel_extra_fetches(void)
+{
+    for (int i = 0; i < g_app.extra_count; i++) {
+        if (g_app.extra[i].fetch_req) {
+            api_request_cancel(g_app.extra[i].fetch_req);
+            g_app.extra[i].fetch_req = NULL;
+        }
+    }
 }
 
 static void fetch_usage_data(void)
 {
-    if (g_app.access_token[0] == '\0') {
+    /* Too early: start_deferred() fetches as soon as HTTP is up */
+    if (!g_app.http_ready)
+        return;
+
+    fetch_extra_accounts();
+
+    /* Another session's instance polls this account for us */
+    if (g_app.broker.role == BROKER_READER)
+        return;
+
+    if (g_app.creds.access_token[0] == '\0') {
         memset(&g_app.usage, 0, sizeof(g_app.usage));
         snprintf(g_app.usage.error, sizeof(g_app.usage.error),
                  "No access token found");
         update_tooltip();
-        if (!g_app.last_fetch_failed) {
-            show_error_balloon(g_app.usage.error);
-            g_app.last_fetch_failed = TRUE;
-        }
+        popup_update(&g_app.usage);
+        pipesrv_publish(&g_app.usage);
+        show_error_balloon(g_app.usage.error);
+        schedule_poll(0);
         return;
     }
 
-    api_fetch_usage(g_app.access_token, &g_app.usage);
+    /* A poll tick while the previous fetch is still running: let it finish */
+    if (g_app.fetch_req)
+        return;
 
-    update_tray_icon();
-    update_tooltip();
+    g_app.fetch_req = api_fetch_usage_async(g_app.creds.access_token,
+                                            g_app.hwnd, WM_USAGE_READY,
+                                            ++g_app.fetch_id);
+    if (!g_app.fetch_req) {
+        g_app.usage.valid = FALSE;
+        snprintf(g_app.usage.error, sizeof(g_app.usage.error),
+                 "Could not start request");
+        apply_usage(0);
+    }
+}
 
-    if (!g_app.usage.valid) {
-        if (!g_app.last_fetch_failed) {
-            show_error_balloon(g_app.usage.error);
-            g_app.last_fetch_failed = TRUE;
+/* Abandon the in-flight fetch, e.g. when "Refresh Now" supersedes it */
+static void cancel_fetch(void)
+{
+    if (g_app.fetch_req) {
+        api_request_cancel(g_app.fetch_req);
+        g_app.fetch_req = NULL;
+    }
+}
+
+static void on_usage_ready(WPARAM id, UsageData *data)
+{
+    /* Result of a cancelled fetch that was already queued */
+    if (id != g_app.fetch_id || !g_app.fetch_req) {
+        free(data);
+        return;
+    }
+
+    api_request_release(g_app.fetch_req);
+    g_app.fetch_req = NULL;
+
+    /* Rejected token: if the file now holds another one, retry once with it
+     * instead of showing the error for a whole poll interval */
+    if (data && data->auth_failed && !g_app.auth_retried) {
+        char old_token[MAX_TOKEN_LEN];
+        memcpy(old_token, g_app.creds.access_token, sizeof(old_token));
+        g_app.auth_retried = TRUE;
+        refresh_credentials();
+        if (strcmp(old_token, g_app.creds.access_token) != 0) {
+            free(data);
+            fetch_usage_data();
+            return;
+        }
+    }
+    if (data && data->valid)
+        g_app.auth_retried = FALSE;
+
+    DWORD retry_ms = 0;
+    if (data) {
+        /* Subscription type comes from the credentials file, not the API */
+        memcpy(data->subscription_type, g_app.usage.subscription_type,
+               sizeof(data->subscription_type));
+        if (data->valid) {
+            retry_reset(&g_app.retry);
+        } else {
+            retry_ms = retry_next_delay_ms(&g_app.retry, data);
+            if (retry_ms && g_app.usage.valid) {
+                /* Transient failure: keep the last good numbers on screen
+                 * and retry quietly; only report once retries run out */
+                free(data);
+                schedule_poll(retry_ms);
+                return;
+            }
         }
+        g_app.usage = *data;
+        free(data);
     } else {
-        g_app.last_fetch_failed = FALSE;
+        g_app.usage.valid = FALSE;
+        snprintf(g_app.usage.error, sizeof(g_app.usage.error),
+                 "Out of memory");
     }
+    apply_usage(retry_ms);
+}
+
+/* Broker reader: show whatever the owner published last */
+static void on_broker_update(void)
+{
+    UsageData data;
+    if (!broker_read(&g_app.broker, &data))
+        return;
+
+    memcpy(data.subscription_type, g_app.usage.subscription_type,
+           sizeof(data.subscription_type));
+    g_app.usage = data;
+    forecast_update(&g_app.forecast, &g_app.usage, util_unix_now());
+    record_history();
+    show_usage();
+    fetch_extra_accounts();  /* Not shared by the broker */
+}
+
+/* Join the broker for the current token when broker_mode is on.
+ * Returns TRUE if this instance should poll the API itself. */
+static BOOL start_broker(void)
+{
+    if (!g_app.config.broker_mode || g_app.creds.access_token[0] == '\0')
+        return TRUE;
+    if (!broker_open(&g_app.broker, util_hash_string(g_app.creds.access_token)))
+        return TRUE;  /* Shared objects unavailable: poll standalone */
+    if (g_app.broker.role == BROKER_OWNER)
+        return TRUE;
+
+    on_broker_update();
+    return FALSE;
+}
+
+/* The owning instance exited and our wait handed us its mutex */
+static void on_broker_owner_lost(void)
+{
+    broker_promote(&g_app.broker);
+    sched_init(&g_app.sched);
+    g_app.sched.offline = g_app.offline;
+    fetch_usage_data();
 }
 
 static void do_fetch(void)
@@ -151,12 +695,258 @@ static void do_fetch(void)
     fetch_usage_data();
 }
 
+/* Credentials changed on disk: pick up the new token, and if the last
+ * fetch failed (typically 401 after a rotation), retry right away */
+static void on_credentials_changed(void)
+{
+    char old_token[MAX_TOKEN_LEN];
+    memcpy(old_token, g_app.creds.access_token, sizeof(old_token));
+
+    refresh_credentials();
+
+    if (strcmp(old_token, g_app.creds.access_token) == 0)
+        return;
+    g_app.auth_retried = FALSE;  /* A new token earns a new 401 retry */
+    /* History and the forecast stay: they follow the configured account,
+     * not its token, so a refresh doesn't start them over */
+
+    if (!g_app.http_ready)
+        return;  /* start_deferred() joins the broker with the new token */
+
+    if (g_app.config.broker_mode) {
+        /* Possibly a different account: rejoin under the new token */
+        KillTimer(g_app.hwnd, IDT_POLL_TIMER);
+        cancel_fetch();
+        broker_close(&g_app.broker);
+        if (start_broker())
+            fetch_usage_data();
+        return;
+    }
+
+    if (!g_app.usage.valid)
+        fetch_usage_data();
+}
+
+static void start_credentials_watch(void)
+{
+    if (watch_start(&g_app.cred_watch, g_app.config.credentials_path))
+        return;
+
+    /* Not watchable (e.g. some network shares): poll instead */
+    set_timer(IDT_SUBSCRIPTION_TIMER,
+              (UINT)(g_app.config.subscription_poll_interval_sec * 1000));
+}
+
+/* Someone may be looking again (unlock, display on, resume): fetch once
+ * now if a poll was skipped or the data is older than the base interval.
+ * Whatever the old timer had queued is dropped, so this is one fetch,
+ * not a burst. Returns FALSE if the data was fresh enough or there's no
+ * network yet. */
+static BOOL catch_up(void)
+{
+    if (g_app.offline) {
+        /* on_network_changed() catches up; until then poll rarely */
+        if (g_app.poll_deferred) {
+            g_app.poll_deferred = FALSE;
+            set_timer(IDT_POLL_TIMER,
+                      (UINT)g_app.config.max_poll_interval_sec * 1000);
+        }
+        return FALSE;
+    }
+    if (!g_app.poll_deferred &&
+        util_unix_now() - g_app.last_fetch_time < g_app.config.api_poll_interval_sec)
+        return FALSE;
+    g_app.poll_deferred = FALSE;
+    KillTimer(g_app.hwnd, IDT_POLL_TIMER);
+    fetch_usage_data();
+    return TRUE;
+}
+
+/* Power setting notifications (sent once with the current value on
+ * registration, then on every change).
+ *
+ * Why watch the display rather than only sleep/resume:
+ * - With the display off (and in Modern Standby, which starts with it)
+ *   a fetch updates a tray icon nobody can see, so polls due then are
+ *   skipped and made up with one catch-up fetch when it comes back on
+ * - On battery, and more so with battery saver, stretching the interval
+ *   costs a little freshness and saves radio and CPU wakeups
+ */
+static void on_power_setting(const POWERBROADCAST_SETTING *ps)
+{
+    if (ps->DataLength < sizeof(DWORD))
+        return;
+    DWORD value = *(const DWORD *)ps->Data;
+
+    if (IsEqualGUID(&ps->PowerSetting, &GUID_CONSOLE_DISPLAY) ||
+        IsEqualGUID(&ps->PowerSetting, &GUID_MONITOR_POWER)) {
+        BOOL off = (value == 0);  /* 2 is dimmed: still visible */
+        BOOL was_off = g_app.sched.display_off;
+        g_app.sched.display_off = off;
+        if (was_off && !off)
+            catch_up();
+    } else if (IsEqualGUID(&ps->PowerSetting, &GUID_POWER_SOURCE)) {
+        g_app.sched.on_battery = (value != 0);  /* 1 DC, 2 short-term (UPS) */
+    } else if (IsEqualGUID(&ps->PowerSetting, &GUID_BATTERY_SAVER)) {
+        g_app.sched.battery_saver = (value != 0);
+    }
+}
+
+static void register_power_notifications(void)
+{
+    if (!RegisterPowerSettingNotification(g_app.hwnd, &GUID_CONSOLE_DISPLAY,
+                                          DEVICE_NOTIFY_WINDOW_HANDLE))
+        RegisterPowerSettingNotification(g_app.hwnd, &GUID_MONITOR_POWER,
+                                         DEVICE_NOTIFY_WINDOW_HANDLE);
+    RegisterPowerSettingNotification(g_app.hwnd, &GUID_POWER_SOURCE,
+                                     DEVICE_NOTIFY_WINDOW_HANDLE);
+    /* Windows 10+; fails harmlessly on older versions */
+    RegisterPowerSettingNotification(g_app.hwnd, &GUID_BATTERY_SAVER,
+                                     DEVICE_NOTIFY_WINDOW_HANDLE);
+}
+
+static void on_watch_signaled(void)
+{
+    BOOL changed;
+    BOOL alive = watch_check(&g_app.cred_watch, &changed);
+
+    if (changed)
+        SetTimer(g_app.hwnd, IDT_CREDENTIALS_DEBOUNCE,
+                 CREDENTIALS_DEBOUNCE_MS, NULL);
+    if (!alive)
+        start_credentials_watch();
+}
+
+/* Whether the adapters suggest we can't reach the API.
+ *
+ * Why only a hint that stretches the interval:
+ * - Without a network each fetch still spends a DNS lookup and the
+ *   connect timeout before failing, and its retries run the same course;
+ *   while offline we skip the retries and poll at max_poll_interval
+ * - The adapter check can be wrong: a host may reach the internet only
+ *   through an explicit proxy and have no default route at all. Polls
+ *   therefore never stop, and with a proxy or PAC URL configured the
+ *   check isn't used
+ * - The moment connectivity returns (an adapter up with a gateway) we
+ *   fetch once instead of waiting out the interval; the fetch creates
+ *   the new connection itself, which is what a warmup would have done
+ */
+static BOOL looks_offline(void)
+{
+    if (!netwatch_handle(&g_app.net_watch))
+        return FALSE;  /* No notifications: we'd never notice coming back */
+    if (g_app.config.proxy[0] || g_app.config.proxy_pac_url[0])
+        return FALSE;
+    return !netwatch_online();
+}
+
+static void set_offline(BOOL offline)
+{
+    g_app.offline = offline;
+    g_app.sched.offline = offline;  /* Takes effect at the next schedule */
+}
+
+/* Network settled after a change (see IDT_NETWORK_DEBOUNCE) */
+static void on_network_changed(void)
+{
+    http_proxy_invalidate();  /* A different network may need a different proxy */
+    if (looks_offline()) {
+        set_offline(TRUE);
+        return;
+    }
+    if (g_app.offline) {
+        set_offline(FALSE);
+        g_app.poll_deferred = TRUE;
+        catch_up();
+        if (g_app.exporting)
+            export_flush();  /* Whatever piled up while we were away */
+    }
+}
+
+/* Second startup stage: everything that needs the network.
+ *
+ * Why not in wWinMain:
+ * - At login the tray icon is what the user sees; with the last known
+ *   value restored from history it is useful at once, while WinHTTP
+ *   session setup (proxy detection) and the first round trip would
+ *   otherwise hold it back and compete with every other login item
+ * - A random delay spreads the first fetches of many sessions on one
+ *   terminal server instead of starting them in the same second
+ * - The work runs in background mode (lower CPU, I/O and memory
+ *   priority); only the request is started here, the rest is async
+ */
+static void start_deferred(void)
+{
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+    if (!http_init()) {
+        SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+        MessageBoxW(NULL, L"Failed to initialize HTTP.",
+                    L"Claude Usage", MB_OK | MB_ICONERROR);
+        PostQuitMessage(1);
+        return;
+    }
+    http_set_proxy(g_app.config.proxy, g_app.config.proxy_bypass,
+                   g_app.config.proxy_pac_url);
+    g_app.http_ready = TRUE;
+
+    netwatch_start(&g_app.net_watch);
+    set_offline(looks_offline());
+
+    /* Samples wait in the history ring; send them in batches, starting
+     * with anything left over from the last run */
+    g_app.exporting = export_init(g_app.config.export_url,
+                                  g_app.config.export_auth, &g_app.history,
+                                  g_app.hwnd, WM_EXPORT_DONE);
+    if (g_app.exporting) {
+        set_timer(IDT_EXPORT_TIMER,
+                  (UINT)g_app.config.export_interval_min * 60 * 1000);
+        if (!g_app.offline)
+            export_flush();
+    }
+
+    /* First fetch (both credentials and usage); each completed fetch arms
+     * the poll timer for the next one */
+    if (start_broker()) {
+        if (g_app.offline) {
+            /* Probably nothing to reach; try again later rather than never */
+            refresh_credentials();
+            set_timer(IDT_POLL_TIMER,
+                      (UINT)g_app.config.max_poll_interval_sec * 1000);
+        } else {
+            do_fetch();
+        }
+    }
+
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+}
+
+/* IDT_EXPIRY_TIMER: the token has just expired. Pick up the refreshed
+ * one and fetch with it; if it hasn't been rewritten yet, the file watch
+ * (or a 401 on the next poll) catches the change. */
+static void on_token_expiry(void)
+{
+    char old_token[MAX_TOKEN_LEN];
+    memcpy(old_token, g_app.creds.access_token, sizeof(old_token));
+
+    on_credentials_changed();
+    if (strcmp(old_token, g_app.creds.access_token) != 0 && g_app.usage.valid) {
+        /* on_credentials_changed() only refetches after a failure */
+        KillTimer(g_app.hwnd, IDT_POLL_TIMER);
+        fetch_usage_data();
+    }
+}
+
+/* Hold Shift while right-clicking to get a "Diagnostics" item: support
+ * can ask for it without cluttering the everyday menu */
 static void show_context_menu(HWND hwnd)
 {
     HMENU hMenu = CreatePopupMenu();
     AppendMenuW(hMenu, MF_STRING, IDM_REFRESH, L"Refresh Now");
     AppendMenuW(hMenu, MF_SEPARATOR, 0, NULL);
     AppendMenuW(hMenu, MF_STRING, IDM_OPENCONFIG, L"Open Config");
+    if (GetKeyState(VK_SHIFT) < 0)
+        AppendMenuW(hMenu, MF_STRING, IDM_DIAGNOSTICS, L"Diagnostics");
     AppendMenuW(hMenu, MF_SEPARATOR, 0, NULL);
     AppendMenuW(hMenu, MF_STRING, IDM_EXIT, L"Exit");
 
@@ -189,24 +979,94 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT msg,
         }
         return 0;
 
+    case WM_USAGE_READY:
+        on_usage_ready(wParam, (UsageData *)lParam);
+        return 0;
+
+    case WM_ACCOUNT_READY:
+        on_account_ready(wParam, (UsageData *)lParam);
+        return 0;
+
+    case WM_EXPORT_DONE:
+        export_on_done(wParam);
+        return 0;
+
     case WM_TIMER:
         if (wParam == IDT_POLL_TIMER) {
-            fetch_usage_data();
+            /* One-shot: the completed fetch schedules the next one */
+            KillTimer(hwnd, IDT_POLL_TIMER);
+            if (g_app.sched.display_off)
+                g_app.poll_deferred = TRUE;  /* catch_up() once that's over */
+            else
+                fetch_usage_data();
         } else if (wParam == IDT_SUBSCRIPTION_TIMER) {
             refresh_credentials();
+        } else if (wParam == IDT_CREDENTIALS_DEBOUNCE) {
+            KillTimer(hwnd, IDT_CREDENTIALS_DEBOUNCE);
+            on_credentials_changed();
+        } else if (wParam == IDT_NETWORK_DEBOUNCE) {
+            KillTimer(hwnd, IDT_NETWORK_DEBOUNCE);
+            on_network_changed();
+        } else if (wParam == IDT_EXPIRY_TIMER) {
+            KillTimer(hwnd, IDT_EXPIRY_TIMER);
+            on_token_expiry();
+        } else if (wParam == IDT_STARTUP_TIMER) {
+            KillTimer(hwnd, IDT_STARTUP_TIMER);
+            start_deferred();
+        } else if (wParam == IDT_EXPORT_TIMER) {
+            export_flush();  /* Even when "offline": that's only a hint */
+        }
+        return 0;
+
+    case WM_POWERBROADCAST:
+        if (wParam == PBT_APMRESUMEAUTOMATIC) {
+            /* Back from sleep: the old sockets are gone. A catch-up fetch
+             * reconnects by itself; otherwise redo DNS + TLS now rather
+             * than on the user-visible first refresh */
+            if (!catch_up())
+                api_warmup();
+        } else if (wParam == PBT_POWERSETTINGCHANGE) {
+            on_power_setting((const POWERBROADCAST_SETTING *)lParam);
+        }
+        return TRUE;
+
+    case WM_WTSSESSION_CHANGE:
+        if (wParam == WTS_SESSION_LOCK) {
+            /* Takes effect when the next fetch completes */
+            g_app.sched.locked = TRUE;
+        } else if (wParam == WTS_SESSION_UNLOCK) {
+            g_app.sched.locked = FALSE;
+            /* The last poll may have been scheduled for the locked rate;
+             * if it's older than the base interval, refresh now */
+            catch_up();
         }
         return 0;
 
     case WM_COMMAND:
         switch (LOWORD(wParam)) {
         case IDM_REFRESH:
+            /* Every account starts over, not just the main one; a queued
+             * completion of a cancelled fetch no longer matches its id */
+            cancel_extra_fetches();
+            if (g_app.broker.role == BROKER_READER) {
+                /* The owner polls the main account; just re-read what it
+                 * published. The other accounts are ours to fetch */
+                on_broker_update();
+                if (g_app.http_ready)
+                    fetch_extra_accounts();
+                break;
+            }
             KillTimer(hwnd, IDT_POLL_TIMER);
-            KillTimer(hwnd, IDT_SUBSCRIPTION_TIMER);
-            do_fetch();
-            SetTimer(hwnd, IDT_POLL_TIMER,
-                     (UINT)(g_app.config.api_poll_interval_sec * 1000), NULL);
-            SetTimer(hwnd, IDT_SUBSCRIPTION_TIMER,
-                     (UINT)(g_app.config.subscription_poll_interval_sec * 1000), NULL);
+            cancel_fetch();
+            if (g_app.cred_watch.dir) {
+                /* The watch already keeps the token current */
+                fetch_usage_data();
+            } else {
+                KillTimer(hwnd, IDT_SUBSCRIPTION_TIMER);
+                do_fetch();
+                set_timer(IDT_SUBSCRIPTION_TIMER,
+                          (UINT)(g_app.config.subscription_poll_interval_sec * 1000));
+            }
             break;
         case IDM_OPENCONFIG: {
             wchar_t config_path[MAX_PATH_LEN];
@@ -217,6 +1077,13 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT msg,
                           config_path, NULL, SW_SHOW);
             break;
         }
+        case IDM_DIAGNOSTICS: {
+            wchar_t report[2048];
+            diag_format_report(report, 2048);
+            MessageBoxW(NULL, report, L"Claude Usage Diagnostics",
+                        MB_OK | MB_ICONINFORMATION | MB_SETFOREGROUND);
+            break;
+        }
         case IDM_EXIT:
             PostQuitMessage(0);
             break;
@@ -232,6 +1099,66 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT msg,
     }
 }
 
+/* Message loop that also wakes for the credentials watch and, as a
+ * broker reader, for published updates and the owner going away.
+ *
+ * Why MsgWaitForMultipleObjects instead of GetMessage:
+ * - GetMessage can only wait on the message queue; the directory watch
+ *   and the broker signal kernel objects, which would otherwise need
+ *   their own threads
+ * - Draining all queued messages per wake keeps input latency unchanged
+ */
+#define NO_HANDLE ((DWORD)-1)
+
+static void run_message_loop(void)
+{
+    for (;;) {
+        HANDLE handles[4];
+        DWORD count = 0;
+        DWORD watch_at = NO_HANDLE, update_at = NO_HANDLE, owner_at = NO_HANDLE;
+        DWORD net_at = NO_HANDLE;
+
+        if (g_app.cred_watch.dir) {
+            watch_at = count;
+            handles[count++] = watch_handle(&g_app.cred_watch);
+        }
+        if (g_app.net_watch.event) {
+            net_at = count;
+            handles[count++] = netwatch_handle(&g_app.net_watch);
+        }
+        if (g_app.broker.role == BROKER_READER) {
+            /* Catch up on a generation published while we were busy, so
+             * waiting on the next one's event can't miss it */
+            on_broker_update();
+            update_at = count;
+            handles[count++] = broker_update_event(&g_app.broker);
+            owner_at = count;
+            handles[count++] = broker_owner_mutex(&g_app.broker);
+        }
+
+        DWORD r = MsgWaitForMultipleObjects(count, handles, FALSE,
+                                            INFINITE, QS_ALLINPUT);
+        if (watch_at != NO_HANDLE && r == WAIT_OBJECT_0 + watch_at)
+            on_watch_signaled();
+        else if (net_at != NO_HANDLE && r == WAIT_OBJECT_0 + net_at)
+            /* One change arrives as a burst of notifications */
+            SetTimer(g_app.hwnd, IDT_NETWORK_DEBOUNCE, NETWORK_DEBOUNCE_MS, NULL);
+        else if (update_at != NO_HANDLE && r == WAIT_OBJECT_0 + update_at)
+            on_broker_update();
+        else if (owner_at != NO_HANDLE &&
+                 (r == WAIT_OBJECT_0 + owner_at || r == WAIT_ABANDONED_0 + owner_at))
+            on_broker_owner_lost();
+
+        MSG msg;
+        while (PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT)
+                return;
+            TranslateMessage(&msg);
+            DispatchMessageW(&msg);
+        }
+    }
+}
+
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
                     LPWSTR lpCmdLine, int nCmdShow)
 {
@@ -241,13 +1168,18 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
     g_app.hInstance = hInstance;
 
+    /* Before any cJSON use */
+    arena_json_install();
+
+    /* Stage timings for the Diagnostics view and ETW (diag.c) */
+    diag_init();
+
     /* Load configuration */
     if (!config_load(&g_app.config))
         return 1;
 
     /* Read initial access token */
-    if (!config_read_access_token(g_app.config.credentials_path,
-                                   g_app.access_token, MAX_TOKEN_LEN)) {
+    if (!config_read_credentials(g_app.config.credentials_path, &g_app.creds)) {
         wchar_t msg[2048];
         _snwprintf(msg, 2048,
             L"Could not read access token from credentials file.\n\n"
@@ -258,13 +1190,6 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
         return 1;
     }
 
-    /* Initialize HTTP */
-    if (!http_init()) {
-        MessageBoxW(NULL, L"Failed to initialize HTTP.",
-                    L"Claude Usage", MB_OK | MB_ICONERROR);
-        return 1;
-    }
-
     /* Register window classes */
     WNDCLASSEXW wc;
     memset(&wc, 0, sizeof(wc));
@@ -274,8 +1199,6 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     wc.lpszClassName = L"ClaudeUsageTray";
     RegisterClassExW(&wc);
 
-    popup_register(hInstance);
-
     /* Register for taskbar re-creation notification */
     WM_TASKBAR_CREATED = RegisterWindowMessageW(L"TaskbarCreated");
 
@@ -283,10 +1206,21 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     g_app.hwnd = CreateWindowExW(0, L"ClaudeUsageTray", L"ClaudeUsage",
                                   0, 0, 0, 0, 0,
                                   HWND_MESSAGE, NULL, hInstance, NULL);
-    if (!g_app.hwnd) {
-        http_shutdown();
+    if (!g_app.hwnd)
         return 1;
-    }
+
+    /* Message-only windows don't receive broadcasts, so WM_POWERBROADCAST
+     * must be requested explicitly (Windows 8+; resolved at runtime since
+     * the minimum target is Windows 7) */
+    typedef HPOWERNOTIFY (WINAPI *RegisterSuspendResumeNotificationFunc)(HANDLE, DWORD);
+    HMODULE hUser32 = GetModuleHandleW(L"user32.dll");
+    RegisterSuspendResumeNotificationFunc pRegisterSuspendResumeNotification =
+        hUser32 ? (RegisterSuspendResumeNotificationFunc)
+                  GetProcAddress(hUser32, "RegisterSuspendResumeNotification")
+                : NULL;
+    if (pRegisterSuspendResumeNotification)
+        pRegisterSuspendResumeNotification(g_app.hwnd, DEVICE_NOTIFY_WINDOW_HANDLE);
+    register_power_notifications();
 
     /* Set up tray icon */
     memset(&g_app.nid, 0, sizeof(g_app.nid));
@@ -299,27 +1233,53 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     wcscpy(g_app.nid.szTip, L"Claude Usage: Loading...");
 
     Shell_NotifyIconW(NIM_ADD, &g_app.nid);
+    g_app.shown.icon = g_app.nid.hIcon;
+    wcscpy(g_app.shown.tip, g_app.nid.szTip);
+
+    /* Lock/unlock notifications for the scheduler */
+    WTSRegisterSessionNotification(g_app.hwnd, NOTIFY_FOR_THIS_SESSION);
 
-    /* Set up timers with configurable intervals */
-    SetTimer(g_app.hwnd, IDT_POLL_TIMER,
-             (UINT)(g_app.config.api_poll_interval_sec * 1000), NULL);
-    SetTimer(g_app.hwnd, IDT_SUBSCRIPTION_TIMER,
-             (UINT)(g_app.config.subscription_poll_interval_sec * 1000), NULL);
+    start_credentials_watch();
 
-    /* Immediate first fetch (both credentials and usage) */
-    do_fetch();
+    /* Local query pipe for prompts and scripts */
+    if (g_app.config.pipe_server)
+        pipesrv_start();
 
-    /* Message loop */
-    MSG msg;
-    while (GetMessageW(&msg, NULL, 0, 0)) {
-        TranslateMessage(&msg);
-        DispatchMessageW(&msg);
+    wchar_t history_path[MAX_PATH_LEN];
+    history_default_path(history_path, MAX_PATH_LEN);
+    forecast_init(&g_app.forecast);
+    if (history_open(&g_app.history, history_path)) {
+        popup_set_history(&g_app.history, HISTORY_MAIN_ACCOUNT);
+        forecast_prime(&g_app.forecast, &g_app.history, HISTORY_MAIN_ACCOUNT,
+                       util_unix_now());
+        restore_last_known();
     }
+    load_extra_accounts();
+
+    /* HTTP and the first fetch follow shortly, from the message loop */
+    sched_init(&g_app.sched);
+    retry_init(&g_app.retry);
+    DWORD jitter = (GetCurrentProcessId() * 2654435761u ^ GetTickCount()) %
+                   STARTUP_JITTER_MS;
+    SetTimer(g_app.hwnd, IDT_STARTUP_TIMER, STARTUP_DELAY_MS + jitter, NULL);
+
+    run_message_loop();
 
     /* Cleanup */
+    WTSUnregisterSessionNotification(g_app.hwnd);
+    watch_stop(&g_app.cred_watch);
+    netwatch_stop(&g_app.net_watch);
+    broker_close(&g_app.broker);
+    pipesrv_stop();
     Shell_NotifyIconW(NIM_DELETE, &g_app.nid);
-    popup_hide();
+    popup_shutdown();
+    export_shutdown();  /* Before the ring it reads from goes away */
+    history_close(&g_app.history);
+    trayicon_shutdown();
+    cancel_fetch();
+    cancel_extra_fetches();
     http_shutdown();
+    diag_shutdown();
 
     return 0;
 }
@@ -0,0 +1,112 @@
+/* winsock2.h must come before windows.h (pulled in by netwatch.h) */
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#include <iphlpapi.h>
+#include <netioapi.h>
+#include "netwatch.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* GetAdaptersAddresses() wants a guess; a few adapters fit in this */
+#define NETWATCH_ADDR_BUF 16384
+
+/* Why NotifyIpInterfaceChange instead of Network List Manager events:
+ * - NLM's INetworkListManagerEvents is a COM connection point, which from
+ *   C means hand-written vtables and an apartment on the UI thread for
+ *   the same "something changed" signal
+ * - The IP Helper notifications arrive on a system thread pool; all we
+ *   do there is set an event, which the main loop already knows how to
+ *   wait on (same shape as watch.c)
+ * - Whether we're actually online is decided afterwards on the UI thread
+ *   by looking at the adapters, not from the notification contents
+ */
+static VOID NETIOAPI_API_ on_interface_change(PVOID ctx, PMIB_IPINTERFACE_ROW row,
+                                              MIB_NOTIFICATION_TYPE type)
+{
+    (void)row; (void)type;
+    SetEvent((HANDLE)ctx);
+}
+
+static VOID NETIOAPI_API_ on_address_change(PVOID ctx, PMIB_UNICASTIPADDRESS_ROW row,
+                                            MIB_NOTIFICATION_TYPE type)
+{
+    (void)row; (void)type;
+    SetEvent((HANDLE)ctx);
+}
+
+BOOL netwatch_start(NetWatch *w)
+{
+    memset(w, 0, sizeof(*w));
+    w->event = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (!w->event)
+        return FALSE;
+
+    /* Interfaces coming up or down, and addresses arriving once DHCP or
+     * SLAAC completes: the second is when a fetch can actually work */
+    if (NotifyIpInterfaceChange(AF_UNSPEC, on_interface_change, w->event,
+                                FALSE, &w->iface_notify) != NO_ERROR)
+        w->iface_notify = NULL;
+    if (NotifyUnicastIpAddressChange(AF_UNSPEC, on_address_change, w->event,
+                                     FALSE, &w->addr_notify) != NO_ERROR)
+        w->addr_notify = NULL;
+
+    if (!w->iface_notify && !w->addr_notify) {
+        netwatch_stop(w);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+HANDLE netwatch_handle(const NetWatch *w)
+{
+    return w->event;
+}
+
+BOOL netwatch_online(void)
+{
+    ULONG flags = GAA_FLAG_INCLUDE_GATEWAYS | GAA_FLAG_SKIP_ANYCAST |
+                  GAA_FLAG_SKIP_MULTICAST | GAA_FLAG_SKIP_DNS_SERVER;
+    ULONG size = NETWATCH_ADDR_BUF;
+    IP_ADAPTER_ADDRESSES *list = NULL;
+    ULONG rc = ERROR_BUFFER_OVERFLOW;
+    BOOL online = TRUE;
+
+    /* The adapter list can grow between the two calls; retry once */
+    for (int attempt = 0; attempt < 2 && rc == ERROR_BUFFER_OVERFLOW; attempt++) {
+        free(list);
+        list = (IP_ADAPTER_ADDRESSES *)malloc(size);
+        if (!list)
+            goto cleanup;
+        rc = GetAdaptersAddresses(AF_UNSPEC, flags, NULL, list, &size);
+    }
+    if (rc != NO_ERROR)
+        goto cleanup;
+
+    online = FALSE;
+    for (const IP_ADAPTER_ADDRESSES *a = list; a; a = a->Next) {
+        if (a->IfType == IF_TYPE_SOFTWARE_LOOPBACK || a->OperStatus != IfOperStatusUp)
+            continue;
+        /* VPN adapters (tunnel, PPP) often route without a default gateway */
+        if (a->FirstGatewayAddress || a->IfType == IF_TYPE_TUNNEL ||
+            a->IfType == IF_TYPE_PPP) {
+            online = TRUE;
+            break;
+        }
+    }
+
+cleanup:
+    free(list);
+    return online;
+}
+
+void netwatch_stop(NetWatch *w)
+{
+    /* Cancelling waits for running callbacks, so the event outlives them */
+    if (w->iface_notify)
+        CancelMibChangeNotify2(w->iface_notify);
+    if (w->addr_notify)
+        CancelMibChangeNotify2(w->addr_notify);
+    if (w->event)
+        CloseHandle(w->event);
+    memset(w, 0, sizeof(*w));
+}
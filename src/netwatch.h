@@ -0,0 +1,30 @@
+#ifndef NETWATCH_H
+#define NETWATCH_H
+
+#include <windows.h>
+
+/* Watches for network interface and address changes. */
+typedef struct {
+    HANDLE event;         /* Auto-reset; signaled on any change, NULL when inactive */
+    HANDLE iface_notify;  /* NotifyIpInterfaceChange() registration */
+    HANDLE addr_notify;   /* NotifyUnicastIpAddressChange() registration */
+} NetWatch;
+
+/* Start watching. Returns FALSE if notifications aren't available
+   (callers then just keep polling). */
+BOOL netwatch_start(NetWatch *w);
+
+/* Handle to wait on (e.g. with MsgWaitForMultipleObjects). Changes come
+   in bursts while an adapter connects; debounce before acting. */
+HANDLE netwatch_handle(const NetWatch *w);
+
+/* TRUE if some interface that could reach the internet is up: not a
+   loopback, operational, and with a default gateway or a VPN type
+   (tunnel, PPP). Returns TRUE when that can't be determined. Only a
+   hint: hosts behind an explicit proxy may have no route at all. */
+BOOL netwatch_online(void);
+
+/* Stop watching. Safe to call on an inactive watch. */
+void netwatch_stop(NetWatch *w);
+
+#endif
@@ -0,0 +1,229 @@
+#include "pipesrv.h"
+#include <sddl.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PIPESRV_JSON_MAX  1024
+#define PIPESRV_BUFFER    4096  /* Larger than any response: writes never block */
+/* A client that connects but never reads doesn't get to stall the server */
+#define PIPESRV_WRITE_TIMEOUT_MS 1000
+
+/* Owned by, and only open to, the user running the tray (plus SYSTEM).
+ * Spelled out with the user's SID (%s) rather than OWNER RIGHTS: an
+ * elevated tray's default owner is BUILTIN\Administrators. */
+#define PIPESRV_SDDL_FMT L"O:%sD:P(A;;GA;;;SY)(A;;GA;;;%s)"
+
+/* The served response, pre-formatted.
+ *
+ * Why format on publish instead of per request:
+ * - Usage changes once per poll at most, while a shell prompt may query
+ *   it on every render; formatting once makes a request a memcpy
+ * - The lock only guards a byte copy, so the UI thread never waits on a
+ *   slow client
+ */
+static CRITICAL_SECTION g_lock;
+static char   g_json[PIPESRV_JSON_MAX];
+static int    g_json_len;
+static HANDLE g_thread;
+static HANDLE g_stop;
+static wchar_t g_name[64];
+static SECURITY_ATTRIBUTES g_sa;  /* Owner-only pipe security */
+
+/* Write the snapshot to one connected client */
+static void serve_client(HANDLE pipe, OVERLAPPED *ov)
+{
+    char out[PIPESRV_JSON_MAX];
+    int len;
+
+    EnterCriticalSection(&g_lock);
+    len = g_json_len;
+    memcpy(out, g_json, len);
+    LeaveCriticalSection(&g_lock);
+
+    DWORD written = 0;
+    ResetEvent(ov->hEvent);
+    if (!WriteFile(pipe, out, (DWORD)len, &written, ov)) {
+        if (GetLastError() != ERROR_IO_PENDING)
+            return;
+        HANDLE wait[2] = {ov->hEvent, g_stop};
+        DWORD r = WaitForMultipleObjects(2, wait, FALSE, PIPESRV_WRITE_TIMEOUT_MS);
+        if (r != WAIT_OBJECT_0) {
+            CancelIo(pipe);
+            WaitForSingleObject(ov->hEvent, INFINITE);
+        }
+    }
+}
+
+/* The current user's SID as a string (caller LocalFree()s) */
+static wchar_t *current_user_sid(void)
+{
+    HANDLE token;
+    BYTE buf[sizeof(TOKEN_USER) + SECURITY_MAX_SID_SIZE];
+    DWORD len = 0;
+    wchar_t *sid_str = NULL;
+
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+        return NULL;
+    if (GetTokenInformation(token, TokenUser, buf, sizeof(buf), &len))
+        ConvertSidToStringSidW(((TOKEN_USER *)buf)->User.Sid, &sid_str);
+    CloseHandle(token);
+    return sid_str;
+}
+
+static HANDLE create_instance(BOOL first)
+{
+    /* FILE_FLAG_FIRST_PIPE_INSTANCE: fail rather than join a pipe
+     * some other process created under our name */
+    return CreateNamedPipeW(g_name,
+        PIPE_ACCESS_OUTBOUND | FILE_FLAG_OVERLAPPED |
+            (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+        PIPE_TYPE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+        PIPE_UNLIMITED_INSTANCES, PIPESRV_BUFFER, 0, 0, &g_sa);
+}
+
+/* Accept clients one at a time until g_stop is set.
+ *
+ * Why a serial loop:
+ * - A request is one buffered write of a few hundred bytes, so serving
+ *   clients one after another is still sub-millisecond each
+ * - Overlapped ConnectNamedPipe lets pipesrv_stop() interrupt the wait
+ *
+ * Why open the next instance before closing the current one:
+ * - Pipe names are machine-wide. If the last instance closed first, the
+ *   name would lapse between clients and any process could create it;
+ *   our next instance would then join that pipe, and prompts would read
+ *   whatever its creator wrote
+ * - While one of our instances exists, only the first one needed
+ *   FILE_FLAG_FIRST_PIPE_INSTANCE: new instances of the pipe need
+ *   FILE_CREATE_PIPE_INSTANCE, which the DACL only grants to us
+ *
+ * Why CloseHandle instead of DisconnectNamedPipe:
+ * - DisconnectNamedPipe discards data the client hasn't read yet; closing
+ *   our handle leaves it readable and then reports end of file
+ */
+static DWORD WINAPI server_thread(LPVOID param)
+{
+    (void)param;
+    OVERLAPPED ov;
+
+    memset(&ov, 0, sizeof(ov));
+    ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!ov.hEvent)
+        return 1;
+
+    HANDLE pipe = create_instance(TRUE);
+    while (pipe != INVALID_HANDLE_VALUE) {
+        BOOL connected = FALSE;
+        ResetEvent(ov.hEvent);
+        if (ConnectNamedPipe(pipe, &ov)) {
+            connected = TRUE;
+        } else {
+            DWORD err = GetLastError();
+            if (err == ERROR_PIPE_CONNECTED) {
+                connected = TRUE;
+            } else if (err == ERROR_IO_PENDING) {
+                HANDLE wait[2] = {ov.hEvent, g_stop};
+                DWORD r = WaitForMultipleObjects(2, wait, FALSE, INFINITE);
+                if (r == WAIT_OBJECT_0) {
+                    DWORD unused;
+                    connected = GetOverlappedResult(pipe, &ov, &unused, FALSE);
+                } else {
+                    CancelIo(pipe);
+                    WaitForSingleObject(ov.hEvent, INFINITE);
+                }
+            }
+        }
+
+        if (connected)
+            serve_client(pipe, &ov);
+
+        HANDLE next = INVALID_HANDLE_VALUE;
+        if (WaitForSingleObject(g_stop, 0) != WAIT_OBJECT_0)
+            next = create_instance(FALSE);
+        CloseHandle(pipe);
+        pipe = next;
+    }
+
+    CloseHandle(ov.hEvent);
+    return 0;
+}
+
+BOOL pipesrv_start(void)
+{
+    PSECURITY_DESCRIPTOR sd = NULL;
+    wchar_t *user = NULL;
+    wchar_t sddl[512];
+    DWORD session = 0;
+
+    ProcessIdToSessionId(GetCurrentProcessId(), &session);
+    _snwprintf(g_name, 64, L"\\\\.\\pipe\\claudeusage-%lu", session);
+
+    InitializeCriticalSection(&g_lock);
+    g_json_len = snprintf(g_json, sizeof(g_json),
+                          "{\"valid\":false,\"error\":\"Loading\"}\n");
+
+    /* Lives as long as the thread; freed in pipesrv_stop() */
+    user = current_user_sid();
+    if (!user)
+        goto fail;
+    _snwprintf(sddl, 512, PIPESRV_SDDL_FMT, user, user);
+    sddl[511] = L'\0';
+    LocalFree(user);
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(
+            sddl, SDDL_REVISION_1, &sd, NULL))
+        goto fail;
+    g_sa.nLength = sizeof(g_sa);
+    g_sa.lpSecurityDescriptor = sd;
+    g_sa.bInheritHandle = FALSE;
+
+    g_stop = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!g_stop)
+        goto fail;
+    g_thread = CreateThread(NULL, 0, server_thread, NULL, 0, NULL);
+    if (!g_thread)
+        goto fail;
+    return TRUE;
+
+fail:
+    if (g_stop) {
+        CloseHandle(g_stop);
+        g_stop = NULL;
+    }
+    LocalFree(sd);
+    g_sa.lpSecurityDescriptor = NULL;
+    DeleteCriticalSection(&g_lock);
+    return FALSE;
+}
+
+void pipesrv_publish(const UsageData *usage)
+{
+    char json[PIPESRV_JSON_MAX];
+    int len;
+
+    if (!g_thread)
+        return;
+    len = api_format_usage_json(usage, json, sizeof(json));
+    if (len < 0)
+        return;
+
+    EnterCriticalSection(&g_lock);
+    memcpy(g_json, json, len);
+    g_json_len = len;
+    LeaveCriticalSection(&g_lock);
+}
+
+void pipesrv_stop(void)
+{
+    if (!g_thread)
+        return;
+
+    SetEvent(g_stop);
+    WaitForSingleObject(g_thread, INFINITE);
+    CloseHandle(g_thread);
+    CloseHandle(g_stop);
+    g_thread = NULL;
+    g_stop = NULL;
+    LocalFree(g_sa.lpSecurityDescriptor);
+    g_sa.lpSecurityDescriptor = NULL;
+    DeleteCriticalSection(&g_lock);
+}
@@ -0,0 +1,17 @@
+#ifndef PIPESRV_H
+#define PIPESRV_H
+
+#include <windows.h>
+#include "api.h"
+
+/* Serve the latest usage on \\.\pipe\claudeusage-<session id>.
+   Each client that connects gets one line of JSON, then end of file. */
+BOOL pipesrv_start(void);
+
+/* Replace the served snapshot. Call from the UI thread on every update. */
+void pipesrv_publish(const UsageData *usage);
+
+/* Stop serving and wait for the server thread to exit. */
+void pipesrv_stop(void);
+
+#endif
@@ -1,4 +1,7 @@
 #include "popup.h"
+#include "diag.h"
+#include "idle.h"
+#include "spark.h"
 #include "util.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +11,9 @@
 /* Base dimensions at 96 DPI (100% scaling) */
 #define POPUP_WIDTH_BASE  310
 #define POPUP_HEIGHT_BASE 280
+#define SPARK_WIDTH_BASE  200  /* Same as the progress bar */
+#define SPARK_HEIGHT_BASE 16
+#define SPARK_ROW_BASE    20   /* Chart plus spacing, per usage section */
 #define POPUP_CLASS  L"ClaudeUsagePopup"
 
 #define CLR_BG       RGB(255, 255, 255)
@@ -21,10 +27,53 @@
 #define CLR_BAR_BG   RGB(230, 230, 230)
 #define CLR_SEPARATOR RGB(220, 220, 220)
 
+#ifndef WM_DPICHANGED
+#define WM_DPICHANGED 0x02E0
+#endif
+
 static HWND g_popup = NULL;
 static UsageData g_popup_data;
 static int g_dpi = 96;  /* Current DPI, updated on window creation */
 
+/* Trend charts under the 5-hour (last 24h) and 7-day (last 7d) bars,
+ * drawn from the history ring when one is open */
+enum { SPARK_24H, SPARK_7D, SPARK_COUNT };
+static Sparkline g_spark[SPARK_COUNT];
+static const HistoryRing *g_history;
+static WORD g_account;
+
+/* Other configured accounts, one line each above the footer */
+static PopupAccount g_accounts[MAX_ACCOUNTS - 1];
+static int g_account_count;
+static wchar_t g_main_name[MAX_ACCOUNT_NAME];
+
+/* GDI objects shared by every paint.
+ *
+ * Why cache instead of creating them in WM_PAINT:
+ * - CreateFontW is the most expensive part of opening the popup (font
+ *   mapping runs every time), and a paint used to create three fonts
+ *   plus a brush or pen per bar and per separator line
+ * - Brushes and the pen don't depend on DPI, so they're built once in
+ *   popup_register() on first use; fonts are rebuilt only when the DPI changes
+ *   (first show on a scaled monitor, or WM_DPICHANGED)
+ * - Everything is freed once, in popup_shutdown()
+ */
+typedef struct {
+    int    dpi;          /* DPI the fonts were built for, 0 if not built */
+    HFONT  title;
+    HFONT  bold;
+    HFONT  normal;
+    HBRUSH bg;
+    HBRUSH bar_bg;
+    HBRUSH bar_green;
+    HBRUSH bar_yellow;
+    HBRUSH bar_red;
+    HBRUSH bar_muted;
+    HPEN   separator;
+} PopupResources;
+
+static PopupResources g_res;
+
 /* Scale a dimension by current DPI.
  *
  * Why scale everything:
@@ -37,6 +86,17 @@ static int scale_for_dpi(int base_value)
     return MulDiv(base_value, g_dpi, 96);
 }
 
+/* Popup height: taller when the sparklines are shown */
+static int popup_height(void)
+{
+    int base = POPUP_HEIGHT_BASE;
+    if (g_history)
+        base += 2 * SPARK_ROW_BASE;
+    if (g_account_count > 0)
+        base += 8 + 18 * g_account_count;
+    return scale_for_dpi(base);
+}
+
 static COLORREF bar_color(double util)
 {
     if (util < 0) return CLR_MUTED;
@@ -45,6 +105,43 @@ static COLORREF bar_color(double util)
     return CLR_RED;
 }
 
+static HBRUSH bar_brush(double util)
+{
+    if (util < 0) return g_res.bar_muted;
+    if (util < 60.0) return g_res.bar_green;
+    if (util < 80.0) return g_res.bar_yellow;
+    return g_res.bar_red;
+}
+
+static HFONT create_ui_font(int base_height, int weight)
+{
+    return CreateFontW(scale_for_dpi(base_height), 0, 0, 0, weight,
+        FALSE, FALSE, FALSE, DEFAULT_CHARSET, OUT_DEFAULT_PRECIS,
+        CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY, DEFAULT_PITCH | FF_SWISS,
+        L"Segoe UI");
+}
+
+static void free_fonts(void)
+{
+    if (g_res.title)  DeleteObject(g_res.title);
+    if (g_res.bold)   DeleteObject(g_res.bold);
+    if (g_res.normal) DeleteObject(g_res.normal);
+    g_res.title = g_res.bold = g_res.normal = NULL;
+    g_res.dpi = 0;
+}
+
+/* Build the DPI-scaled fonts unless they already match g_dpi */
+static void ensure_fonts(void)
+{
+    if (g_res.dpi == g_dpi && g_res.title)
+        return;
+    free_fonts();
+    g_res.title  = create_ui_font(18, FW_BOLD);
+    g_res.bold   = create_ui_font(14, FW_SEMIBOLD);
+    g_res.normal = create_ui_font(13, FW_NORMAL);
+    g_res.dpi = g_dpi;
+}
+
 /* Format subscription type for display.
  *
  * Why format here instead of storing formatted version:
@@ -102,9 +199,7 @@ static void draw_progress_bar(HDC hdc, int x, int y, int w, int h, double util)
 {
     /* Background */
     RECT rc = {x, y, x + w, y + h};
-    HBRUSH hBg = CreateSolidBrush(CLR_BAR_BG);
-    FillRect(hdc, &rc, hBg);
-    DeleteObject(hBg);
+    FillRect(hdc, &rc, g_res.bar_bg);
 
     if (util < 0) return;
 
@@ -113,31 +208,318 @@ static void draw_progress_bar(HDC hdc, int x, int y, int w, int h, double util)
     if (fill > w) fill = w;
     if (fill > 0) {
         RECT rcFill = {x, y, x + fill, y + h};
-        HBRUSH hFill = CreateSolidBrush(bar_color(util));
-        FillRect(hdc, &rcFill, hFill);
-        DeleteObject(hFill);
+        FillRect(hdc, &rcFill, bar_brush(util));
     }
 }
 
 static void draw_separator(HDC hdc, int x, int y, int w)
 {
-    HPEN hPen = CreatePen(PS_SOLID, 1, CLR_SEPARATOR);
-    HPEN hOld = (HPEN)SelectObject(hdc, hPen);
+    HPEN hOld = (HPEN)SelectObject(hdc, g_res.separator);
     MoveToEx(hdc, x, y, NULL);
     LineTo(hdc, x + w, y);
     SelectObject(hdc, hOld);
-    DeleteObject(hPen);
 }
 
-static void draw_usage_section(HDC hdc, HFONT hBold, HFONT hNormal,
-                               int *py, const wchar_t *title,
-                               double util, const char *resets_iso)
+/* Popup sections, top to bottom. Each is redrawn on its own when what it
+ * shows changes (see render_surface()). */
+enum {
+    SEC_HEADER,     /* Title + separator */
+    SEC_ERROR,      /* Error text (only when !valid) */
+    SEC_FIVE_HOUR,
+    SEC_SEVEN_DAY,
+    SEC_MODELS,     /* Opus / Sonnet lines, if the API reports them */
+    SEC_EXTRA,      /* Extra credits, if enabled */
+    SEC_ACCOUNTS,   /* One line per other configured account */
+    SEC_FOOTER,     /* "Updated:" timestamp, pinned to the bottom */
+    SEC_COUNT
+};
+
+#define SECTION_KEY_MAX 192
+
+/* Pre-rendered popup image.
+ *
+ * Why render into a memory DIB and blit:
+ * - Over RDP/Citrix every GDI call on a window DC is a network round
+ *   trip; painting straight to the window meant dozens of them per
+ *   WM_PAINT and visible flicker. A cached surface turns each paint
+ *   into a single BitBlt
+ * - The surface is redrawn only when the data changes (popup_show,
+ *   popup_update) and once a minute for the "Resets in" countdown
+ *
+ * Why per-section keys:
+ * - Each section's visible text is formatted into 'key'; a section is
+ *   redrawn (and only its rectangle invalidated) when its key changes,
+ *   so a countdown tick repaints one line rather than the whole popup
+ * - If the layout itself shifts (a section appears or disappears), the
+ *   whole surface is redrawn
+ */
+typedef struct {
+    HDC     dc;
+    HBITMAP bmp;
+    HGDIOBJ old_bmp;
+    HGDIOBJ old_font;
+    int     width;
+    int     height;
+    RECT    rect[SEC_COUNT];                  /* Empty if not shown */
+    wchar_t key[SEC_COUNT][SECTION_KEY_MAX];  /* What each section shows */
+} PopupSurface;
+
+static PopupSurface g_surface;
+static SYSTEMTIME g_updated;  /* Local time the shown numbers were fetched */
+
+#define IDT_POPUP_COUNTDOWN 1
+#define POPUP_COUNTDOWN_MS  60000
+
+static void destroy_surface(void)
+{
+    if (!g_surface.dc)
+        return;
+    SelectObject(g_surface.dc, g_surface.old_font);
+    SelectObject(g_surface.dc, g_surface.old_bmp);
+    DeleteObject(g_surface.bmp);
+    DeleteDC(g_surface.dc);
+    memset(&g_surface, 0, sizeof(g_surface));
+}
+
+static BOOL create_surface(int width, int height)
+{
+    destroy_surface();
+
+    BITMAPINFO bmi;
+    memset(&bmi, 0, sizeof(bmi));
+    bmi.bmiHeader.biSize        = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth       = width;
+    bmi.bmiHeader.biHeight      = -height;  /* Top-down */
+    bmi.bmiHeader.biPlanes      = 1;
+    bmi.bmiHeader.biBitCount    = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    HDC screen = GetDC(NULL);
+    HDC dc = CreateCompatibleDC(screen);
+    ReleaseDC(NULL, screen);
+    if (!dc)
+        return FALSE;
+
+    void *bits;
+    HBITMAP bmp = CreateDIBSection(dc, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+    if (!bmp) {
+        DeleteDC(dc);
+        return FALSE;
+    }
+
+    g_surface.dc       = dc;
+    g_surface.bmp      = bmp;
+    g_surface.old_bmp  = SelectObject(dc, bmp);
+    g_surface.old_font = GetCurrentObject(dc, OBJ_FONT);
+    g_surface.width    = width;
+    g_surface.height   = height;
+    SetBkMode(dc, TRANSPARENT);
+    return TRUE;
+}
+
+static void format_percent(double util, wchar_t *out, int len)
+{
+    if (util >= 0)
+        _snwprintf(out, len, L"%.0f%%", util);
+    else
+        wcscpy(out, L"N/A");
+}
+
+/* "Resets in: ..." line, or "" if the API gave no reset time. 'limit_sec'
+ * adds the forecast time to 100% when it comes before the reset. */
+static void format_reset_line(const char *resets_iso, int limit_sec,
+                              wchar_t *out, int len)
+{
+    out[0] = L'\0';
+    if (!resets_iso[0])
+        return;
+
+    SYSTEMTIME st_reset;
+    wchar_t remaining[64];
+    if (util_parse_iso8601(resets_iso, &st_reset))
+        util_format_time_remaining(&st_reset, remaining, 64);
+    else
+        wcscpy(remaining, L"unknown");
+
+    if (limit_sec > 0) {
+        wchar_t eta[32];
+        util_format_duration(limit_sec, eta, 32);
+        _snwprintf(out, len, L"Resets in: %s  (100%% in %s)", remaining, eta);
+    } else {
+        _snwprintf(out, len, L"Resets in: %s", remaining);
+    }
+}
+
+static void format_title(wchar_t *out, int len)
+{
+    wchar_t sub_type[32];
+    format_subscription_type(g_popup_data.subscription_type, sub_type, 32);
+    if (g_main_name[0])
+        _snwprintf(out, len, L"Claude %s Usage - %s", sub_type, g_main_name);
+    else
+        _snwprintf(out, len, L"Claude %s Usage", sub_type);
+}
+
+/* "Team: 5h 40% | 7d 10%", or the account's error */
+static void format_account(const PopupAccount *a, wchar_t *out, int len)
+{
+    const UsageData *u = &a->usage;
+    if (u->valid) {
+        wchar_t five[16], seven[16];
+        format_percent(u->five_hour_util, five, 16);
+        format_percent(u->seven_day_util, seven, 16);
+        _snwprintf(out, len, L"%s: 5h %s | 7d %s", a->name, five, seven);
+    } else {
+        _snwprintf(out, len, L"%s: %hs", a->name,
+                   u->error[0] ? u->error : "Loading...");
+    }
+    out[len - 1] = L'\0';
+}
+
+static void format_models(wchar_t *opus, wchar_t *sonnet, int len)
+{
+    opus[0] = sonnet[0] = L'\0';
+    if (g_popup_data.opus_util >= 0)
+        _snwprintf(opus, len, L"7-Day Opus: %.0f%%", g_popup_data.opus_util);
+    if (g_popup_data.sonnet_util >= 0)
+        _snwprintf(sonnet, len, L"7-Day Sonnet: %.0f%%", g_popup_data.sonnet_util);
+}
+
+static void format_extra(wchar_t *out, int len)
+{
+    _snwprintf(out, len, L"Extra Credits: $%.2f / $%.2f",
+               g_popup_data.extra_used / 100.0,
+               g_popup_data.extra_limit / 100.0);
+}
+
+static void format_footer(wchar_t *out, int len)
+{
+    SYSTEMTIME today;
+    GetLocalTime(&today);
+    /* Restored from history: it may well be from another day */
+    if (g_updated.wYear != today.wYear || g_updated.wMonth != today.wMonth ||
+        g_updated.wDay != today.wDay)
+        _snwprintf(out, len, L"Updated: %04d-%02d-%02d %02d:%02d",
+                   g_updated.wYear, g_updated.wMonth, g_updated.wDay,
+                   g_updated.wHour, g_updated.wMinute);
+    else
+        _snwprintf(out, len, L"Updated: %02d:%02d:%02d",
+                   g_updated.wHour, g_updated.wMinute, g_updated.wSecond);
+}
+
+/* g_updated from usage->fetched_at: when the API last confirmed the
+ * numbers (a 200, or a 304 saying they haven't changed), so a sample
+ * restored from history keeps its own time */
+static void set_updated(const UsageData *usage)
+{
+    if (!util_unix_to_local(usage->fetched_at, &g_updated))
+        GetLocalTime(&g_updated);  /* Errors: when we found out */
+}
+
+/* Compute where each section goes for the current data */
+static void layout_sections(RECT *rect)
+{
+    const UsageData *d = &g_popup_data;
+    int width = scale_for_dpi(POPUP_WIDTH_BASE);
+    int spark_row = g_history ? scale_for_dpi(SPARK_ROW_BASE) : 0;
+    int h[SEC_COUNT];
+    memset(h, 0, sizeof(h));
+
+    h[SEC_HEADER] = scale_for_dpi(28) + scale_for_dpi(10);
+    if (!d->valid) {
+        h[SEC_ERROR] = scale_for_dpi(20);
+    } else {
+        h[SEC_FIVE_HOUR] = scale_for_dpi(20) + scale_for_dpi(20) + spark_row +
+                           scale_for_dpi(6);
+        if (d->five_hour_resets[0])
+            h[SEC_FIVE_HOUR] += scale_for_dpi(18);
+        h[SEC_SEVEN_DAY] = scale_for_dpi(20) + scale_for_dpi(20) + spark_row +
+                           scale_for_dpi(6);
+        if (d->seven_day_resets[0])
+            h[SEC_SEVEN_DAY] += scale_for_dpi(18);
+        if (d->opus_util >= 0)
+            h[SEC_MODELS] += scale_for_dpi(18);
+        if (d->sonnet_util >= 0)
+            h[SEC_MODELS] += scale_for_dpi(18);
+        if (d->extra_enabled)
+            h[SEC_EXTRA] = scale_for_dpi(8) + scale_for_dpi(20);
+    }
+    if (g_account_count > 0)
+        h[SEC_ACCOUNTS] = scale_for_dpi(8) + scale_for_dpi(18) * g_account_count;
+
+    int y = scale_for_dpi(12);
+    for (int i = 0; i < SEC_FOOTER; i++) {
+        SetRect(&rect[i], 0, y, width, y + h[i]);
+        if (h[i] == 0)
+            SetRectEmpty(&rect[i]);
+        y += h[i];
+    }
+    SetRect(&rect[SEC_FOOTER], 0, popup_height() - scale_for_dpi(30),
+            width, popup_height());
+}
+
+/* Everything a section displays, as one string */
+static void section_key(int sec, wchar_t *key)
+{
+    const UsageData *d = &g_popup_data;
+    wchar_t a[128], b[128];
+
+    key[0] = L'\0';
+    switch (sec) {
+    case SEC_HEADER:
+        format_title(key, SECTION_KEY_MAX);
+        break;
+    case SEC_ERROR:
+        if (!d->valid)
+            _snwprintf(key, SECTION_KEY_MAX, L"%hs", d->error);
+        break;
+    case SEC_FIVE_HOUR:
+    case SEC_SEVEN_DAY: {
+        if (!d->valid)
+            break;
+        BOOL five = (sec == SEC_FIVE_HOUR);
+        format_percent(five ? d->five_hour_util : d->seven_day_util, a, 128);
+        format_reset_line(five ? d->five_hour_resets : d->seven_day_resets,
+                          five ? d->five_hour_limit_sec : d->seven_day_limit_sec,
+                          b, 128);
+        _snwprintf(key, SECTION_KEY_MAX, L"%s|%s|%lu", a, b,
+                   g_history ? g_spark[five ? SPARK_24H : SPARK_7D].version : 0);
+        break;
+    }
+    case SEC_MODELS:
+        if (!d->valid)
+            break;
+        format_models(a, b, 128);
+        _snwprintf(key, SECTION_KEY_MAX, L"%s|%s", a, b);
+        break;
+    case SEC_EXTRA:
+        if (d->valid && d->extra_enabled)
+            format_extra(key, SECTION_KEY_MAX);
+        break;
+    case SEC_ACCOUNTS: {
+        int n = 0;
+        for (int i = 0; i < g_account_count && n >= 0 && n < SECTION_KEY_MAX; i++) {
+            format_account(&g_accounts[i], a, 128);
+            n += _snwprintf(key + n, SECTION_KEY_MAX - n, L"%s|", a);
+        }
+        break;
+    }
+    case SEC_FOOTER:
+        format_footer(key, SECTION_KEY_MAX);
+        break;
+    }
+    key[SECTION_KEY_MAX - 1] = L'\0';
+}
+
+static void draw_usage_section(HDC hdc, int y, const wchar_t *title,
+                               double util, const char *resets_iso,
+                               int limit_sec, const Sparkline *spark,
+                               const wchar_t *span)
 {
-    int y = *py;
     int lx = scale_for_dpi(16);
 
     /* Title */
-    SelectObject(hdc, hBold);
+    SelectObject(hdc, g_res.bold);
     SetTextColor(hdc, CLR_LABEL);
     TextOutW(hdc, lx, y, title, (int)wcslen(title));
     y += scale_for_dpi(20);
@@ -147,33 +529,202 @@ static void draw_usage_section(HDC hdc, HFONT hBold, HFONT hNormal,
 
     /* Percentage text */
     wchar_t pct[32];
-    if (util >= 0)
-        _snwprintf(pct, 32, L"%.0f%%", util);
-    else
-        wcscpy(pct, L"N/A");
-    SelectObject(hdc, hNormal);
+    format_percent(util, pct, 32);
+    SelectObject(hdc, g_res.normal);
     SetTextColor(hdc, bar_color(util));
     TextOutW(hdc, lx + scale_for_dpi(210), y, pct, (int)wcslen(pct));
     y += scale_for_dpi(20);
 
-    /* Reset time */
-    if (resets_iso[0]) {
-        SYSTEMTIME st_reset;
-        wchar_t remaining[64];
-        if (util_parse_iso8601(resets_iso, &st_reset))
-            util_format_time_remaining(&st_reset, remaining, 64);
-        else
-            wcscpy(remaining, L"unknown");
-
-        wchar_t line[128];
-        _snwprintf(line, 128, L"Resets in: %s", remaining);
+    /* Trend over the last 'span' */
+    if (g_history) {
+        spark_draw(spark, hdc, lx, y);
         SetTextColor(hdc, CLR_MUTED);
+        TextOutW(hdc, lx + scale_for_dpi(210), y, span, (int)wcslen(span));
+        y += scale_for_dpi(SPARK_ROW_BASE);
+    }
+
+    /* Reset time */
+    wchar_t line[128];
+    format_reset_line(resets_iso, limit_sec, line, 128);
+    if (line[0]) {
+        /* Red when the limit is forecast to arrive before the reset */
+        SetTextColor(hdc, limit_sec > 0 ? CLR_RED : CLR_MUTED);
         TextOutW(hdc, lx, y, line, (int)wcslen(line));
-        y += scale_for_dpi(18);
     }
+}
+
+static void draw_section(HDC hdc, int sec, const RECT *rc)
+{
+    const UsageData *d = &g_popup_data;
+    int lx = scale_for_dpi(16);
+    int y = rc->top;
+    int line_width = scale_for_dpi(POPUP_WIDTH_BASE) - scale_for_dpi(32);
+    wchar_t text[128], text2[128];
+
+    switch (sec) {
+    case SEC_HEADER:
+        format_title(text, 128);
+        SelectObject(hdc, g_res.title);
+        SetTextColor(hdc, CLR_HEADER);
+        TextOutW(hdc, lx, y, text, (int)wcslen(text));
+        draw_separator(hdc, lx, y + scale_for_dpi(28), line_width);
+        break;
+
+    case SEC_ERROR: {
+        SelectObject(hdc, g_res.normal);
+        SetTextColor(hdc, CLR_RED);
+        wchar_t *err = util_to_wide(d->error);
+        if (err) {
+            TextOutW(hdc, lx, y, err, (int)wcslen(err));
+            free(err);
+        } else {
+            TextOutW(hdc, lx, y, L"Error fetching data", 19);
+        }
+        break;
+    }
+
+    case SEC_FIVE_HOUR:
+        draw_usage_section(hdc, y, L"5-Hour Window",
+                           d->five_hour_util, d->five_hour_resets,
+                           d->five_hour_limit_sec, &g_spark[SPARK_24H], L"24h");
+        break;
+
+    case SEC_SEVEN_DAY:
+        draw_usage_section(hdc, y, L"7-Day Window",
+                           d->seven_day_util, d->seven_day_resets,
+                           d->seven_day_limit_sec, &g_spark[SPARK_7D], L"7d");
+        break;
+
+    case SEC_MODELS:
+        format_models(text, text2, 128);
+        SelectObject(hdc, g_res.normal);
+        SetTextColor(hdc, CLR_LABEL);
+        if (text[0]) {
+            TextOutW(hdc, lx, y, text, (int)wcslen(text));
+            y += scale_for_dpi(18);
+        }
+        if (text2[0])
+            TextOutW(hdc, lx, y, text2, (int)wcslen(text2));
+        break;
+
+    case SEC_EXTRA:
+        draw_separator(hdc, lx, y, line_width);
+        y += scale_for_dpi(8);
+        format_extra(text, 128);
+        SelectObject(hdc, g_res.normal);
+        SetTextColor(hdc, CLR_LABEL);
+        TextOutW(hdc, lx, y, text, (int)wcslen(text));
+        break;
+
+    case SEC_ACCOUNTS:
+        draw_separator(hdc, lx, y, line_width);
+        y += scale_for_dpi(8);
+        SelectObject(hdc, g_res.normal);
+        for (int i = 0; i < g_account_count; i++) {
+            const UsageData *u = &g_accounts[i].usage;
+            double util = u->five_hour_util > u->seven_day_util
+                        ? u->five_hour_util : u->seven_day_util;
+            format_account(&g_accounts[i], text, 128);
+            SetTextColor(hdc, u->valid ? bar_color(util) : CLR_MUTED);
+            TextOutW(hdc, lx, y, text, (int)wcslen(text));
+            y += scale_for_dpi(18);
+        }
+        break;
+
+    case SEC_FOOTER:
+        draw_separator(hdc, lx, y, line_width);
+        format_footer(text, 128);
+        SelectObject(hdc, g_res.normal);
+        SetTextColor(hdc, CLR_MUTED);
+        TextOutW(hdc, lx, y + scale_for_dpi(8), text, (int)wcslen(text));
+        break;
+    }
+}
+
+/* Plot samples recorded since the last render and scroll the charts to
+ * the current time. A changed chart bumps its version, which is part of
+ * its section's key. */
+static void sync_sparks(void)
+{
+    if (!g_history)
+        return;
+    LONGLONG now = util_unix_now();
+    for (int i = 0; i < SPARK_COUNT; i++)
+        spark_sync(&g_spark[i], g_history, g_account,
+                   scale_for_dpi(SPARK_WIDTH_BASE),
+                   scale_for_dpi(SPARK_HEIGHT_BASE), now);
+}
+
+/* Bring the cached surface up to date with g_popup_data, redrawing only
+ * the sections that changed, and invalidate just those parts of the
+ * window. */
+static void render_surface(void)
+{
+    int width = scale_for_dpi(POPUP_WIDTH_BASE);
+    int height = popup_height();
+    BOOL full = FALSE;
+    LONGLONG t0 = diag_begin();
+
+    if (!g_surface.dc || g_surface.width != width || g_surface.height != height) {
+        if (!create_surface(width, height))
+            return;
+        full = TRUE;
+    }
+    ensure_fonts();
+    sync_sparks();
+
+    RECT rect[SEC_COUNT];
+    layout_sections(rect);
+    if (memcmp(rect, g_surface.rect, sizeof(rect)) != 0)
+        full = TRUE;
+
+    if (full) {
+        RECT all = {0, 0, width, height};
+        FillRect(g_surface.dc, &all, g_res.bg);
+        memcpy(g_surface.rect, rect, sizeof(rect));
+    }
+
+    for (int i = 0; i < SEC_COUNT; i++) {
+        wchar_t key[SECTION_KEY_MAX];
+        section_key(i, key);
+        if (!full && wcscmp(key, g_surface.key[i]) == 0)
+            continue;
+        wcscpy(g_surface.key[i], key);
+        if (IsRectEmpty(&rect[i]))
+            continue;
+        if (!full)
+            FillRect(g_surface.dc, &rect[i], g_res.bg);
+        draw_section(g_surface.dc, i, &rect[i]);
+        if (g_popup && !full)
+            InvalidateRect(g_popup, &rect[i], FALSE);
+    }
+
+    /* Leave no cached font selected, so ensure_fonts() can delete them */
+    SelectObject(g_surface.dc, g_surface.old_font);
 
-    y += scale_for_dpi(6);
-    *py = y;
+    if (g_popup && full)
+        InvalidateRect(g_popup, NULL, FALSE);
+    diag_end(DIAG_POPUP_RENDER, t0);
+}
+
+/* Dismissed by the user: drop what only a visible popup needs.
+ *
+ * Why free the surface and the charts' DIBs but keep fonts and brushes:
+ * - Updates while hidden are no-ops, so the DIBs (several hundred KB at
+ *   high DPI) would sit untouched until the next open, which redraws
+ *   nearly everything anyway
+ * - Each chart keeps its column values and cursor (a few hundred bytes),
+ *   so the next open repaints it and plots only the samples since
+ * - Fonts are what makes opening slow and cost a few GDI handles; they
+ *   stay until popup_shutdown()
+ */
+static void dismiss(void)
+{
+    popup_hide();
+    destroy_surface();
+    for (int i = 0; i < SPARK_COUNT; i++)
+        spark_free_bitmap(&g_spark[i]);
+    idle_enter();
 }
 
 static LRESULT CALLBACK PopupProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
@@ -183,124 +734,47 @@ static LRESULT CALLBACK PopupProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPa
         PAINTSTRUCT ps;
         HDC hdc = BeginPaint(hwnd, &ps);
 
-        /* Fill background */
-        RECT rcClient;
-        GetClientRect(hwnd, &rcClient);
-        HBRUSH hBg = CreateSolidBrush(CLR_BG);
-        FillRect(hdc, &rcClient, hBg);
-        DeleteObject(hBg);
-
-        SetBkMode(hdc, TRANSPARENT);
-
-        /* Create DPI-scaled fonts */
-        HFONT hTitle = CreateFontW(scale_for_dpi(18), 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE,
-            DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
-            CLEARTYPE_QUALITY, DEFAULT_PITCH | FF_SWISS, L"Segoe UI");
-        HFONT hBold = CreateFontW(scale_for_dpi(14), 0, 0, 0, FW_SEMIBOLD, FALSE, FALSE, FALSE,
-            DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
-            CLEARTYPE_QUALITY, DEFAULT_PITCH | FF_SWISS, L"Segoe UI");
-        HFONT hNormal = CreateFontW(scale_for_dpi(13), 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE,
-            DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
-            CLEARTYPE_QUALITY, DEFAULT_PITCH | FF_SWISS, L"Segoe UI");
-
-        int lx = scale_for_dpi(16);  /* Left margin */
-        int y = scale_for_dpi(12);
-        int popup_width = scale_for_dpi(POPUP_WIDTH_BASE);
-
-        /* Title - format with subscription type */
-        wchar_t title[64];
-        wchar_t sub_type[32];
-        format_subscription_type(g_popup_data.subscription_type, sub_type, 32);
-        _snwprintf(title, 64, L"Claude %s Usage", sub_type);
-        SelectObject(hdc, hTitle);
-        SetTextColor(hdc, CLR_HEADER);
-        TextOutW(hdc, lx, y, title, (int)wcslen(title));
-        y += scale_for_dpi(28);
-        draw_separator(hdc, lx, y, popup_width - scale_for_dpi(32));
-        y += scale_for_dpi(10);
-
-        if (!g_popup_data.valid) {
-            SelectObject(hdc, hNormal);
-            SetTextColor(hdc, CLR_RED);
-            wchar_t *err = util_to_wide(g_popup_data.error);
-            if (err) {
-                TextOutW(hdc, lx, y, err, (int)wcslen(err));
-                free(err);
-            } else {
-                TextOutW(hdc, lx, y, L"Error fetching data", 19);
-            }
-        } else {
-            /* 5-hour window */
-            draw_usage_section(hdc, hBold, hNormal, &y,
-                L"5-Hour Window",
-                g_popup_data.five_hour_util,
-                g_popup_data.five_hour_resets);
-
-            /* 7-day window */
-            draw_usage_section(hdc, hBold, hNormal, &y,
-                L"7-Day Window",
-                g_popup_data.seven_day_util,
-                g_popup_data.seven_day_resets);
-
-            /* Opus/Sonnet specific if available */
-            if (g_popup_data.opus_util >= 0) {
-                wchar_t lbl[64];
-                _snwprintf(lbl, 64, L"7-Day Opus: %.0f%%", g_popup_data.opus_util);
-                SelectObject(hdc, hNormal);
-                SetTextColor(hdc, CLR_LABEL);
-                TextOutW(hdc, lx, y, lbl, (int)wcslen(lbl));
-                y += scale_for_dpi(18);
-            }
-            if (g_popup_data.sonnet_util >= 0) {
-                wchar_t lbl[64];
-                _snwprintf(lbl, 64, L"7-Day Sonnet: %.0f%%", g_popup_data.sonnet_util);
-                SelectObject(hdc, hNormal);
-                SetTextColor(hdc, CLR_LABEL);
-                TextOutW(hdc, lx, y, lbl, (int)wcslen(lbl));
-                y += scale_for_dpi(18);
-            }
-
-            /* Extra credits */
-            if (g_popup_data.extra_enabled) {
-                draw_separator(hdc, lx, y, popup_width - scale_for_dpi(32));
-                y += scale_for_dpi(8);
-                wchar_t credits[128];
-                _snwprintf(credits, 128, L"Extra Credits: $%.2f / $%.2f",
-                    g_popup_data.extra_used / 100.0,
-                    g_popup_data.extra_limit / 100.0);
-                SelectObject(hdc, hNormal);
-                SetTextColor(hdc, CLR_LABEL);
-                TextOutW(hdc, lx, y, credits, (int)wcslen(credits));
-                y += scale_for_dpi(20);
-            }
-        }
-
-        /* Timestamp */
-        int popup_height = scale_for_dpi(POPUP_HEIGHT_BASE);
-        SYSTEMTIME now;
-        GetLocalTime(&now);
-        wchar_t ts[64];
-        _snwprintf(ts, 64, L"Updated: %02d:%02d:%02d",
-                   now.wHour, now.wMinute, now.wSecond);
-        draw_separator(hdc, lx, popup_height - scale_for_dpi(30), popup_width - scale_for_dpi(32));
-        SelectObject(hdc, hNormal);
-        SetTextColor(hdc, CLR_MUTED);
-        TextOutW(hdc, lx, popup_height - scale_for_dpi(22), ts, (int)wcslen(ts));
+        if (!g_surface.dc)
+            render_surface();
+        if (g_surface.dc)
+            BitBlt(hdc, ps.rcPaint.left, ps.rcPaint.top,
+                   ps.rcPaint.right - ps.rcPaint.left,
+                   ps.rcPaint.bottom - ps.rcPaint.top,
+                   g_surface.dc, ps.rcPaint.left, ps.rcPaint.top, SRCCOPY);
 
-        DeleteObject(hTitle);
-        DeleteObject(hBold);
-        DeleteObject(hNormal);
         EndPaint(hwnd, &ps);
         return 0;
     }
 
+    case WM_ERASEBKGND:
+        /* The blit covers everything; erasing first is what flickers */
+        return 1;
+
+    case WM_TIMER:
+        if (wParam == IDT_POPUP_COUNTDOWN)
+            render_surface();
+        return 0;
+
+    case WM_DPICHANGED: {
+        /* Moved to a monitor with different scaling: rebuild fonts and
+         * take the size Windows suggests */
+        const RECT *rc = (const RECT *)lParam;
+        g_dpi = LOWORD(wParam);
+        ensure_fonts();
+        SetWindowPos(hwnd, NULL, rc->left, rc->top,
+                     rc->right - rc->left, rc->bottom - rc->top,
+                     SWP_NOZORDER | SWP_NOACTIVATE);
+        render_surface();  /* New size: full redraw */
+        return 0;
+    }
+
     case WM_KILLFOCUS:
-        popup_hide();
+        dismiss();
         return 0;
 
     case WM_KEYDOWN:
         if (wParam == VK_ESCAPE)
-            popup_hide();
+            dismiss();
         return 0;
 
     default:
@@ -310,6 +784,9 @@ static LRESULT CALLBACK PopupProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPa
 
 void popup_register(HINSTANCE hInstance)
 {
+    if (g_res.bg)
+        return;  /* Already registered */
+
     WNDCLASSEXW wc;
     memset(&wc, 0, sizeof(wc));
     wc.cbSize        = sizeof(wc);
@@ -318,19 +795,97 @@ void popup_register(HINSTANCE hInstance)
     wc.hCursor       = LoadCursor(NULL, IDC_ARROW);
     wc.lpszClassName = POPUP_CLASS;
     RegisterClassExW(&wc);
+
+    g_res.bg         = CreateSolidBrush(CLR_BG);
+    g_res.bar_bg     = CreateSolidBrush(CLR_BAR_BG);
+    g_res.bar_green  = CreateSolidBrush(CLR_GREEN);
+    g_res.bar_yellow = CreateSolidBrush(CLR_YELLOW);
+    g_res.bar_red    = CreateSolidBrush(CLR_RED);
+    g_res.bar_muted  = CreateSolidBrush(CLR_MUTED);
+    g_res.separator  = CreatePen(PS_SOLID, 1, CLR_SEPARATOR);
+
+    spark_init(&g_spark[SPARK_24H], SPARK_FIVE_HOUR, 24 * 3600, CLR_BG, bar_color);
+    spark_init(&g_spark[SPARK_7D], SPARK_SEVEN_DAY, 7 * 24 * 3600, CLR_BG, bar_color);
+}
+
+void popup_set_history(const HistoryRing *history, WORD account)
+{
+    g_history = history;
+    g_account = account;
+}
+
+void popup_shutdown(void)
+{
+    popup_hide();
+    destroy_surface();
+    for (int i = 0; i < SPARK_COUNT; i++)
+        spark_free(&g_spark[i]);
+    free_fonts();
+    if (g_res.bg)         DeleteObject(g_res.bg);
+    if (g_res.bar_bg)     DeleteObject(g_res.bar_bg);
+    if (g_res.bar_green)  DeleteObject(g_res.bar_green);
+    if (g_res.bar_yellow) DeleteObject(g_res.bar_yellow);
+    if (g_res.bar_red)    DeleteObject(g_res.bar_red);
+    if (g_res.bar_muted)  DeleteObject(g_res.bar_muted);
+    if (g_res.separator)  DeleteObject(g_res.separator);
+    memset(&g_res, 0, sizeof(g_res));
+}
+
+void popup_set_accounts(const wchar_t *main_name,
+                        const PopupAccount *accounts, int count)
+{
+    if (count > MAX_ACCOUNTS - 1)
+        count = MAX_ACCOUNTS - 1;
+    g_main_name[0] = L'\0';
+    if (main_name)
+        wcsncpy(g_main_name, main_name, MAX_ACCOUNT_NAME - 1);
+    g_main_name[MAX_ACCOUNT_NAME - 1] = L'\0';
+    BOOL resized = (count != g_account_count);
+    memcpy(g_accounts, accounts, count * sizeof(*accounts));
+    g_account_count = count;
+
+    if (!g_popup)
+        return;
+    /* A different number of lines changes the window height */
+    if (resized)
+        SetWindowPos(g_popup, NULL, 0, 0, scale_for_dpi(POPUP_WIDTH_BASE),
+                     popup_height(), SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE);
+    render_surface();
+}
+
+HDC popup_render_offscreen(const UsageData *usage)
+{
+    g_popup_data = *usage;
+    set_updated(usage);
+    render_surface();
+    return g_surface.dc;
+}
+
+void popup_update(const UsageData *usage)
+{
+    if (!g_popup)
+        return;  /* popup_show() picks up the latest data */
+    g_popup_data = *usage;
+    set_updated(usage);
+    render_surface();
 }
 
 void popup_show(HINSTANCE hInstance, const UsageData *usage)
 {
     g_popup_data = *usage;
+    set_updated(usage);
 
     if (g_popup) {
-        InvalidateRect(g_popup, NULL, TRUE);
+        render_surface();
         SetForegroundWindow(g_popup);
         SetFocus(g_popup);
         return;
     }
 
+    idle_leave();
+    /* Registered on the first click rather than at login */
+    popup_register(hInstance);
+
     /* Get DPI for the monitor where cursor is (for multi-monitor setups).
      * We query DPI before creating the window to size it correctly. */
     POINT pt;
@@ -352,13 +907,16 @@ void popup_show(HINSTANCE hInstance, const UsageData *usage)
     }
     if (g_dpi == 0) g_dpi = 96;  /* Fallback */
 
+    /* Render before the window exists, so the first WM_PAINT is a blit */
+    render_surface();
+
     /* Calculate DPI-scaled dimensions */
     int popup_width = scale_for_dpi(POPUP_WIDTH_BASE);
-    int popup_height = scale_for_dpi(POPUP_HEIGHT_BASE);
+    int height = popup_height();
 
     /* Position above cursor (near tray area) */
     int x = pt.x - popup_width / 2;
-    int y = pt.y - popup_height - scale_for_dpi(8);
+    int y = pt.y - height - scale_for_dpi(8);
 
     /* Clamp to screen */
     RECT workArea;
@@ -371,9 +929,10 @@ void popup_show(HINSTANCE hInstance, const UsageData *usage)
         WS_EX_TOPMOST | WS_EX_TOOLWINDOW,
         POPUP_CLASS, NULL,
         WS_POPUP | WS_BORDER,
-        x, y, popup_width, popup_height,
+        x, y, popup_width, height,
         NULL, NULL, hInstance, NULL);
 
+    SetTimer(g_popup, IDT_POPUP_COUNTDOWN, POPUP_COUNTDOWN_MS, NULL);
     ShowWindow(g_popup, SW_SHOW);
     SetForegroundWindow(g_popup);
     SetFocus(g_popup);
@@ -3,15 +3,45 @@
 
 #include <windows.h>
 #include "api.h"
+#include "config.h"
+#include "history.h"
 
-/* Register the popup window class. Call once at startup. */
+/* Another configured account, listed below the main one */
+typedef struct {
+    wchar_t   name[MAX_ACCOUNT_NAME];
+    UsageData usage;
+} PopupAccount;
+
+/* Register the popup window class and build its brushes. popup_show()
+   does this on first use; calling it again is a no-op. */
 void popup_register(HINSTANCE hInstance);
 
+/* Draw 24h / 7-day trend charts from 'history' (NULL: none) for
+   'account' (see HistoryRecord). The ring must stay open until this is
+   called again or popup_shutdown(). */
+void popup_set_history(const HistoryRing *history, WORD account);
+
+/* Set the main account's name (NULL or "" for none) and the other
+   accounts to list; repaints if visible. 'count' <= MAX_ACCOUNTS - 1. */
+void popup_set_accounts(const wchar_t *main_name,
+                        const PopupAccount *accounts, int count);
+
 /* Show the detail popup near the tray icon.
    If already visible, brings to foreground and repaints. */
 void popup_show(HINSTANCE hInstance, const UsageData *usage);
 
+/* Refresh the popup with new data if it is visible; otherwise a no-op. */
+void popup_update(const UsageData *usage);
+
 /* Hide and destroy the popup if visible. */
 void popup_hide(void);
 
+/* Render 'usage' into the popup's off-screen surface without showing a
+   window, and return the surface DC (valid until the next call or
+   popup_shutdown()). For benchmarks; requires popup_register(). */
+HDC popup_render_offscreen(const UsageData *usage);
+
+/* Hide the popup and free its cached GDI objects. Call once at exit. */
+void popup_shutdown(void);
+
 #endif
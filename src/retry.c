@@ -0,0 +1,83 @@
+#include "retry.h"
+
+/* Backoff: 2s, 4s, 8s, ... capped at 5 minutes, at most 6 retries in a row.
+ * After that the regular poll schedule takes over until a fetch succeeds. */
+#define RETRY_BASE_MS      2000
+#define RETRY_CAP_MS       (5 * 60 * 1000)
+#define RETRY_MAX_ATTEMPTS 6
+/* Don't let a hostile or broken Retry-After park us for days */
+#define RETRY_AFTER_MAX_SEC (60 * 60)
+
+static DWORD next_random(RetryPolicy *r)
+{
+    /* xorshift32: plenty for jitter, and no shared CRT rand() state */
+    DWORD x = r->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    r->seed = x;
+    return x;
+}
+
+void retry_init(RetryPolicy *r)
+{
+    LARGE_INTEGER qpc;
+    QueryPerformanceCounter(&qpc);
+    r->attempts = 0;
+    /* Different on every machine and every start, so clients don't agree */
+    r->seed = qpc.LowPart ^ GetCurrentProcessId() ^ GetTickCount();
+    if (r->seed == 0)
+        r->seed = 0x9E3779B9u;
+}
+
+void retry_reset(RetryPolicy *r)
+{
+    r->attempts = 0;
+}
+
+/* Pick the retry delay.
+ *
+ * Why "equal jitter" (half fixed, half random) instead of a fixed backoff:
+ * - When a whole office comes back online at once, every client fails at
+ *   the same moment; with a deterministic backoff they also retry at the
+ *   same moments, hammering the endpoint in lockstep
+ * - Randomizing the upper half spreads retries across the window, while
+ *   the fixed lower half still guarantees the delay actually grows
+ *
+ * Why honor Retry-After:
+ * - A 429/503 with Retry-After is the server telling us exactly when it
+ *   will accept us again; retrying sooner just earns another 429
+ * - We still add jitter on top, since every client got the same value
+ */
+int retry_after_sec(const UsageData *result)
+{
+    int sec = result->retry_after_sec;
+    if (sec <= 0)
+        return 0;
+    return sec > RETRY_AFTER_MAX_SEC ? RETRY_AFTER_MAX_SEC : sec;
+}
+
+DWORD retry_next_delay_ms(RetryPolicy *r, const UsageData *result)
+{
+    if (result->valid || !result->retryable)
+        return 0;
+    if (r->attempts >= RETRY_MAX_ATTEMPTS)
+        return 0;
+
+    DWORD backoff = RETRY_BASE_MS << r->attempts;
+    if (backoff > RETRY_CAP_MS)
+        backoff = RETRY_CAP_MS;
+    r->attempts++;
+
+    DWORD half = backoff / 2;
+    DWORD delay = half + next_random(r) % (half + 1);
+
+    int sec = retry_after_sec(result);
+    if (sec > 0) {
+        DWORD server = (DWORD)sec * 1000;
+        /* Up to 10% on top of the server's value */
+        if (delay < server)
+            delay = server + next_random(r) % (server / 10 + 1);
+    }
+    return delay;
+}
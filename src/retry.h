@@ -0,0 +1,27 @@
+#ifndef RETRY_H
+#define RETRY_H
+
+#include <windows.h>
+#include "api.h"
+
+/* Retry state for transient fetch failures (one per polled account). */
+typedef struct {
+    int   attempts;  /* Consecutive transient failures, 0 when healthy */
+    DWORD seed;      /* Jitter PRNG state */
+} RetryPolicy;
+
+void retry_init(RetryPolicy *r);
+
+/* Forget past failures after a successful fetch. */
+void retry_reset(RetryPolicy *r);
+
+/* Decide how long to wait before retrying a failed fetch.
+   Returns the delay in milliseconds, or 0 if 'result' is not a transient
+   failure or the retry budget is used up (fall back to the normal poll). */
+DWORD retry_next_delay_ms(RetryPolicy *r, const UsageData *result);
+
+/* The server's Retry-After in seconds, capped at RETRY_AFTER_MAX_SEC;
+   0 if none. Use this wherever retry_after_sec turns into a delay. */
+int retry_after_sec(const UsageData *result);
+
+#endif
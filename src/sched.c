@@ -0,0 +1,118 @@
+#include "sched.h"
+#include "util.h"
+
+/* Icon thresholds (see update_tray_icon() in main.c) and how close to one
+ * counts as "near": within this many points we poll at the fastest rate. */
+#define SCHED_NEAR_THRESHOLD  5.0
+/* Below this, usage is low and a slower poll loses nothing */
+#define SCHED_LOW_UTIL        50.0
+/* Poll this long after a window resets, so the server has rolled over */
+#define SCHED_RESET_GRACE_SEC 5
+
+void sched_init(Scheduler *s)
+{
+    s->last_util = -1.0;
+    s->unchanged_polls = 0;
+    s->locked = FALSE;
+    s->display_off = FALSE;
+    s->on_battery = FALSE;
+    s->battery_saver = FALSE;
+    s->offline = FALSE;
+}
+
+static double next_threshold(double util)
+{
+    if (util < 80.0) return 80.0;
+    if (util < 95.0) return 95.0;
+    return 100.0;
+}
+
+/* Pull 'delay' in so the poll lands just after a window reset */
+static int snap_to_reset(int delay, const char *resets_iso, LONGLONG now)
+{
+    LONGLONG reset;
+    if (!util_iso8601_to_unix(resets_iso, &reset))
+        return delay;
+    LONGLONG until = reset - now + SCHED_RESET_GRACE_SEC;
+    if (until > 0 && until < delay)
+        return (int)until;
+    return delay;
+}
+
+/* Pick the next poll delay.
+ *
+ * Why adapt instead of a fixed interval:
+ * - At 2% utilization with hours until reset, polling every 5 minutes
+ *   mostly fetches identical numbers
+ * - Near the 80%/95% icon thresholds, a stale number is the difference
+ *   between a warning and a surprise; that's when freshness matters
+ * - A window reset is a known moment when the numbers are guaranteed to
+ *   change, so we schedule a poll right after it rather than waiting out
+ *   an interval
+ *
+ * The rules, in order:
+ * 1. Failed poll: base interval (retry policy is handled separately),
+ *    or max interval under rule 5 - offline, the fetch itself fails
+ * 2. Within SCHED_NEAR_THRESHOLD of 80/95/100%: min interval
+ * 3. Otherwise base interval, doubled when utilization is low, and doubled
+ *    again for every consecutive poll that saw no change (idle backoff)
+ * 4. On battery: doubled; battery saver: doubled twice more
+ * 5. Locked session or display off: max interval - nobody is looking;
+ *    offline (a hint from netwatch): max interval as well
+ * 6. Clamp to [min, max]
+ * 7. Snap to just after the next five-hour / seven-day reset if sooner
+ */
+int sched_next_poll_sec(Scheduler *s, const AppConfig *cfg,
+                        const UsageData *usage, LONGLONG now)
+{
+    int base = cfg->api_poll_interval_sec;
+    if (!cfg->adaptive_polling)
+        return base;
+
+    int min = cfg->min_poll_interval_sec;
+    int max = cfg->max_poll_interval_sec;
+    if (min > base) min = base;
+    if (max < base) max = base;
+
+    BOOL away = s->locked || s->display_off || s->offline;
+    if (!usage->valid)
+        return away ? max : base;
+
+    double util = usage->five_hour_util;
+    if (usage->seven_day_util > util)
+        util = usage->seven_day_util;
+
+    if (util == s->last_util)
+        s->unchanged_polls++;
+    else
+        s->unchanged_polls = 0;
+    s->last_util = util;
+
+    int delay;
+    if (util >= 0 && util < 100.0 &&
+        next_threshold(util) - util <= SCHED_NEAR_THRESHOLD) {
+        delay = min;
+    } else if (util >= 100.0) {
+        delay = max;  /* Capped: nothing changes until the reset */
+    } else {
+        delay = base;
+        if (util < SCHED_LOW_UTIL)
+            delay *= 2;
+        for (int i = 0; i < s->unchanged_polls && delay < max; i++)
+            delay *= 2;
+    }
+
+    if (s->on_battery)
+        delay *= 2;
+    if (s->battery_saver)
+        delay *= 4;
+    if (away)
+        delay = max;
+    if (delay < min) delay = min;
+    if (delay > max) delay = max;
+
+    /* A reset is a one-off, so it may undercut the min interval */
+    delay = snap_to_reset(delay, usage->five_hour_resets, now);
+    delay = snap_to_reset(delay, usage->seven_day_resets, now);
+    return delay;
+}
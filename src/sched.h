@@ -0,0 +1,26 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <windows.h>
+#include "api.h"
+#include "config.h"
+
+/* Adaptive poll scheduler state (one per polled account). */
+typedef struct {
+    double last_util;        /* Max utilization seen at the previous poll */
+    int    unchanged_polls;  /* Consecutive polls with no change */
+    BOOL   locked;           /* Session locked (nobody is looking) */
+    BOOL   display_off;      /* Console display off, or connected standby */
+    BOOL   on_battery;       /* Running on DC power */
+    BOOL   battery_saver;    /* Windows battery saver is on */
+    BOOL   offline;          /* netwatch sees no route out (a hint, see main.c) */
+} Scheduler;
+
+void sched_init(Scheduler *s);
+
+/* Decide how many seconds to wait before the next poll, given the result
+   of the one that just finished. Call once per completed poll. */
+int sched_next_poll_sec(Scheduler *s, const AppConfig *cfg,
+                        const UsageData *usage, LONGLONG now);
+
+#endif
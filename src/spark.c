@@ -0,0 +1,236 @@
+#include "spark.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* COLORREF is 0x00BBGGRR; a 32bpp BI_RGB pixel is 0x00RRGGBB */
+static DWORD to_pixel(COLORREF c)
+{
+    return ((DWORD)GetRValue(c) << 16) | ((DWORD)GetGValue(c) << 8) |
+           GetBValue(c);
+}
+
+static WORD record_value(const Sparkline *s, const HistoryRecord *r)
+{
+    return s->field == SPARK_FIVE_HOUR ? r->five_hour_util : r->seven_day_util;
+}
+
+void spark_init(Sparkline *s, SparkField field, DWORD span_sec,
+                COLORREF bg, SparkColorFunc color)
+{
+    memset(s, 0, sizeof(*s));
+    s->field    = field;
+    s->span_sec = span_sec;
+    s->bg       = bg;
+    s->color    = color;
+}
+
+void spark_free_bitmap(Sparkline *s)
+{
+    if (s->dc) {
+        SelectObject(s->dc, s->old_bmp);
+        DeleteObject(s->bmp);
+        DeleteDC(s->dc);
+    }
+    s->dc = NULL;
+    s->bmp = NULL;
+    s->old_bmp = NULL;
+    s->bits = NULL;
+}
+
+void spark_free(Sparkline *s)
+{
+    spark_free_bitmap(s);
+    free(s->col_val);
+    s->col_val = NULL;
+    s->width = s->height = 0;
+}
+
+static BOOL create_bitmap(Sparkline *s, int width, int height)
+{
+    BITMAPINFO bmi;
+    memset(&bmi, 0, sizeof(bmi));
+    bmi.bmiHeader.biSize        = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth       = width;
+    bmi.bmiHeader.biHeight      = -height;  /* Top-down */
+    bmi.bmiHeader.biPlanes      = 1;
+    bmi.bmiHeader.biBitCount    = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    HDC screen = GetDC(NULL);
+    s->dc = CreateCompatibleDC(screen);
+    ReleaseDC(NULL, screen);
+    if (!s->dc)
+        goto fail;
+
+    void *bits;
+    s->bmp = CreateDIBSection(s->dc, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+    if (!s->bmp)
+        goto fail;
+    s->old_bmp = SelectObject(s->dc, s->bmp);
+    s->bits = (DWORD *)bits;
+    return TRUE;
+
+fail:
+    if (s->dc)
+        DeleteDC(s->dc);
+    s->dc = NULL;
+    s->bmp = NULL;
+    s->old_bmp = NULL;
+    s->bits = NULL;
+    return FALSE;
+}
+
+/* Repaint one column from col_val[] */
+static void draw_column(Sparkline *s, int col)
+{
+    WORD v = s->col_val[col];
+    DWORD bg = to_pixel(s->bg);
+    DWORD fg = bg;
+    int filled = 0;
+
+    if (v != HISTORY_NO_VALUE) {
+        double util = history_util(v);
+        fg = to_pixel(s->color(util));
+        filled = (int)((util * s->height + 50.0) / 100.0);
+        if (filled > s->height) filled = s->height;
+        if (filled < 1) filled = 1;  /* Sampled, even at 0% */
+    }
+
+    int first = s->height - filled;
+    for (int row = 0; row < s->height; row++)
+        s->bits[row * s->width + col] = row >= first ? fg : bg;
+}
+
+static void clear_columns(Sparkline *s, int from, int to)
+{
+    for (int col = from; col < to; col++) {
+        s->col_val[col] = HISTORY_NO_VALUE;
+        draw_column(s, col);
+    }
+}
+
+/* Move the chart left so the rightmost column is bucket 'bucket' */
+static void advance_to(Sparkline *s, LONGLONG bucket)
+{
+    if (bucket <= s->last_bucket)
+        return;
+
+    LONGLONG shift = bucket - s->last_bucket;
+    s->last_bucket = bucket;
+    s->version++;
+
+    if (shift >= s->width) {
+        clear_columns(s, 0, s->width);
+        return;
+    }
+
+    int n = (int)shift;
+    int keep = s->width - n;
+    for (int row = 0; row < s->height; row++) {
+        DWORD *line = s->bits + row * s->width;
+        memmove(line, line + n, keep * sizeof(DWORD));
+    }
+    memmove(s->col_val, s->col_val + n, keep * sizeof(WORD));
+    clear_columns(s, keep, s->width);
+}
+
+static void plot_sample(Sparkline *s, DWORD timestamp, WORD value)
+{
+    if (value == HISTORY_NO_VALUE)
+        return;
+
+    LONGLONG bucket = timestamp / s->bucket_sec;
+    advance_to(s, bucket);  /* Ahead of "now": the clock went back */
+
+    LONGLONG col = s->width - 1 - (s->last_bucket - bucket);
+    if (col < 0)
+        return;  /* Older than the span */
+
+    /* A bucket shows the peak of its samples */
+    WORD *slot = &s->col_val[col];
+    if (*slot != HISTORY_NO_VALUE && *slot >= value)
+        return;
+    *slot = value;
+    draw_column(s, (int)col);
+    s->version++;
+}
+
+/* Why incremental:
+ * - A week of one-minute polls is ~10000 samples. Re-plotting them on
+ *   every popup paint would cost more than the rest of the popup
+ *   together, so the chart lives in its own bitmap and is only touched
+ *   where it changes
+ * - Time passing shifts the pixel rows left (a memmove per row) and
+ *   clears the new columns; a new sample repaints the one column it
+ *   falls in. Neither touches the ring beyond the samples not yet seen
+ * - Pixels are written straight into the DIB, so plotting makes no GDI
+ *   calls; the popup copies the finished chart with one BitBlt
+ * - The full scan of the span only happens on first use, after a DPI
+ *   change (new width) and when the account changes. A dismissed popup
+ *   frees only the DIB (spark_free_bitmap()); col_val[] and the cursor
+ *   stay, so reopening repaints the columns without reading the ring
+ */
+BOOL spark_sync(Sparkline *s, const HistoryRing *h, WORD account,
+                int width, int height, LONGLONG now)
+{
+    DWORD before = s->version;
+    BOOL rebuild = !s->col_val || s->width != width || s->height != height ||
+                   s->account != account;
+
+    if (rebuild) {
+        spark_free(s);
+        if (width <= 0 || height <= 0)
+            return FALSE;
+        s->col_val = (WORD *)malloc(width * sizeof(WORD));
+        if (!s->col_val || !create_bitmap(s, width, height)) {
+            spark_free(s);
+            return FALSE;
+        }
+        s->width = width;
+        s->height = height;
+
+        s->bucket_sec = s->span_sec / width;
+        if (s->bucket_sec == 0)
+            s->bucket_sec = 1;
+        s->last_bucket = now / s->bucket_sec;
+        s->last_ts = now > (LONGLONG)s->span_sec
+                   ? (DWORD)(now - s->span_sec) : 0;
+        s->account = account;
+        clear_columns(s, 0, width);
+        s->version++;
+    } else if (!s->dc) {
+        /* Only the pixels were freed: repaint them from col_val[] */
+        if (!create_bitmap(s, width, height))
+            return FALSE;
+        for (int col = 0; col < width; col++)
+            draw_column(s, col);
+        s->version++;
+    }
+
+    /* Pixels are written directly below; finish any pending BitBlt first */
+    GdiFlush();
+
+    advance_to(s, now / s->bucket_sec);
+
+    /* Samples newer than the last sync sit at the end of the ring */
+    DWORD n = history_count(h);
+    DWORD i = n;
+    while (i > 0 && history_at(h, i - 1)->timestamp > s->last_ts)
+        i--;
+
+    for (; i < n; i++) {
+        const HistoryRecord *r = history_at(h, i);
+        if (r->account == account)
+            plot_sample(s, r->timestamp, record_value(s, r));
+        if (r->timestamp > s->last_ts)
+            s->last_ts = r->timestamp;
+    }
+
+    return s->version != before;
+}
+
+void spark_draw(const Sparkline *s, HDC hdc, int x, int y)
+{
+    if (s->dc)
+        BitBlt(hdc, x, y, s->width, s->height, s->dc, 0, 0, SRCCOPY);
+}
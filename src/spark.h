@@ -0,0 +1,61 @@
+#ifndef SPARK_H
+#define SPARK_H
+
+#include <windows.h>
+#include "history.h"
+
+/* Which utilization a sparkline plots */
+typedef enum {
+    SPARK_FIVE_HOUR,
+    SPARK_SEVEN_DAY
+} SparkField;
+
+/* Color for a utilization percentage */
+typedef COLORREF (*SparkColorFunc)(double util);
+
+/* Cached bitmap of one utilization over a trailing time span, one column
+   per 'bucket_sec' seconds, newest on the right. */
+typedef struct {
+    SparkField     field;
+    DWORD          span_sec;     /* Time covered by the full width */
+    COLORREF       bg;
+    SparkColorFunc color;
+
+    HDC            dc;
+    HBITMAP        bmp;
+    HGDIOBJ        old_bmp;
+    DWORD         *bits;         /* Top-down 32bpp pixels */
+    int            width;
+    int            height;
+    WORD          *col_val;      /* Per-column max, hundredths or HISTORY_NO_VALUE */
+
+    DWORD          bucket_sec;
+    LONGLONG       last_bucket;  /* Bucket shown in the rightmost column */
+    DWORD          last_ts;      /* Newest sample already plotted */
+    WORD           account;      /* Account the columns belong to */
+    DWORD          version;      /* Bumped whenever a pixel changes */
+} Sparkline;
+
+/* Set up an empty sparkline; no GDI objects are created until spark_sync() */
+void spark_init(Sparkline *s, SparkField field, DWORD span_sec,
+                COLORREF bg, SparkColorFunc color);
+
+/* Bring the bitmap up to 'now' (Unix seconds) for a width x height chart
+   of 'account' (see HistoryRecord.account). Only samples newer than the
+   last call are plotted; a size or account change rebuilds from the ring.
+   Returns TRUE if the image changed. */
+BOOL spark_sync(Sparkline *s, const HistoryRing *h, WORD account,
+                int width, int height, LONGLONG now);
+
+/* Copy the chart to (x, y) on 'hdc'. No-op if it was never synced. */
+void spark_draw(const Sparkline *s, HDC hdc, int x, int y);
+
+/* Free the bitmap but keep the plotted values and the cursor; the next
+   spark_sync() repaints from them instead of rescanning the ring. */
+void spark_free_bitmap(Sparkline *s);
+
+/* Free the bitmap and the plotted values. The sparkline may be synced
+   again afterwards. */
+void spark_free(Sparkline *s);
+
+#endif
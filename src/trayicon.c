@@ -0,0 +1,197 @@
+#include "trayicon.h"
+#include <string.h>
+
+/* Colors match gen_icon.py's static set (background, text) */
+#define CLR_GREEN_BG   RGB(34, 139, 34)
+#define CLR_YELLOW_BG  RGB(218, 165, 32)
+#define CLR_RED_BG     RGB(200, 40, 40)
+#define CLR_LIGHT_TEXT RGB(255, 255, 255)
+#define CLR_DARK_TEXT  RGB(0, 0, 0)
+
+#define TRAYICON_VALUES   101  /* 0..100 */
+#define TRAYICON_MAX_SIZE 256
+
+/* Every percentage glyph, pre-rendered side by side in one DIB.
+ *
+ * Why an atlas:
+ * - All 101 glyphs are drawn in one pass with one font per size, so
+ *   font mapping runs once per icon size instead of once per change
+ * - Turning a glyph into an HICON is then a row copy plus
+ *   CreateIconIndirect, and the HICON is cached too, so a repeated
+ *   percentage costs nothing
+ * - The atlas is keyed by the small-icon size (which follows the DPI);
+ *   when it changes everything is rebuilt at the new size
+ */
+typedef struct {
+    int      size;        /* Cell width and height in pixels, 0 if not built */
+    HBITMAP  bmp;
+    DWORD   *bits;        /* size*TRAYICON_VALUES x size, top-down BGRA */
+    HICON    icons[TRAYICON_VALUES];
+} IconAtlas;
+
+static IconAtlas g_atlas;
+
+/* Monochrome AND mask, all zero: the 32-bit alpha channel does the work */
+static BYTE g_zero_mask[((TRAYICON_MAX_SIZE + 15) / 16) * 2 * TRAYICON_MAX_SIZE];
+
+static void free_atlas(void)
+{
+    for (int i = 0; i < TRAYICON_VALUES; i++) {
+        if (g_atlas.icons[i])
+            DestroyIcon(g_atlas.icons[i]);
+    }
+    if (g_atlas.bmp)
+        DeleteObject(g_atlas.bmp);
+    memset(&g_atlas, 0, sizeof(g_atlas));
+}
+
+static HBITMAP create_dib(int width, int height, DWORD **bits)
+{
+    BITMAPINFO bmi;
+    memset(&bmi, 0, sizeof(bmi));
+    bmi.bmiHeader.biSize        = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth       = width;
+    bmi.bmiHeader.biHeight      = -height;  /* Top-down */
+    bmi.bmiHeader.biPlanes      = 1;
+    bmi.bmiHeader.biBitCount    = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    return CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, (void **)bits, NULL, 0);
+}
+
+static HFONT create_glyph_font(int height)
+{
+    return CreateFontW(-height, 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE,
+        DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
+        NONANTIALIASED_QUALITY, DEFAULT_PITCH | FF_SWISS, L"Segoe UI");
+}
+
+/* Same thresholds as the static IDI_GREEN/YELLOW/RED icons */
+static void glyph_colors(int percent, COLORREF *bg, COLORREF *fg)
+{
+    if (percent >= 95) {
+        *bg = CLR_RED_BG;    *fg = CLR_LIGHT_TEXT;
+    } else if (percent >= 80) {
+        *bg = CLR_YELLOW_BG; *fg = CLR_DARK_TEXT;
+    } else {
+        *bg = CLR_GREEN_BG;  *fg = CLR_LIGHT_TEXT;
+    }
+}
+
+/* Draw all percentages into a fresh atlas of 'size' pixel cells */
+static BOOL build_atlas(int size)
+{
+    free_atlas();
+
+    DWORD *bits;
+    HBITMAP bmp = create_dib(size * TRAYICON_VALUES, size, &bits);
+    if (!bmp)
+        return FALSE;
+
+    HDC dc = CreateCompatibleDC(NULL);
+    if (!dc) {
+        DeleteObject(bmp);
+        return FALSE;
+    }
+    HGDIOBJ old_bmp = SelectObject(dc, bmp);
+
+    /* Two digits fill the cell; "100" needs a narrower font to fit */
+    HFONT two_digit = create_glyph_font(size * 3 / 4);
+    HFONT three_digit = create_glyph_font(size / 2);
+    HGDIOBJ old_font = SelectObject(dc, two_digit);
+    SetBkMode(dc, TRANSPARENT);
+
+    for (int p = 0; p < TRAYICON_VALUES; p++) {
+        COLORREF bg, fg;
+        glyph_colors(p, &bg, &fg);
+
+        RECT cell = {p * size, 0, (p + 1) * size, size};
+        HBRUSH brush = CreateSolidBrush(bg);
+        FillRect(dc, &cell, brush);
+        DeleteObject(brush);
+
+        wchar_t text[4];
+        _snwprintf(text, 4, L"%d", p);
+        text[3] = L'\0';
+        SelectObject(dc, p == 100 ? three_digit : two_digit);
+        SetTextColor(dc, fg);
+        DrawTextW(dc, text, -1, &cell,
+                  DT_CENTER | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX);
+    }
+
+    SelectObject(dc, old_font);
+    DeleteObject(two_digit);
+    DeleteObject(three_digit);
+    SelectObject(dc, old_bmp);
+    DeleteDC(dc);
+    GdiFlush();
+
+    /* GDI leaves alpha at 0: make the cells opaque, with the corner
+     * pixels clear so the square reads as slightly rounded */
+    int width = size * TRAYICON_VALUES;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < width; x++) {
+            int cx = x % size;
+            BOOL corner = (y == 0 || y == size - 1) &&
+                          (cx == 0 || cx == size - 1);
+            DWORD *px = &bits[y * width + x];
+            *px = corner ? 0 : (*px | 0xFF000000u);
+        }
+    }
+
+    g_atlas.size = size;
+    g_atlas.bmp = bmp;
+    g_atlas.bits = bits;
+    return TRUE;
+}
+
+/* Cut one cell out of the atlas as an HICON */
+static HICON icon_from_atlas(int percent)
+{
+    int size = g_atlas.size;
+    DWORD *bits;
+    HBITMAP color = create_dib(size, size, &bits);
+    if (!color)
+        return NULL;
+
+    int stride = size * TRAYICON_VALUES;
+    for (int y = 0; y < size; y++)
+        memcpy(&bits[y * size], &g_atlas.bits[y * stride + percent * size],
+               size * sizeof(DWORD));
+
+    HBITMAP mask = CreateBitmap(size, size, 1, 1, g_zero_mask);
+    HICON icon = NULL;
+    if (mask) {
+        ICONINFO ii;
+        memset(&ii, 0, sizeof(ii));
+        ii.fIcon    = TRUE;
+        ii.hbmMask  = mask;
+        ii.hbmColor = color;
+        icon = CreateIconIndirect(&ii);
+        DeleteObject(mask);
+    }
+    DeleteObject(color);
+    return icon;
+}
+
+HICON trayicon_get(int percent)
+{
+    if (percent < 0) percent = 0;
+    if (percent > 100) percent = 100;
+
+    /* Follows the system DPI for this DPI-aware process */
+    int size = GetSystemMetrics(SM_CXSMICON);
+    if (size <= 0 || size > TRAYICON_MAX_SIZE)
+        return NULL;
+
+    if (g_atlas.size != size && !build_atlas(size))
+        return NULL;
+
+    if (!g_atlas.icons[percent])
+        g_atlas.icons[percent] = icon_from_atlas(percent);
+    return g_atlas.icons[percent];
+}
+
+void trayicon_shutdown(void)
+{
+    free_atlas();
+}
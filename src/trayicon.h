@@ -0,0 +1,15 @@
+#ifndef TRAYICON_H
+#define TRAYICON_H
+
+#include <windows.h>
+
+/* Tray icon showing 'percent' (clamped to 0-100) at the current small
+   icon size, or NULL if rendering failed. The icon is owned by the cache:
+   don't destroy it. The same percentage returns the same handle until the
+   icon size changes. */
+HICON trayicon_get(int percent);
+
+/* Free the atlas and every cached icon. Call once at exit. */
+void trayicon_shutdown(void);
+
+#endif
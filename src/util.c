@@ -33,6 +33,69 @@ BOOL util_parse_iso8601(const char *iso, SYSTEMTIME *out)
     return TRUE;
 }
 
+/* 100ns FILETIME ticks between 1601-01-01 and the Unix epoch */
+#define FILETIME_UNIX_EPOCH 116444736000000000ULL
+
+static LONGLONG filetime_to_unix(const FILETIME *ft)
+{
+    ULARGE_INTEGER ui;
+    ui.LowPart  = ft->dwLowDateTime;
+    ui.HighPart = ft->dwHighDateTime;
+    return (LONGLONG)((ui.QuadPart - FILETIME_UNIX_EPOCH) / 10000000ULL);
+}
+
+/* Unix seconds are what scheduling code wants: plain integers that can be
+ * compared and subtracted without SYSTEMTIME/FILETIME round trips. */
+LONGLONG util_unix_now(void)
+{
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    return filetime_to_unix(&ft);
+}
+
+BOOL util_iso8601_to_unix(const char *iso, LONGLONG *out)
+{
+    SYSTEMTIME st;
+    FILETIME ft;
+    if (!iso || !iso[0] || !util_parse_iso8601(iso, &st))
+        return FALSE;
+    if (!SystemTimeToFileTime(&st, &ft))
+        return FALSE;
+    *out = filetime_to_unix(&ft);
+    return TRUE;
+}
+
+BOOL util_unix_to_local(LONGLONG t, SYSTEMTIME *out)
+{
+    ULARGE_INTEGER ui;
+    FILETIME utc, local;
+
+    if (t <= 0)
+        return FALSE;
+    ui.QuadPart = (ULONGLONG)t * 10000000ULL + FILETIME_UNIX_EPOCH;
+    utc.dwLowDateTime  = ui.LowPart;
+    utc.dwHighDateTime = ui.HighPart;
+    return FileTimeToLocalFileTime(&utc, &local) &&
+           FileTimeToSystemTime(&local, out);
+}
+
+void util_unix_to_iso8601(LONGLONG t, char *buf, int len)
+{
+    ULARGE_INTEGER ui;
+    FILETIME ft;
+    SYSTEMTIME st;
+
+    ui.QuadPart = (ULONGLONG)t * 10000000ULL + FILETIME_UNIX_EPOCH;
+    ft.dwLowDateTime  = ui.LowPart;
+    ft.dwHighDateTime = ui.HighPart;
+    if (t <= 0 || !FileTimeToSystemTime(&ft, &st)) {
+        buf[0] = '\0';
+        return;
+    }
+    snprintf(buf, len, "%04d-%02d-%02dT%02d:%02d:%02d+00:00",
+             st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
+}
+
 /* Format time remaining until a future timestamp.
  *
  * Why use FILETIME for arithmetic:
@@ -72,9 +135,14 @@ void util_format_time_remaining(const SYSTEMTIME *reset, wchar_t *buf, int len)
 
     /* Convert 100ns intervals to seconds: divide by 10,000,000 */
     ULONGLONG diff_sec = (ui_reset.QuadPart - ui_now.QuadPart) / 10000000ULL;
-    int days  = (int)(diff_sec / 86400);
-    int hours = (int)((diff_sec % 86400) / 3600);
-    int mins  = (int)((diff_sec % 3600) / 60);
+    util_format_duration(diff_sec, buf, len);
+}
+
+void util_format_duration(ULONGLONG sec, wchar_t *buf, int len)
+{
+    int days  = (int)(sec / 86400);
+    int hours = (int)((sec % 86400) / 3600);
+    int mins  = (int)((sec % 3600) / 60);
 
     /* Progressive formatting: show most significant + next significant unit */
     if (days > 0)
@@ -147,3 +215,21 @@ char *util_to_narrow(const wchar_t *wide)
     }
     return s;
 }
+
+/* Hash a string with 64-bit FNV-1a.
+ *
+ * Why FNV-1a:
+ * - A dozen lines, no dependencies, and well distributed for short keys
+ * - Used only to tell tokens apart, not for security, so a cryptographic
+ *   hash would be overkill
+ */
+ULONGLONG util_hash_string(const char *s)
+{
+    ULONGLONG h = 1469598103934665603ULL;
+    if (!s) return h;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
@@ -6,13 +6,32 @@
 /* Parse an ISO 8601 timestamp like "2026-02-16T13:00:01+00:00" into SYSTEMTIME (UTC). */
 BOOL util_parse_iso8601(const char *iso, SYSTEMTIME *out);
 
+/* Current time as Unix seconds (UTC). */
+LONGLONG util_unix_now(void);
+
+/* Parse an ISO 8601 timestamp into Unix seconds (UTC). */
+BOOL util_iso8601_to_unix(const char *iso, LONGLONG *out);
+
+/* Format Unix seconds as ISO 8601 UTC ("2026-02-16T13:00:01+00:00");
+   "" for t <= 0. */
+void util_unix_to_iso8601(LONGLONG t, char *buf, int len);
+
+/* Convert Unix seconds to local time. FALSE for t <= 0. */
+BOOL util_unix_to_local(LONGLONG t, SYSTEMTIME *out);
+
 /* Format time remaining until 'reset' as e.g. "2h 14m" or "3d 12h". */
 void util_format_time_remaining(const SYSTEMTIME *reset, wchar_t *buf, int len);
 
+/* Format a duration in seconds the same way ("2h 14m", "45m"). */
+void util_format_duration(ULONGLONG sec, wchar_t *buf, int len);
+
 /* Convert narrow UTF-8 string to wide. Caller must free() the result. */
 wchar_t *util_to_wide(const char *narrow);
 
 /* Convert wide string to narrow UTF-8. Caller must free() the result. */
 char *util_to_narrow(const wchar_t *wide);
 
+/* 64-bit FNV-1a hash of a string, e.g. to key caches by token without storing it. */
+ULONGLONG util_hash_string(const char *s);
+
 #endif
@@ -0,0 +1,124 @@
+#include "watch.h"
+#include <string.h>
+#include <wchar.h>
+
+/* Issue the next asynchronous ReadDirectoryChangesW.
+ *
+ * Why these filters:
+ * - LAST_WRITE / SIZE: Claude Code rewriting the file in place
+ * - FILE_NAME: the write-to-temp-then-rename pattern, which shows up as
+ *   a rename (or create) of the target name rather than a write
+ */
+static BOOL arm(FileWatch *w)
+{
+    ResetEvent(w->event);
+    memset(&w->ov, 0, sizeof(w->ov));
+    w->ov.hEvent = w->event;
+    return ReadDirectoryChangesW(w->dir, w->buf, sizeof(w->buf), FALSE,
+                                 FILE_NOTIFY_CHANGE_FILE_NAME |
+                                 FILE_NOTIFY_CHANGE_LAST_WRITE |
+                                 FILE_NOTIFY_CHANGE_SIZE,
+                                 NULL, &w->ov, NULL);
+}
+
+/* Watch the directory containing a file.
+ *
+ * Why ReadDirectoryChangesW instead of FindFirstChangeNotificationW:
+ * - The .claude directory also holds files Claude Code writes constantly
+ *   (history, settings); FindFirstChangeNotification can't say which file
+ *   changed, so every prompt would trigger a credentials reload
+ * - ReadDirectoryChangesW reports file names, so we wake the app only for
+ *   the one file we care about
+ *
+ * Why overlapped I/O with an event:
+ * - The event can be waited on alongside the message queue, so the UI
+ *   thread needs no extra watcher thread and no polling timer
+ */
+BOOL watch_start(FileWatch *w, const wchar_t *file_path)
+{
+    memset(w, 0, sizeof(*w));
+
+    const wchar_t *slash = wcsrchr(file_path, L'\\');
+    if (!slash) slash = wcsrchr(file_path, L'/');
+    if (!slash || slash == file_path || wcslen(slash + 1) >= MAX_PATH)
+        return FALSE;
+
+    wchar_t dir[MAX_PATH];
+    size_t dir_len = (size_t)(slash - file_path);
+    if (dir_len >= MAX_PATH) return FALSE;
+    wcsncpy(dir, file_path, dir_len);
+    dir[dir_len] = L'\0';
+    wcscpy(w->file_name, slash + 1);
+
+    w->dir = CreateFileW(dir, FILE_LIST_DIRECTORY,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                         NULL, OPEN_EXISTING,
+                         FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    if (w->dir == INVALID_HANDLE_VALUE) {
+        w->dir = NULL;
+        return FALSE;
+    }
+
+    w->event = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!w->event || !arm(w)) {
+        watch_stop(w);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+HANDLE watch_handle(const FileWatch *w)
+{
+    return w->event;
+}
+
+BOOL watch_check(FileWatch *w, BOOL *changed)
+{
+    *changed = FALSE;
+    if (!w->dir) return FALSE;
+
+    DWORD bytes = 0;
+    if (!GetOverlappedResult(w->dir, &w->ov, &bytes, FALSE)) {
+        /* Directory deleted or share disconnected */
+        watch_stop(w);
+        *changed = TRUE;
+        return FALSE;
+    }
+
+    if (bytes == 0) {
+        /* Buffer overflowed: we don't know what changed, assume our file */
+        *changed = TRUE;
+    } else {
+        size_t name_len = wcslen(w->file_name);
+        const BYTE *p = (const BYTE *)w->buf;
+        for (;;) {
+            const FILE_NOTIFY_INFORMATION *fni = (const FILE_NOTIFY_INFORMATION *)p;
+            if (fni->Action != FILE_ACTION_REMOVED &&
+                fni->Action != FILE_ACTION_RENAMED_OLD_NAME &&
+                fni->FileNameLength == name_len * sizeof(wchar_t) &&
+                _wcsnicmp(fni->FileName, w->file_name, name_len) == 0)
+                *changed = TRUE;
+            if (fni->NextEntryOffset == 0) break;
+            p += fni->NextEntryOffset;
+        }
+    }
+
+    if (!arm(w)) {
+        watch_stop(w);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void watch_stop(FileWatch *w)
+{
+    if (w->dir) {
+        CancelIo(w->dir);
+        CloseHandle(w->dir);
+        w->dir = NULL;
+    }
+    if (w->event) {
+        CloseHandle(w->event);
+        w->event = NULL;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <windows.h>
+
+/* Watches a single file for changes via its parent directory. */
+typedef struct {
+    HANDLE     dir;                   /* Directory handle, NULL when inactive */
+    HANDLE     event;                 /* Signaled when a change batch is ready */
+    OVERLAPPED ov;
+    wchar_t    file_name[MAX_PATH];   /* Leaf name to filter on */
+    DWORD      buf[1024];             /* FILE_NOTIFY_INFORMATION records (DWORD-aligned) */
+} FileWatch;
+
+/* Start watching 'file_path'. Returns FALSE if the directory can't be
+   watched (caller should fall back to polling). */
+BOOL watch_start(FileWatch *w, const wchar_t *file_path);
+
+/* Handle to wait on (e.g. with MsgWaitForMultipleObjects). */
+HANDLE watch_handle(const FileWatch *w);
+
+/* Call when watch_handle() is signaled. Sets *changed if the watched file
+   was written, created or renamed into place, then re-arms the watch.
+   Returns FALSE if the watch broke and has been stopped. */
+BOOL watch_check(FileWatch *w, BOOL *changed);
+
+/* Stop watching. Safe to call on an inactive watch. */
+void watch_stop(FileWatch *w);
+
+#endif
@@ -0,0 +1,560 @@
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "api.h"
+#include "config.h"
+#include "export.h"
+#include "forecast.h"
+#include "history.h"
+#include "http.h"
+#include "retry.h"
+#include "sched.h"
+#include "util.h"
+
+/* Unit tests for the modules that decide when to poll and what to keep.
+ *
+ * Why these modules:
+ * - Retry, scheduling, forecasting and the history ring are pure logic
+ *   (or a file on disk), yet a slip in any of them only shows up as a
+ *   tray icon that polls too often, goes quiet for an hour, or exports
+ *   the same samples twice; none of that is visible in a quick manual run
+ * - They are tested through their public headers, linked from the same
+ *   sources as the app, so a test can't pass against a private copy
+ *
+ * Why stub http.c instead of linking it:
+ * - export.c only needs http_post_async() to hand its batch over; the
+ *   stubs below capture the body, and the test plays the completion
+ *   through export_on_done() the way the UI thread does
+ */
+
+static int g_checks;
+static int g_failures;
+
+#define CHECK(cond) do {                                                 \
+        g_checks++;                                                      \
+        if (!(cond)) {                                                   \
+            g_failures++;                                                \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        }                                                                \
+    } while (0)
+
+/* ---- http.c stubs for export.c ---- */
+
+static char g_posted[65536 + 1];
+static DWORD g_posted_len;
+static int g_posts;
+static int g_fake_request;
+
+HttpRequest *http_post_async(const wchar_t *host, INTERNET_PORT port,
+                             const wchar_t *url_path, const wchar_t *headers,
+                             const void *body, DWORD body_len,
+                             HttpCompletion done, void *ctx)
+{
+    (void)host; (void)port; (void)url_path; (void)headers;
+    (void)done; (void)ctx;
+    g_posts++;
+    g_posted_len = body_len < sizeof(g_posted) - 1 ? body_len : sizeof(g_posted) - 1;
+    memcpy(g_posted, body, g_posted_len);
+    g_posted[g_posted_len] = '\0';
+    return (HttpRequest *)&g_fake_request;
+}
+
+void http_release(HttpRequest *req)
+{
+    (void)req;
+}
+
+void http_cancel(HttpRequest *req)
+{
+    (void)req;
+}
+
+/* ---- Helpers ---- */
+
+static UsageData make_usage(double five_hour, double seven_day)
+{
+    UsageData u;
+    memset(&u, 0, sizeof(u));
+    u.five_hour_util = five_hour;
+    u.seven_day_util = seven_day;
+    u.opus_util = -1.0;
+    u.sonnet_util = -1.0;
+    u.valid = TRUE;
+    return u;
+}
+
+static UsageData make_failure(BOOL retryable, int retry_after)
+{
+    UsageData u;
+    memset(&u, 0, sizeof(u));
+    u.retryable = retryable;
+    u.retry_after_sec = retry_after;
+    return u;
+}
+
+/* A fresh, empty history file in %TEMP%; FALSE if none could be made */
+static BOOL open_temp_ring(HistoryRing *h, wchar_t *path)
+{
+    wchar_t dir[MAX_PATH];
+    if (!GetTempPathW(MAX_PATH, dir) ||
+        !GetTempFileNameW(dir, L"cut", 0, path))
+        return FALSE;
+    return history_open(h, path);
+}
+
+static int count_lines(const char *body)
+{
+    int n = 0;
+    for (const char *c = body; *c; c++)
+        n += (*c == '\n');
+    return n;
+}
+
+#define NOW 1700000000LL
+
+/* ---- retry.c ---- */
+
+static void test_retry_backoff(void)
+{
+    RetryPolicy r;
+    retry_init(&r);
+
+    UsageData ok = make_usage(10.0, 5.0);
+    UsageData fatal = make_failure(FALSE, 0);
+    UsageData transient = make_failure(TRUE, 0);
+    CHECK(retry_next_delay_ms(&r, &ok) == 0);
+    CHECK(retry_next_delay_ms(&r, &fatal) == 0);
+
+    /* Equal jitter: between half and all of 2s, 4s, 8s, ... */
+    DWORD backoff = 2000;
+    for (int i = 0; i < 6; i++) {
+        DWORD d = retry_next_delay_ms(&r, &transient);
+        CHECK(d >= backoff / 2 && d <= backoff);
+        backoff *= 2;
+    }
+    /* Budget used up: the regular poll takes over */
+    CHECK(retry_next_delay_ms(&r, &transient) == 0);
+
+    retry_reset(&r);
+    DWORD d = retry_next_delay_ms(&r, &transient);
+    CHECK(d >= 1000 && d <= 2000);
+}
+
+static void test_retry_after(void)
+{
+    RetryPolicy r;
+    retry_init(&r);
+
+    /* The server's value, plus up to 10% */
+    UsageData limited = make_failure(TRUE, 30);
+    DWORD d = retry_next_delay_ms(&r, &limited);
+    CHECK(d >= 30000 && d <= 33000);
+
+    /* A week-long Retry-After is capped at an hour */
+    UsageData hostile = make_failure(TRUE, 7 * 24 * 3600);
+    CHECK(retry_after_sec(&hostile) == 3600);
+    retry_reset(&r);
+    d = retry_next_delay_ms(&r, &hostile);
+    CHECK(d >= 3600000 && d <= 3960000);
+
+    UsageData negative = make_failure(TRUE, -5);
+    CHECK(retry_after_sec(&negative) == 0);
+    UsageData none = make_failure(TRUE, 0);
+    CHECK(retry_after_sec(&none) == 0);
+}
+
+/* ---- sched.c ---- */
+
+static AppConfig sched_config(void)
+{
+    AppConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.api_poll_interval_sec = 300;
+    cfg.adaptive_polling = TRUE;
+    cfg.min_poll_interval_sec = 60;
+    cfg.max_poll_interval_sec = 1800;
+    return cfg;
+}
+
+static void test_sched_rules(void)
+{
+    AppConfig cfg = sched_config();
+    Scheduler s;
+    UsageData u;
+
+    /* Fixed interval when adaptive polling is off, and after a failure */
+    cfg.adaptive_polling = FALSE;
+    sched_init(&s);
+    u = make_usage(90.0, 10.0);
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 300);
+    cfg.adaptive_polling = TRUE;
+    u = make_failure(TRUE, 0);
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 300);
+
+    /* Near a threshold: fastest rate; at 100%: slowest */
+    sched_init(&s);
+    u = make_usage(77.0, 10.0);
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 60);
+    sched_init(&s);
+    u = make_usage(10.0, 100.0);
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 1800);
+
+    /* Low usage doubles the base interval */
+    sched_init(&s);
+    u = make_usage(10.0, 20.0);
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 600);
+
+    /* Power state */
+    sched_init(&s);
+    s.on_battery = TRUE;
+    u = make_usage(60.0, 10.0);
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 600);
+    sched_init(&s);
+    s.battery_saver = TRUE;
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 1200);
+
+    /* Nobody looking, or no route out: max interval */
+    sched_init(&s);
+    s.locked = TRUE;
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 1800);
+    sched_init(&s);
+    s.offline = TRUE;
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 1800);
+
+    /* Offline the fetch itself fails: still the max, not the base */
+    u = make_failure(TRUE, 0);
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 1800);
+    sched_init(&s);
+    s.locked = TRUE;
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 1800);
+}
+
+static void test_sched_idle_backoff(void)
+{
+    AppConfig cfg = sched_config();
+    Scheduler s;
+    sched_init(&s);
+
+    /* Unchanged numbers double the delay each poll, up to the max */
+    UsageData u = make_usage(60.0, 10.0);
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 300);
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 600);
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 1200);
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 1800);
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 1800);
+
+    /* A change starts over */
+    u.five_hour_util = 61.0;
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 300);
+}
+
+static void test_sched_reset_snap(void)
+{
+    AppConfig cfg = sched_config();
+    Scheduler s;
+    sched_init(&s);
+
+    /* A reset 30s out pulls the poll in to just after it, even below
+     * the min interval */
+    UsageData u = make_usage(60.0, 10.0);
+    util_unix_to_iso8601(NOW + 30, u.five_hour_resets, sizeof(u.five_hour_resets));
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 35);
+
+    /* One already past is ignored */
+    sched_init(&s);
+    util_unix_to_iso8601(NOW - 600, u.five_hour_resets, sizeof(u.five_hour_resets));
+    CHECK(sched_next_poll_sec(&s, &cfg, &u, NOW) == 300);
+}
+
+/* ---- forecast.c ---- */
+
+static void test_forecast_rate(void)
+{
+    Forecast f;
+    forecast_init(&f);
+
+    /* One sample: no rate yet */
+    UsageData u = make_usage(10.0, 5.0);
+    forecast_update(&f, &u, NOW);
+    CHECK(u.five_hour_limit_sec == 0);
+
+    /* 10 points in 10 minutes: the other 80 take 80 minutes */
+    u = make_usage(20.0, 5.0);
+    forecast_update(&f, &u, NOW + 600);
+    CHECK(u.five_hour_limit_sec >= 4799 && u.five_hour_limit_sec <= 4801);
+    CHECK(u.seven_day_limit_sec == 0);  /* Flat: never */
+
+    /* The estimate counts down without a new sample */
+    forecast_estimate(&f, &u, NOW + 1600);
+    CHECK(u.five_hour_limit_sec >= 3799 && u.five_hour_limit_sec <= 3801);
+
+    /* Invalid results are ignored */
+    UsageData failed = make_failure(TRUE, 0);
+    forecast_update(&f, &failed, NOW + 1200);
+    CHECK(f.five_hour.util == 20.0);
+}
+
+static void test_forecast_windows(void)
+{
+    Forecast f;
+    forecast_init(&f);
+
+    /* Reaching 100% only after the reset: no warning */
+    UsageData u = make_usage(10.0, 5.0);
+    util_unix_to_iso8601(NOW + 3600, u.five_hour_resets, sizeof(u.five_hour_resets));
+    forecast_update(&f, &u, NOW);
+    UsageData v = u;
+    v.five_hour_util = 11.0;
+    forecast_update(&f, &v, NOW + 600);
+    CHECK(v.five_hour_limit_sec == 0);
+
+    /* A drop means the window rolled over; the old pace is forgotten */
+    forecast_init(&f);
+    u = make_usage(10.0, 5.0);
+    forecast_update(&f, &u, NOW);
+    u.five_hour_util = 50.0;
+    forecast_update(&f, &u, NOW + 600);
+    CHECK(u.five_hour_limit_sec > 0);
+    u.five_hour_util = 2.0;
+    forecast_update(&f, &u, NOW + 1200);
+    CHECK(u.five_hour_limit_sec == 0);
+    CHECK(!f.five_hour.has_rate);
+}
+
+/* ---- history.c ---- */
+
+static void test_history_ring(void)
+{
+    HistoryRing h;
+    wchar_t path[MAX_PATH];
+    if (!open_temp_ring(&h, path)) {
+        CHECK(!"temporary history file");
+        return;
+    }
+
+    UsageData latest;
+    LONGLONG when;
+    CHECK(history_count(&h) == 0);
+    CHECK(!history_latest(&h, HISTORY_MAIN_ACCOUNT, &latest, &when));
+
+    /* Fill until the count stops growing: that's the capacity */
+    DWORD capacity = 0;
+    for (DWORD i = 0; ; i++) {
+        UsageData u = make_usage((i % 100) + 0.25, 1.0);
+        history_append(&h, &u, (WORD)(i % 2), NOW + i);
+        if (history_count(&h) == capacity)
+            break;
+        capacity = history_count(&h);
+    }
+    CHECK(capacity > 1);
+
+    /* Wrap past the start a few more times */
+    for (DWORD i = capacity + 1; i < capacity + 10; i++) {
+        UsageData u = make_usage((i % 100) + 0.25, 1.0);
+        history_append(&h, &u, (WORD)(i % 2), NOW + i);
+    }
+    DWORD total = capacity + 10;
+    CHECK(history_count(&h) == capacity);
+    CHECK(history_appended(&h) == total);
+    CHECK(history_at(&h, 0)->timestamp == (DWORD)(NOW + total - capacity));
+    CHECK(history_at(&h, capacity - 1)->timestamp == (DWORD)(NOW + total - 1));
+
+    /* Latest per account, converted back */
+    DWORD last = total - 1;  /* Belongs to account last % 2 */
+    CHECK(history_latest(&h, (WORD)(last % 2), &latest, &when));
+    CHECK(when == NOW + (LONGLONG)last);
+    CHECK(latest.valid);
+    CHECK(latest.five_hour_util == (last % 100) + 0.25);
+    CHECK(latest.opus_util == -1.0);
+    CHECK(history_latest(&h, (WORD)((last - 1) % 2), &latest, &when));
+    CHECK(when == NOW + (LONGLONG)last - 1);
+    CHECK(!history_latest(&h, 7, &latest, &when));
+
+    /* Invalid results are not recorded */
+    UsageData failed = make_failure(TRUE, 0);
+    history_append(&h, &failed, HISTORY_MAIN_ACCOUNT, NOW + total);
+    CHECK(history_appended(&h) == total);
+
+    /* The ring and the export cursor survive a reopen */
+    history_set_exported(&h, total - 3);
+    history_close(&h);
+    CHECK(history_open(&h, path));
+    CHECK(history_count(&h) == capacity);
+    CHECK(history_appended(&h) == total);
+    CHECK(history_exported(&h) == total - 3);
+    CHECK(history_at(&h, capacity - 1)->timestamp == (DWORD)(NOW + total - 1));
+
+    history_close(&h);
+    DeleteFileW(path);
+}
+
+/* Write a version 1 or 2 ring by hand: the header was magic, version,
+ * record_size, capacity, head, count, the timestamp of the last exported
+ * sample and a reserved word */
+#define OLD_HISTORY_MAGIC    0x53484355
+#define OLD_HISTORY_CAPACITY 16384
+
+static BOOL write_old_ring(const wchar_t *path, DWORD version, DWORD exported_ts,
+                           const HistoryRecord *records, DWORD count)
+{
+    DWORD header[8] = {
+        OLD_HISTORY_MAGIC, version, sizeof(HistoryRecord), OLD_HISTORY_CAPACITY,
+        count, count, exported_ts, 0
+    };
+    HANDLE f = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE)
+        return FALSE;
+    DWORD written;
+    BOOL ok = WriteFile(f, header, sizeof(header), &written, NULL) &&
+              WriteFile(f, records, count * sizeof(HistoryRecord), &written, NULL);
+    CloseHandle(f);
+    return ok;
+}
+
+static void test_history_migration(void)
+{
+    HistoryRing h;
+    wchar_t path[MAX_PATH];
+    if (!open_temp_ring(&h, path)) {
+        CHECK(!"temporary history file");
+        return;
+    }
+    history_close(&h);
+
+    HistoryRecord records[3];
+    memset(records, 0, sizeof(records));
+    for (int i = 0; i < 3; i++) {
+        records[i].timestamp = (DWORD)(NOW + i);
+        records[i].five_hour_util = 1000;
+        records[i].seven_day_util = HISTORY_NO_VALUE;
+        records[i].opus_util = HISTORY_NO_VALUE;
+        records[i].sonnet_util = HISTORY_NO_VALUE;
+    }
+
+    /* Version 2, first two samples exported: only the third is left */
+    CHECK(write_old_ring(path, 2, (DWORD)(NOW + 1), records, 3));
+    CHECK(history_open(&h, path));
+    CHECK(history_count(&h) == 3);
+    CHECK(history_appended(&h) == 3);
+    CHECK(history_exported(&h) == 2);
+    CHECK(history_at(&h, 2)->timestamp == (DWORD)(NOW + 2));
+    history_close(&h);
+
+    /* Version 1 written by the exporter keeps its cursor too */
+    CHECK(write_old_ring(path, 1, (DWORD)(NOW + 2), records, 3));
+    CHECK(history_open(&h, path));
+    CHECK(history_exported(&h) == 3);
+    history_close(&h);
+
+    /* Version 1 from before the exporter: nothing exported yet */
+    CHECK(write_old_ring(path, 1, 0, records, 3));
+    CHECK(history_open(&h, path));
+    CHECK(history_appended(&h) == 3);
+    CHECK(history_exported(&h) == 0);
+    history_close(&h);
+
+    DeleteFileW(path);
+}
+
+/* ---- export.c ---- */
+
+static void test_export_cursor(void)
+{
+    HistoryRing h;
+    wchar_t path[MAX_PATH];
+    if (!open_temp_ring(&h, path)) {
+        CHECK(!"temporary history file");
+        return;
+    }
+
+    CHECK(!export_init(L"http://collector.example/write", L"", &h, NULL, 0));
+    CHECK(export_init(L"https://collector.example/write?precision=s", L"",
+                      &h, NULL, 0));
+
+    /* Nothing recorded: nothing sent */
+    g_posts = 0;
+    export_flush();
+    CHECK(g_posts == 0);
+
+    UsageData u = make_usage(12.5, 3.0);
+    for (int i = 0; i < 3; i++)
+        history_append(&h, &u, HISTORY_MAIN_ACCOUNT, NOW + i);
+
+    /* One batch in flight at a time; the cursor moves on success only */
+    export_flush();
+    CHECK(g_posts == 1);
+    CHECK(count_lines(g_posted) == 3);
+    CHECK(strstr(g_posted, "five_hour=12.50") != NULL);
+    export_flush();
+    CHECK(g_posts == 1);
+    CHECK(history_exported(&h) == 0);
+
+    export_on_done(503);
+    CHECK(history_exported(&h) == 0);
+    export_flush();
+    CHECK(g_posts == 2);
+    CHECK(count_lines(g_posted) == 3);
+    export_on_done(204);
+    CHECK(history_exported(&h) == 3);
+    export_flush();
+    CHECK(g_posts == 2);
+
+    /* Samples sharing a second are each sent exactly once */
+    history_append(&h, &u, HISTORY_MAIN_ACCOUNT, NOW + 10);
+    history_append(&h, &u, 1, NOW + 10);
+    export_flush();
+    CHECK(g_posts == 3);
+    CHECK(count_lines(g_posted) == 2);
+    export_on_done(204);
+    CHECK(history_exported(&h) == 5);
+
+    /* Unsent samples overwritten by a full ring: restart at the oldest,
+     * and a backlog larger than a batch goes out in several */
+    while (history_appended(&h) - history_count(&h) <= history_exported(&h))
+        history_append(&h, &u, HISTORY_MAIN_ACCOUNT, NOW + 100);
+    DWORD end = history_appended(&h);
+    DWORD oldest = end - history_count(&h);
+    CHECK(oldest > history_exported(&h));
+
+    g_posts = 0;
+    export_flush();
+    CHECK(g_posts == 1);
+    int lines = count_lines(g_posted);
+    CHECK(lines > 0 && (DWORD)lines < history_count(&h));
+    export_on_done(200);
+    CHECK(history_exported(&h) == oldest + lines);
+    CHECK(g_posts == 2);  /* The next batch went out straight away */
+    while (g_posts < 1000 && history_exported(&h) != end) {
+        int before = g_posts;
+        export_on_done(200);
+        if (g_posts == before)
+            break;
+    }
+    CHECK(history_exported(&h) == end);
+
+    export_shutdown();
+    history_close(&h);
+    DeleteFileW(path);
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    test_retry_backoff();
+    test_retry_after();
+    test_sched_rules();
+    test_sched_idle_backoff();
+    test_sched_reset_snap();
+    test_forecast_rate();
+    test_forecast_windows();
+    test_history_ring();
+    test_history_migration();
+    test_export_cursor();
+
+    printf("%d checks, %d failures\n", g_checks, g_failures);
+    return g_failures ? 1 : 0;
+}